@@ -7,43 +7,203 @@
  * - uio_info registration
  * - Memory region export to user space
  * - User space can mmap and access device memory
+ * - Simulated interrupt with irqcontrol (enable/disable from user space)
+ * - Large vmalloc and physically contiguous regions
  *
  * This demo uses a kernel-allocated buffer as simulated
  * "device memory" that user space can read/write via mmap.
+ * An hrtimer plays the device: each tick updates a sequence
+ * counter and timestamp in that memory and, unless user space
+ * has disabled it, raises a UIO event.
  */
 
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/uio_driver.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/gfp.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 
 #define UIO_DEMO_MEM_SIZE 4096
 
+/*
+ * Simulated registers at UIO_DEMO_REGS_OFFSET in map 0. Layout must
+ * match uio_userspace.c.
+ */
+#define UIO_DEMO_REGS_OFFSET 256
+
+struct uio_demo_regs {
+	u32 seq;          /* Incremented on every tick */
+	u32 irq_enabled;  /* Mirrors the irqcontrol state */
+	u64 tick_ns;      /* CLOCK_MONOTONIC of the last tick */
+	u64 ticks_masked; /* Ticks that raised no event */
+};
+
+static unsigned int irq_period_us = 1000;
+module_param(irq_period_us, uint, 0444);
+MODULE_PARM_DESC(irq_period_us, "Simulated interrupt period in us, 0 for no interrupt (default: 1000)");
+
+static unsigned int bulk_size_kb = 4096;
+module_param(bulk_size_kb, uint, 0444);
+MODULE_PARM_DESC(bulk_size_kb, "Size of the vmalloc region (map 1) in KiB, 0 to omit (default: 4096)");
+
+static unsigned int contig_order = 9;
+module_param(contig_order, uint, 0444);
+MODULE_PARM_DESC(contig_order, "Page order of the physically contiguous region (map 2) (default: 9, 2 MiB on 4K pages)");
+
 struct uio_demo_dev {
 	struct uio_info info;
 	void *mem;  /* Simulated device memory */
+	struct uio_demo_regs *regs;
+	struct hrtimer timer;
+	ktime_t period;
+	bool irq_enabled;
+	void *bulk;
+	struct page *contig;
 };
 
+static enum hrtimer_restart uio_demo_tick(struct hrtimer *t)
+{
+	struct uio_demo_dev *dev = container_of(t, struct uio_demo_dev, timer);
+	struct uio_demo_regs *regs = dev->regs;
+
+	/* Timestamp before the sequence, so a reader that sees seq change sees it */
+	WRITE_ONCE(regs->tick_ns, ktime_get_ns());
+	smp_wmb();
+	WRITE_ONCE(regs->seq, regs->seq + 1);
+
+	/* Hard irq context, like a real handler calling uio_event_notify() */
+	if (READ_ONCE(dev->irq_enabled))
+		uio_event_notify(&dev->info);
+	else
+		WRITE_ONCE(regs->ticks_masked, regs->ticks_masked + 1);
+
+	hrtimer_forward_now(t, dev->period);
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Called for write(fd, &irq_on, 4) on /dev/uioN. A real device would
+ * set or clear its interrupt mask bit here. The "device" keeps ticking
+ * while masked, so user space can busy-poll seq without interrupts.
+ */
+static int uio_demo_irqcontrol(struct uio_info *info, s32 irq_on)
+{
+	struct uio_demo_dev *dev = info->priv;
+
+	WRITE_ONCE(dev->irq_enabled, !!irq_on);
+	WRITE_ONCE(dev->regs->irq_enabled, !!irq_on);
+	return 0;
+}
+
+static void uio_demo_stop_timer(void *data)
+{
+	struct uio_demo_dev *dev = data;
+
+	hrtimer_cancel(&dev->timer);
+}
+
+static void uio_demo_free_bulk(void *data)
+{
+	vfree(data);
+}
+
+static void uio_demo_free_contig(void *data)
+{
+	__free_pages(data, contig_order);
+}
+
+/*
+ * Map 1: a large virtually contiguous buffer. UIO maps it one page at
+ * a time on fault, so each first touch of a page costs a fault.
+ */
+static int uio_demo_add_bulk(struct uio_demo_dev *dev, struct device *d, int n)
+{
+	size_t size = PAGE_ALIGN((size_t)bulk_size_kb * 1024);
+	int ret;
+
+	dev->bulk = vmalloc_user(size);
+	if (!dev->bulk)
+		return -ENOMEM;
+
+	ret = devm_add_action_or_reset(d, uio_demo_free_bulk, dev->bulk);
+	if (ret)
+		return ret;
+
+	dev->info.mem[n].name = "bulk_memory";
+	dev->info.mem[n].addr = (phys_addr_t)(uintptr_t)dev->bulk;
+	dev->info.mem[n].size = size;
+	dev->info.mem[n].memtype = UIO_MEM_VIRTUAL;
+	return 0;
+}
+
+/*
+ * Map 2: physically contiguous, naturally aligned pages, as a DMA
+ * buffer for a kernel-bypass driver would be. UIO_MEM_IOVA maps the
+ * whole region with remap_pfn_range() at mmap() time, cached, so
+ * there are no faults afterwards. (UIO_MEM_PHYS would map it uncached.)
+ * UIO never installs huge page table entries, so TLB reach is still
+ * 4K per entry.
+ */
+static int uio_demo_add_contig(struct uio_demo_dev *dev, struct device *d, int n)
+{
+	int ret;
+
+	dev->contig = alloc_pages(GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN,
+				  contig_order);
+	if (!dev->contig) {
+		dev_warn(d, "No order-%u contiguous block, map %d omitted\n",
+			 contig_order, n);
+		return 0;
+	}
+
+	ret = devm_add_action_or_reset(d, uio_demo_free_contig, dev->contig);
+	if (ret)
+		return ret;
+
+	dev->info.mem[n].name = "contig_memory";
+	dev->info.mem[n].addr = page_to_phys(dev->contig);
+	dev->info.mem[n].size = PAGE_SIZE << contig_order;
+	dev->info.mem[n].memtype = UIO_MEM_IOVA;
+	return 0;
+}
+
 static int uio_demo_probe(struct platform_device *pdev)
 {
 	struct uio_demo_dev *dev;
+	int n = 1;
+	int ret;
 
 	dev = devm_kzalloc(&pdev->dev, sizeof(*dev), GFP_KERNEL);
 	if (!dev)
 		return -ENOMEM;
 
-	/* Allocate simulated device memory */
-	dev->mem = devm_kzalloc(&pdev->dev, UIO_DEMO_MEM_SIZE, GFP_KERNEL);
+	/* Allocate simulated device memory; whole page, as it gets mapped */
+	dev->mem = (void *)devm_get_free_pages(&pdev->dev,
+					       GFP_KERNEL | __GFP_ZERO, 0);
 	if (!dev->mem)
 		return -ENOMEM;
 
 	/* Pre-fill with identification data */
 	memcpy(dev->mem, "UIO-DEMO", 8);
+	dev->regs = dev->mem + UIO_DEMO_REGS_OFFSET;
 
 	/* Configure UIO device */
 	dev->info.name = "uio-demo";
 	dev->info.version = "1.0";
-	dev->info.irq = UIO_IRQ_NONE;  /* No IRQ for this demo */
+	dev->info.priv = dev;
+
+	if (irq_period_us) {
+		/* No Linux IRQ line; the driver calls uio_event_notify() itself */
+		dev->info.irq = UIO_IRQ_CUSTOM;
+		dev->info.irqcontrol = uio_demo_irqcontrol;
+		dev->irq_enabled = true;
+		dev->regs->irq_enabled = 1;
+	} else {
+		dev->info.irq = UIO_IRQ_NONE;
+	}
 
 	/* Export memory region to user space */
 	dev->info.mem[0].name = "device_memory";
@@ -51,11 +211,48 @@ static int uio_demo_probe(struct platform_device *pdev)
 	dev->info.mem[0].size = UIO_DEMO_MEM_SIZE;
 	dev->info.mem[0].memtype = UIO_MEM_LOGICAL;
 
+	if (bulk_size_kb) {
+		ret = uio_demo_add_bulk(dev, &pdev->dev, n);
+		if (ret)
+			return ret;
+		n++;
+	}
+
+	ret = uio_demo_add_contig(dev, &pdev->dev, n);
+	if (ret)
+		return ret;
+
 	platform_set_drvdata(pdev, dev);
 
-	return devm_uio_register_device(&pdev->dev, &dev->info);
+	ret = devm_uio_register_device(&pdev->dev, &dev->info);
+	if (ret)
+		return ret;
+
+	if (!irq_period_us)
+		return 0;
+
+	/* Registered after the UIO device, so the timer stops before it goes */
+	hrtimer_init(&dev->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_HARD);
+	dev->timer.function = uio_demo_tick;
+	dev->period = us_to_ktime(irq_period_us);
+
+	ret = devm_add_action_or_reset(&pdev->dev, uio_demo_stop_timer, dev);
+	if (ret)
+		return ret;
+
+	hrtimer_start(&dev->timer, dev->period, HRTIMER_MODE_REL_HARD);
+
+	dev_info(&pdev->dev, "Simulated IRQ every %u us\n", irq_period_us);
+	return 0;
 }
 
+static struct platform_driver uio_demo_driver = {
+	.probe = uio_demo_probe,
+	.driver = {
+		.name = "uio-demo",
+	},
+};
+
 /* Platform device for self-registration (demo only) */
 static struct platform_device *pdev;
 
@@ -63,34 +260,37 @@ static int __init uio_demo_init(void)
 {
 	int ret;
 
+	ret = platform_driver_register(&uio_demo_driver);
+	if (ret)
+		return ret;
+
 	pdev = platform_device_alloc("uio-demo", -1);
-	if (!pdev)
-		return -ENOMEM;
+	if (!pdev) {
+		ret = -ENOMEM;
+		goto err_driver;
+	}
 
 	ret = platform_device_add(pdev);
 	if (ret) {
 		platform_device_put(pdev);
-		return ret;
+		goto err_driver;
 	}
 
 	pr_info("uio_demo: device registered as /dev/uioN\n");
 	return 0;
+
+err_driver:
+	platform_driver_unregister(&uio_demo_driver);
+	return ret;
 }
 
 static void __exit uio_demo_exit(void)
 {
 	platform_device_unregister(pdev);
+	platform_driver_unregister(&uio_demo_driver);
 	pr_info("uio_demo: unregistered\n");
 }
 
-static struct platform_driver uio_demo_driver = {
-	.probe = uio_demo_probe,
-	.driver = {
-		.name = "uio-demo",
-	},
-};
-
-module_platform_driver(uio_demo_driver);
 module_init(uio_demo_init);
 module_exit(uio_demo_exit);
 
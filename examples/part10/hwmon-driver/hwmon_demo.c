@@ -4,6 +4,10 @@
  *
  * Demonstrates implementing a hardware monitoring driver with
  * temperature, voltage, and fan speed sensors.
+ *
+ * Sensor reads are served from a cache that a delayed work refreshes
+ * every update_interval milliseconds, so sysfs reads never touch the
+ * (simulated) hardware.
  */
 
 #include <linux/module.h>
@@ -12,15 +16,48 @@
 #include <linux/hwmon-sysfs.h>
 #include <linux/random.h>
 #include <linux/of.h>
+#include <linux/seqlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/sysfs.h>
 
 #define DRIVER_NAME     "demo-hwmon"
 #define NUM_TEMP        2
 #define NUM_VOLTAGE     2
 #define NUM_FAN         1
 
+#define UPDATE_INTERVAL_DEFAULT 1000    /* ms */
+#define UPDATE_INTERVAL_MIN     10
+#define UPDATE_INTERVAL_MAX     60000
+
+/* One complete reading of every channel */
+struct demo_hwmon_sample {
+    long temp[NUM_TEMP];
+    long voltage[NUM_VOLTAGE];
+    long fan_rpm[NUM_FAN];
+    unsigned long taken;          /* jiffies */
+};
+
 struct demo_hwmon {
     struct device *hwmon_dev;
 
+    /*
+     * Written only by the refresh work; readers retry if a refresh
+     * ran while they copied, and never block it.
+     */
+    seqlock_t lock;
+    struct demo_hwmon_sample sample;
+    struct delayed_work refresh_work;
+    unsigned long update_interval;  /* ms */
+
+    /*
+     * Serializes update_interval writes against teardown: once stopping
+     * is set, nothing re-arms refresh_work.
+     */
+    struct mutex update_lock;
+    bool stopping;
+
     /* Simulated sensor values */
     long temp[NUM_TEMP];          /* millidegrees */
     long temp_max[NUM_TEMP];
@@ -63,16 +100,96 @@ static long simulate_fan(struct demo_hwmon *hwmon, int channel)
     return max(0L, base + variation);
 }
 
+/* Read every channel, as one bus transaction would on a real chip */
+static void demo_hwmon_take_sample(struct demo_hwmon *hwmon,
+                                   struct demo_hwmon_sample *s)
+{
+    int i;
+
+    for (i = 0; i < NUM_TEMP; i++)
+        s->temp[i] = simulate_temp(hwmon, i);
+    for (i = 0; i < NUM_VOLTAGE; i++)
+        s->voltage[i] = hwmon->voltage[i];
+    for (i = 0; i < NUM_FAN; i++)
+        s->fan_rpm[i] = simulate_fan(hwmon, i);
+    s->taken = jiffies;
+}
+
+static void demo_hwmon_get_sample(struct demo_hwmon *hwmon,
+                                  struct demo_hwmon_sample *s)
+{
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&hwmon->lock);
+        *s = hwmon->sample;
+    } while (read_seqretry(&hwmon->lock, seq));
+}
+
+/* Wake poll() on an alarm file, from a new sample or a threshold write */
+static void demo_hwmon_notify_if(struct device *hwmon_dev, bool before,
+                                 bool after, enum hwmon_sensor_types type,
+                                 u32 attr, int channel)
+{
+    if (before != after)
+        hwmon_notify_event(hwmon_dev, type, attr, channel);
+}
+
+static void demo_hwmon_refresh(struct work_struct *work)
+{
+    struct demo_hwmon *hwmon = container_of(to_delayed_work(work),
+                                            struct demo_hwmon, refresh_work);
+    struct device *d = hwmon->hwmon_dev;
+    struct demo_hwmon_sample s, old;
+    int i;
+
+    /* Sample outside the lock; a real bus read may sleep */
+    demo_hwmon_take_sample(hwmon, &s);
+
+    write_seqlock(&hwmon->lock);
+    old = hwmon->sample;
+    hwmon->sample = s;
+    write_sequnlock(&hwmon->lock);
+
+    /* Wake poll() on alarm files whose state changed */
+    for (i = 0; i < NUM_TEMP; i++) {
+        demo_hwmon_notify_if(d, old.temp[i] > hwmon->temp_max[i],
+                             s.temp[i] > hwmon->temp_max[i],
+                             hwmon_temp, hwmon_temp_max_alarm, i);
+        demo_hwmon_notify_if(d, old.temp[i] > hwmon->temp_crit[i],
+                             s.temp[i] > hwmon->temp_crit[i],
+                             hwmon_temp, hwmon_temp_crit_alarm, i);
+    }
+    for (i = 0; i < NUM_FAN; i++)
+        demo_hwmon_notify_if(d, old.fan_rpm[i] < hwmon->fan_min[i],
+                             s.fan_rpm[i] < hwmon->fan_min[i],
+                             hwmon_fan, hwmon_fan_alarm, i);
+
+    schedule_delayed_work(&hwmon->refresh_work,
+                          msecs_to_jiffies(READ_ONCE(hwmon->update_interval)));
+}
+
 static int demo_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
                            u32 attr, int channel, long *val)
 {
     struct demo_hwmon *hwmon = dev_get_drvdata(dev);
+    struct demo_hwmon_sample s;
+
+    /* Only the cache; never the hardware */
+    demo_hwmon_get_sample(hwmon, &s);
 
     switch (type) {
+    case hwmon_chip:
+        if (attr == hwmon_chip_update_interval) {
+            *val = READ_ONCE(hwmon->update_interval);
+            return 0;
+        }
+        break;
+
     case hwmon_temp:
         switch (attr) {
         case hwmon_temp_input:
-            *val = simulate_temp(hwmon, channel);
+            *val = s.temp[channel];
             return 0;
         case hwmon_temp_max:
             *val = hwmon->temp_max[channel];
@@ -81,10 +198,10 @@ static int demo_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
             *val = hwmon->temp_crit[channel];
             return 0;
         case hwmon_temp_max_alarm:
-            *val = simulate_temp(hwmon, channel) > hwmon->temp_max[channel];
+            *val = s.temp[channel] > hwmon->temp_max[channel];
             return 0;
         case hwmon_temp_crit_alarm:
-            *val = simulate_temp(hwmon, channel) > hwmon->temp_crit[channel];
+            *val = s.temp[channel] > hwmon->temp_crit[channel];
             return 0;
         }
         break;
@@ -92,7 +209,7 @@ static int demo_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
     case hwmon_in:
         switch (attr) {
         case hwmon_in_input:
-            *val = hwmon->voltage[channel];
+            *val = s.voltage[channel];
             return 0;
         case hwmon_in_min:
             *val = hwmon->voltage_min[channel];
@@ -106,13 +223,13 @@ static int demo_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
     case hwmon_fan:
         switch (attr) {
         case hwmon_fan_input:
-            *val = simulate_fan(hwmon, channel);
+            *val = s.fan_rpm[channel];
             return 0;
         case hwmon_fan_min:
             *val = hwmon->fan_min[channel];
             return 0;
         case hwmon_fan_alarm:
-            *val = simulate_fan(hwmon, channel) < hwmon->fan_min[channel];
+            *val = s.fan_rpm[channel] < hwmon->fan_min[channel];
             return 0;
         }
         break;
@@ -128,15 +245,39 @@ static int demo_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
                             u32 attr, int channel, long val)
 {
     struct demo_hwmon *hwmon = dev_get_drvdata(dev);
+    struct demo_hwmon_sample s;
+    bool before;
+
+    demo_hwmon_get_sample(hwmon, &s);
 
     switch (type) {
+    case hwmon_chip:
+        if (attr == hwmon_chip_update_interval) {
+            val = clamp_val(val, UPDATE_INTERVAL_MIN, UPDATE_INTERVAL_MAX);
+            mutex_lock(&hwmon->update_lock);
+            WRITE_ONCE(hwmon->update_interval, val);
+            /* Apply now rather than after the old interval */
+            if (!hwmon->stopping)
+                mod_delayed_work(system_wq, &hwmon->refresh_work,
+                                 msecs_to_jiffies(val));
+            mutex_unlock(&hwmon->update_lock);
+            return 0;
+        }
+        break;
+
     case hwmon_temp:
         switch (attr) {
         case hwmon_temp_max:
+            before = s.temp[channel] > hwmon->temp_max[channel];
             hwmon->temp_max[channel] = val;
+            demo_hwmon_notify_if(dev, before, s.temp[channel] > val,
+                                 hwmon_temp, hwmon_temp_max_alarm, channel);
             return 0;
         case hwmon_temp_crit:
+            before = s.temp[channel] > hwmon->temp_crit[channel];
             hwmon->temp_crit[channel] = val;
+            demo_hwmon_notify_if(dev, before, s.temp[channel] > val,
+                                 hwmon_temp, hwmon_temp_crit_alarm, channel);
             return 0;
         }
         break;
@@ -155,7 +296,10 @@ static int demo_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
     case hwmon_fan:
         switch (attr) {
         case hwmon_fan_min:
+            before = s.fan_rpm[channel] < hwmon->fan_min[channel];
             hwmon->fan_min[channel] = val;
+            demo_hwmon_notify_if(dev, before, s.fan_rpm[channel] < val,
+                                 hwmon_fan, hwmon_fan_alarm, channel);
             return 0;
         }
         break;
@@ -207,6 +351,11 @@ static umode_t demo_hwmon_is_visible(const void *data,
                                      u32 attr, int channel)
 {
     switch (type) {
+    case hwmon_chip:
+        if (attr == hwmon_chip_update_interval)
+            return 0644;
+        break;
+
     case hwmon_temp:
         if (channel >= NUM_TEMP)
             return 0;
@@ -256,6 +405,7 @@ static umode_t demo_hwmon_is_visible(const void *data,
 }
 
 static const struct hwmon_channel_info * const demo_hwmon_info[] = {
+    HWMON_CHANNEL_INFO(chip, HWMON_C_UPDATE_INTERVAL),
     HWMON_CHANNEL_INFO(temp,
                        HWMON_T_INPUT | HWMON_T_MAX | HWMON_T_CRIT |
                        HWMON_T_LABEL | HWMON_T_MAX_ALARM | HWMON_T_CRIT_ALARM,
@@ -281,10 +431,61 @@ static const struct hwmon_chip_info demo_hwmon_chip_info = {
     .info = demo_hwmon_info,
 };
 
+/*
+ * Driver-specific bulk read: every input from one consistent sample in
+ * a single read(), for agents that would otherwise open one file per
+ * channel. Not part of the hwmon ABI; libsensors ignores it.
+ */
+static ssize_t samples_show(struct device *dev, struct device_attribute *attr,
+                            char *buf)
+{
+    struct demo_hwmon *hwmon = dev_get_drvdata(dev);
+    struct demo_hwmon_sample s;
+    int len = 0;
+    int i;
+
+    demo_hwmon_get_sample(hwmon, &s);
+
+    for (i = 0; i < NUM_TEMP; i++)
+        len += sysfs_emit_at(buf, len, "temp%d_input %ld\n", i + 1, s.temp[i]);
+    for (i = 0; i < NUM_VOLTAGE; i++)
+        len += sysfs_emit_at(buf, len, "in%d_input %ld\n", i, s.voltage[i]);
+    for (i = 0; i < NUM_FAN; i++)
+        len += sysfs_emit_at(buf, len, "fan%d_input %ld\n", i + 1, s.fan_rpm[i]);
+    len += sysfs_emit_at(buf, len, "age_ms %u\n",
+                         jiffies_to_msecs(jiffies - s.taken));
+
+    return len;
+}
+static DEVICE_ATTR_RO(samples);
+
+static struct attribute *demo_hwmon_attrs[] = {
+    &dev_attr_samples.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(demo_hwmon);
+
+/*
+ * The hwmon sysfs files are removed only after this runs, so an
+ * update_interval write can still arrive. stopping keeps it from
+ * re-arming the work once it has been cancelled.
+ */
+static void demo_hwmon_stop_refresh(void *data)
+{
+    struct demo_hwmon *hwmon = data;
+
+    mutex_lock(&hwmon->update_lock);
+    hwmon->stopping = true;
+    mutex_unlock(&hwmon->update_lock);
+
+    cancel_delayed_work_sync(&hwmon->refresh_work);
+}
+
 static int demo_hwmon_probe(struct platform_device *pdev)
 {
     struct demo_hwmon *hwmon;
     struct device *hwmon_dev;
+    int ret;
 
     hwmon = devm_kzalloc(&pdev->dev, sizeof(*hwmon), GFP_KERNEL);
     if (!hwmon)
@@ -315,17 +516,35 @@ static int demo_hwmon_probe(struct platform_device *pdev)
     hwmon->voltage_labels[1] = "5V Rail";
     hwmon->fan_labels[0] = "System Fan";
 
+    /* Fill the cache before the attributes appear */
+    seqlock_init(&hwmon->lock);
+    mutex_init(&hwmon->update_lock);
+    INIT_DELAYED_WORK(&hwmon->refresh_work, demo_hwmon_refresh);
+    hwmon->update_interval = UPDATE_INTERVAL_DEFAULT;
+    demo_hwmon_take_sample(hwmon, &hwmon->sample);
+
     hwmon_dev = devm_hwmon_device_register_with_info(&pdev->dev,
                                                      "demo_hwmon",
                                                      hwmon,
                                                      &demo_hwmon_chip_info,
-                                                     NULL);
+                                                     demo_hwmon_groups);
     if (IS_ERR(hwmon_dev))
         return PTR_ERR(hwmon_dev);
 
     hwmon->hwmon_dev = hwmon_dev;
     platform_set_drvdata(pdev, hwmon);
 
+    /*
+     * Registered after the hwmon device, so it runs before the device is
+     * unregistered while its attributes are still live; see above
+     */
+    ret = devm_add_action_or_reset(&pdev->dev, demo_hwmon_stop_refresh, hwmon);
+    if (ret)
+        return ret;
+
+    schedule_delayed_work(&hwmon->refresh_work,
+                          msecs_to_jiffies(hwmon->update_interval));
+
     dev_info(&pdev->dev, "HWMON demo registered: %d temp, %d voltage, %d fan\n",
              NUM_TEMP, NUM_VOLTAGE, NUM_FAN);
 
@@ -11,32 +11,98 @@
 #include <linux/platform_device.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include <linux/random.h>
 
 #define DRIVER_NAME     "demo-iio-adc"
 #define NUM_CHANNELS    4
 #define ADC_RESOLUTION  12          /* 12-bit ADC */
 #define VREF_MV         3300        /* 3.3V reference */
+#define ADC_SAMP_FREQ_DEFAULT   1000    /* Hz */
+#define ADC_SAMP_FREQ_MAX       100000  /* Hz */
 
 struct demo_adc {
     struct mutex lock;
     int scale_mv;
     /* Simulated channel values (raw ADC counts) */
     int channels[NUM_CHANNELS];
+
+    /* Buffered capture: hrtimer fires the trigger at samp_freq */
+    struct iio_trigger *trig;
+    struct hrtimer timer;
+    int samp_freq;
+    ktime_t period;
+
+    /* One scan: enabled channels packed in order, then the timestamp */
+    struct {
+        u16 chan[NUM_CHANNELS];
+        s64 timestamp __aligned(8);
+    } scan;
 };
 
 /* Simulate reading an ADC channel with some variation */
 static int demo_adc_read_channel(struct demo_adc *adc, int channel)
 {
     int base = adc->channels[channel];
-    int variation;
-
-    get_random_bytes(&variation, sizeof(variation));
-    variation = (variation % 100) - 50;  /* ±50 counts variation */
+    int variation = (int)get_random_u32_below(100) - 50;  /* ±50 counts */
 
     return clamp(base + variation, 0, (1 << ADC_RESOLUTION) - 1);
 }
 
+/*
+ * Runs in the pollfunc thread once per trigger. All enabled channels are
+ * converted under one lock acquisition and pushed as a single scan.
+ */
+static irqreturn_t demo_adc_trigger_handler(int irq, void *p)
+{
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    struct demo_adc *adc = iio_priv(indio_dev);
+    int bit, i = 0;
+
+    mutex_lock(&adc->lock);
+    for_each_set_bit(bit, indio_dev->active_scan_mask, indio_dev->masklength)
+        adc->scan.chan[i++] = demo_adc_read_channel(adc, bit);
+    mutex_unlock(&adc->lock);
+
+    iio_push_to_buffers_with_timestamp(indio_dev, &adc->scan, pf->timestamp);
+
+    iio_trigger_notify_done(indio_dev->trig);
+    return IRQ_HANDLED;
+}
+
+/* Hard-irq expiry, as iio_trigger_poll() requires */
+static enum hrtimer_restart demo_adc_timer_fn(struct hrtimer *timer)
+{
+    struct demo_adc *adc = container_of(timer, struct demo_adc, timer);
+
+    hrtimer_forward_now(timer, READ_ONCE(adc->period));
+    iio_trigger_poll(adc->trig);
+
+    return HRTIMER_RESTART;
+}
+
+static int demo_adc_set_trigger_state(struct iio_trigger *trig, bool state)
+{
+    struct demo_adc *adc = iio_trigger_get_drvdata(trig);
+
+    if (state)
+        hrtimer_start(&adc->timer, adc->period, HRTIMER_MODE_REL_HARD);
+    else
+        hrtimer_cancel(&adc->timer);
+
+    return 0;
+}
+
+static const struct iio_trigger_ops demo_adc_trigger_ops = {
+    .set_trigger_state = demo_adc_set_trigger_state,
+};
+
 static int demo_adc_read_raw(struct iio_dev *indio_dev,
                              struct iio_chan_spec const *chan,
                              int *val, int *val2, long mask)
@@ -44,6 +110,13 @@ static int demo_adc_read_raw(struct iio_dev *indio_dev,
     struct demo_adc *adc = iio_priv(indio_dev);
     int ret = 0;
 
+    /* A one-shot conversion would race the running buffer */
+    if (mask == IIO_CHAN_INFO_RAW) {
+        ret = iio_device_claim_direct_mode(indio_dev);
+        if (ret)
+            return ret;
+    }
+
     mutex_lock(&adc->lock);
 
     switch (mask) {
@@ -52,6 +125,11 @@ static int demo_adc_read_raw(struct iio_dev *indio_dev,
         ret = IIO_VAL_INT;
         break;
 
+    case IIO_CHAN_INFO_SAMP_FREQ:
+        *val = adc->samp_freq;
+        ret = IIO_VAL_INT;
+        break;
+
     case IIO_CHAN_INFO_SCALE:
         /* Scale to convert raw to millivolts: Vref / 2^bits */
         *val = adc->scale_mv;
@@ -69,6 +147,10 @@ static int demo_adc_read_raw(struct iio_dev *indio_dev,
     }
 
     mutex_unlock(&adc->lock);
+
+    if (mask == IIO_CHAN_INFO_RAW)
+        iio_device_release_direct_mode(indio_dev);
+
     return ret;
 }
 
@@ -78,6 +160,18 @@ static int demo_adc_write_raw(struct iio_dev *indio_dev,
 {
     struct demo_adc *adc = iio_priv(indio_dev);
 
+    if (mask == IIO_CHAN_INFO_SAMP_FREQ) {
+        if (val < 1 || val > ADC_SAMP_FREQ_MAX)
+            return -EINVAL;
+
+        /* Takes effect at the next timer expiry if capture is running */
+        mutex_lock(&adc->lock);
+        adc->samp_freq = val;
+        WRITE_ONCE(adc->period, ns_to_ktime(NSEC_PER_SEC / val));
+        mutex_unlock(&adc->lock);
+        return 0;
+    }
+
     if (mask != IIO_CHAN_INFO_RAW)
         return -EINVAL;
 
@@ -99,6 +193,7 @@ static int demo_adc_write_raw(struct iio_dev *indio_dev,
     .info_mask_separate = BIT(IIO_CHAN_INFO_RAW),              \
     .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE) |     \
                                 BIT(IIO_CHAN_INFO_OFFSET),      \
+    .info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),   \
     .scan_index = (num),                                        \
     .scan_type = {                                              \
         .sign = 'u',                                            \
@@ -113,6 +208,7 @@ static const struct iio_chan_spec demo_adc_channels[] = {
     DEMO_ADC_CHANNEL(1),
     DEMO_ADC_CHANNEL(2),
     DEMO_ADC_CHANNEL(3),
+    IIO_CHAN_SOFT_TIMESTAMP(NUM_CHANNELS),
 };
 
 static const struct iio_info demo_adc_info = {
@@ -124,7 +220,7 @@ static int demo_adc_probe(struct platform_device *pdev)
 {
     struct demo_adc *adc;
     struct iio_dev *indio_dev;
-    int i;
+    int ret;
 
     indio_dev = devm_iio_device_alloc(&pdev->dev, sizeof(*adc));
     if (!indio_dev)
@@ -140,12 +236,39 @@ static int demo_adc_probe(struct platform_device *pdev)
     adc->channels[2] = 1024;  /* ~0.825V */
     adc->channels[3] = 0;     /* 0V */
 
+    adc->samp_freq = ADC_SAMP_FREQ_DEFAULT;
+    adc->period = ns_to_ktime(NSEC_PER_SEC / ADC_SAMP_FREQ_DEFAULT);
+    hrtimer_init(&adc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_HARD);
+    adc->timer.function = demo_adc_timer_fn;
+
     indio_dev->name = DRIVER_NAME;
     indio_dev->info = &demo_adc_info;
     indio_dev->modes = INDIO_DIRECT_MODE;
     indio_dev->channels = demo_adc_channels;
     indio_dev->num_channels = ARRAY_SIZE(demo_adc_channels);
 
+    /* Our own trigger, selected by default so capture needs no setup */
+    adc->trig = devm_iio_trigger_alloc(&pdev->dev, "%s-dev%d",
+                                       indio_dev->name,
+                                       iio_device_id(indio_dev));
+    if (!adc->trig)
+        return -ENOMEM;
+
+    adc->trig->ops = &demo_adc_trigger_ops;
+    iio_trigger_set_drvdata(adc->trig, adc);
+
+    ret = devm_iio_trigger_register(&pdev->dev, adc->trig);
+    if (ret)
+        return ret;
+
+    indio_dev->trig = iio_trigger_get(adc->trig);
+
+    ret = devm_iio_triggered_buffer_setup(&pdev->dev, indio_dev,
+                                          iio_pollfunc_store_time,
+                                          demo_adc_trigger_handler, NULL);
+    if (ret)
+        return ret;
+
     platform_set_drvdata(pdev, indio_dev);
 
     return devm_iio_device_register(&pdev->dev, indio_dev);
@@ -7,96 +7,571 @@
  * - Basic net_device_ops (open, stop, start_xmit)
  * - NAPI for RX processing
  * - Statistics tracking
+ * - Lock-free single-producer/single-consumer RX ring
+ * - Multiple TX/RX queue pairs, each with its own NAPI instance
+ * - Flow-hash (RSS-style) TX queue selection
+ * - Zero-copy loopback of the TX skb, copying only shared skbs
+ * - Per-queue 64-bit statistics with u64_stats_sync, ethtool -S
+ * - Native XDP (DROP/PASS/TX/REDIRECT) in NAPI poll and ndo_xdp_xmit
+ * - xmit_more doorbell batching, BQL and TX queue stop/wake
  *
  * Packets transmitted are looped back and received on the same interface.
+ * TX queue N always loops back into RX ring N, polled by NAPI instance N.
+ *
+ * Usage:
+ *   insmod vnet_demo.ko                     # 256-entry RX ring
+ *   insmod vnet_demo.ko rx_ring_size=1024   # rounded up to a power of two
+ *   insmod vnet_demo.ko num_queues=8        # 8 queue pairs, hashed by flow
+ *   insmod vnet_demo.ko num_queues=8 rss=0  # let XPS pick the TX queue
+ *   insmod vnet_demo.ko zerocopy=0          # skb_copy() every packet
+ *   ip link set dev vnet0 xdpdrv obj prog.o sec xdp
  */
 
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/cache.h>
+#include <linux/ethtool.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/bpf_trace.h>
+#include <net/xdp.h>
 
 #define DRIVER_NAME "vnet_demo"
-#define RX_RING_SIZE 64
+#define RX_RING_MIN 2
+#define RX_RING_MAX 32768
+#define VNET_MAX_QUEUES 64
+#define VNET_XDP_TX_BATCH 16
+
+/* Largest frame that fits in one page with XDP headroom and skb tailroom */
+#define VNET_XDP_MAX_LEN (PAGE_SIZE - XDP_PACKET_HEADROOM - \
+                          SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+static unsigned int rx_ring_size = 256;
+module_param(rx_ring_size, uint, 0444);
+MODULE_PARM_DESC(rx_ring_size, "RX ring entries, power of two (default: 256)");
+
+static unsigned int num_queues = 1;
+module_param(num_queues, uint, 0444);
+MODULE_PARM_DESC(num_queues, "TX/RX queue pairs (default: 1, max: 64)");
+
+static bool rss = true;
+module_param(rss, bool, 0444);
+MODULE_PARM_DESC(rss, "Pick TX queue by flow hash; 0 = core/XPS selection (default: 1)");
+
+static bool zerocopy = true;
+module_param(zerocopy, bool, 0644);
+MODULE_PARM_DESC(zerocopy, "Loop the TX skb back without copying it (default: 1)");
+
+/*
+ * Single-producer/single-consumer ring (simulates a hardware RX ring).
+ *
+ * start_xmit is the only producer (serialized by the TX queue lock) and
+ * NAPI poll is the only consumer, so no lock is needed. Each side owns one
+ * index and only reads the other's, with acquire/release ordering making
+ * the slot contents visible before the index that publishes them. The
+ * indices run freely and are masked on access; keeping them on separate
+ * cache lines stops the two CPUs bouncing a line on every packet.
+ */
+struct vnet_ring {
+    struct sk_buff **slots;
+    unsigned int mask;          /* size - 1 */
+
+    unsigned int head ____cacheline_aligned_in_smp;  /* Written by producer */
+    unsigned int tail ____cacheline_aligned_in_smp;  /* Written by consumer */
+};
+
+/*
+ * Counters with exactly one writer each: TX stats are written by
+ * start_xmit under the queue's TX lock, RX stats by its NAPI poll.
+ * u64_stats_sync makes 64-bit reads consistent on 32-bit hosts and
+ * compiles away on 64-bit.
+ */
+struct vnet_queue_stats {
+    u64_stats_t packets;
+    u64_stats_t bytes;
+    u64_stats_t drops;
+    struct u64_stats_sync syncp;
+};
+
+/* Driver-private state of an skb while it sits on an RX ring */
+struct vnet_skb_cb {
+    bool from_xdp;              /* Sent by XDP; not run through XDP again */
+};
+#define VNET_SKB_CB(skb) ((struct vnet_skb_cb *)(skb)->cb)
+
+/* XDP verdict counters, written only by the queue's NAPI poll */
+struct vnet_xdp_stats {
+    u64_stats_t drop;
+    u64_stats_t tx;
+    u64_stats_t redirect;
+    struct u64_stats_sync syncp;
+};
+
+/* One TX queue, the RX ring it loops back into, and the NAPI that drains it */
+struct vnet_queue {
+    struct vnet_priv *priv;
+    struct napi_struct napi;
+    struct vnet_ring rx_ring;
+    struct xdp_rxq_info xdp_rxq;
+    unsigned int index;
+
+    /*
+     * Separate cache lines: the TX and NAPI CPUs update these on every
+     * packet. tx_stats.drops counts loopback packets lost before reaching
+     * the RX ring (ring full or copy failure) and is reported as rx_dropped.
+     * xdp_xmit_stats counts ndo_xdp_xmit frames, also under the TX lock;
+     * its drops (no ring space) are reported as tx_dropped.
+     */
+    struct vnet_queue_stats tx_stats ____cacheline_aligned_in_smp;
+    struct vnet_queue_stats xdp_xmit_stats;
+    struct vnet_queue_stats rx_stats ____cacheline_aligned_in_smp;
+    struct vnet_xdp_stats xdp_stats;
+};
+
+/* XDP_TX frames collected during one NAPI poll, sent in one burst */
+struct vnet_xdp_tx_batch {
+    struct xdp_frame *frames[VNET_XDP_TX_BATCH];
+    unsigned int count;
+};
 
 struct vnet_priv {
     struct net_device *ndev;
-    struct napi_struct napi;
+    struct vnet_queue *queues;
+    unsigned int num_queues;
+    struct bpf_prog __rcu *xdp_prog;
+};
 
-    /* Simple RX ring buffer (simulates hardware) */
-    struct sk_buff *rx_ring[RX_RING_SIZE];
-    int rx_head;  /* Next slot to write */
-    int rx_tail;  /* Next slot to read */
-    spinlock_t rx_lock;
-
-    /* Statistics */
-    u64 tx_packets;
-    u64 tx_bytes;
-    u64 rx_packets;
-    u64 rx_bytes;
+/* Fields of vnet_queue_stats reported per queue by ethtool -S */
+static const char vnet_queue_stat_names[][ETH_GSTRING_LEN] = {
+    "tx_queue_%u_packets",
+    "tx_queue_%u_bytes",
+    "tx_queue_%u_xdp_xmit",
+    "tx_queue_%u_xdp_xmit_drops",
+    "rx_queue_%u_packets",
+    "rx_queue_%u_bytes",
+    "rx_queue_%u_drops",
+    "rx_queue_%u_xdp_drop",
+    "rx_queue_%u_xdp_tx",
+    "rx_queue_%u_xdp_redirect",
 };
+#define VNET_QUEUE_STATS ARRAY_SIZE(vnet_queue_stat_names)
+
+/* ============ Statistics Helpers ============ */
+
+static void vnet_stats_add(struct vnet_queue_stats *st, unsigned int len)
+{
+    u64_stats_update_begin(&st->syncp);
+    u64_stats_inc(&st->packets);
+    u64_stats_add(&st->bytes, len);
+    u64_stats_update_end(&st->syncp);
+}
+
+static void vnet_stats_drop(struct vnet_queue_stats *st)
+{
+    u64_stats_update_begin(&st->syncp);
+    u64_stats_inc(&st->drops);
+    u64_stats_update_end(&st->syncp);
+}
+
+static void vnet_xdp_stats_inc(struct vnet_xdp_stats *st, u64_stats_t *field)
+{
+    u64_stats_update_begin(&st->syncp);
+    u64_stats_inc(field);
+    u64_stats_update_end(&st->syncp);
+}
+
+/* Consistent snapshot of one stats block, safe against a concurrent writer */
+static void vnet_stats_read(const struct vnet_queue_stats *st,
+                            u64 *packets, u64 *bytes, u64 *drops)
+{
+    unsigned int start;
+
+    do {
+        start = u64_stats_fetch_begin(&st->syncp);
+        *packets = u64_stats_read(&st->packets);
+        *bytes = u64_stats_read(&st->bytes);
+        *drops = u64_stats_read(&st->drops);
+    } while (u64_stats_fetch_retry(&st->syncp, start));
+}
+
+static void vnet_xdp_stats_read(const struct vnet_xdp_stats *st,
+                                u64 *drop, u64 *tx, u64 *redirect)
+{
+    unsigned int start;
+
+    do {
+        start = u64_stats_fetch_begin(&st->syncp);
+        *drop = u64_stats_read(&st->drop);
+        *tx = u64_stats_read(&st->tx);
+        *redirect = u64_stats_read(&st->redirect);
+    } while (u64_stats_fetch_retry(&st->syncp, start));
+}
 
 /* ============ RX Ring Helpers (simulate hardware) ============ */
 
-static bool rx_ring_full(struct vnet_priv *priv)
+static int vnet_ring_init(struct vnet_ring *ring, unsigned int size)
+{
+    ring->slots = kcalloc(size, sizeof(*ring->slots), GFP_KERNEL);
+    if (!ring->slots)
+        return -ENOMEM;
+
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return 0;
+}
+
+static void vnet_ring_free(struct vnet_ring *ring)
 {
-    return ((priv->rx_head + 1) % RX_RING_SIZE) == priv->rx_tail;
+    kfree(ring->slots);
+    ring->slots = NULL;
 }
 
-static bool rx_ring_empty(struct vnet_priv *priv)
+/* Producer side: returns false if the ring is full */
+static bool vnet_ring_produce(struct vnet_ring *ring, struct sk_buff *skb)
 {
-    return priv->rx_head == priv->rx_tail;
+    unsigned int head = ring->head;
+    /* Pairs with the release in vnet_ring_consume(): slot is free again */
+    unsigned int tail = smp_load_acquire(&ring->tail);
+
+    if (head - tail > ring->mask)
+        return false;
+
+    ring->slots[head & ring->mask] = skb;
+    /* Publish the slot before the new head becomes visible */
+    smp_store_release(&ring->head, head + 1);
+    return true;
 }
 
-static void rx_ring_enqueue(struct vnet_priv *priv, struct sk_buff *skb)
+/* Producer side: true if vnet_ring_produce() would fail */
+static bool vnet_ring_full(struct vnet_ring *ring)
 {
-    priv->rx_ring[priv->rx_head] = skb;
-    priv->rx_head = (priv->rx_head + 1) % RX_RING_SIZE;
+    return ring->head - smp_load_acquire(&ring->tail) > ring->mask;
 }
 
-static struct sk_buff *rx_ring_dequeue(struct vnet_priv *priv)
+/* Entries currently queued; either side may call this */
+static unsigned int vnet_ring_count(struct vnet_ring *ring)
 {
-    struct sk_buff *skb = priv->rx_ring[priv->rx_tail];
-    priv->rx_ring[priv->rx_tail] = NULL;
-    priv->rx_tail = (priv->rx_tail + 1) % RX_RING_SIZE;
+    return READ_ONCE(ring->head) - READ_ONCE(ring->tail);
+}
+
+/* Wake a stopped TX queue once a quarter of the ring is free again */
+static unsigned int vnet_ring_wake_thresh(struct vnet_ring *ring)
+{
+    return max((ring->mask + 1) / 4, 1U);
+}
+
+/* Consumer side: returns NULL if the ring is empty */
+static struct sk_buff *vnet_ring_consume(struct vnet_ring *ring)
+{
+    unsigned int tail = ring->tail;
+    /* Pairs with the release in vnet_ring_produce(): slot is filled */
+    unsigned int head = smp_load_acquire(&ring->head);
+    struct sk_buff *skb;
+
+    if (tail == head)
+        return NULL;
+
+    skb = ring->slots[tail & ring->mask];
+    ring->slots[tail & ring->mask] = NULL;
+    /* Hand the slot back to the producer */
+    smp_store_release(&ring->tail, tail + 1);
     return skb;
 }
 
+/* Free anything left in the ring; both sides must be stopped */
+static void vnet_ring_drain(struct vnet_ring *ring)
+{
+    struct sk_buff *skb;
+
+    while ((skb = vnet_ring_consume(ring)))
+        dev_kfree_skb(skb);
+}
+
+/* ============ XDP ============ */
+
+/*
+ * Loop XDP frames back into @q's RX ring, as if transmitted on TX queue
+ * q->index. Taking that queue's TX lock makes us its ring's producer.
+ * @xmit is set for ndo_xdp_xmit, whose frames are counted separately.
+ * Returns how many frames were queued; the caller owns the rest.
+ */
+static int vnet_xdp_queue_frames(struct vnet_queue *q,
+                                 struct xdp_frame **frames, int n, bool xmit)
+{
+    struct net_device *ndev = q->priv->ndev;
+    struct netdev_queue *txq = netdev_get_tx_queue(ndev, q->index);
+    unsigned int bytes = 0;
+    int i;
+
+    __netif_tx_lock(txq, smp_processor_id());
+    for (i = 0; i < n; i++) {
+        struct sk_buff *skb;
+
+        /* Check space first: once built, the skb owns the frame */
+        if (vnet_ring_full(&q->rx_ring))
+            break;
+
+        skb = xdp_build_skb_from_frame(frames[i], ndev);
+        if (!skb)
+            break;
+
+        /*
+         * The ring holds raw frames, but xdp_build_skb_from_frame() has
+         * already pulled the MAC header with eth_type_trans().
+         */
+        skb_push(skb, ETH_HLEN);
+
+        /*
+         * Without this an XDP_TX'd frame would meet the same program on
+         * the RX ring and could bounce between the two forever.
+         */
+        VNET_SKB_CB(skb)->from_xdp = true;
+
+        /* Every ring entry is BQL-accounted, see vnet_poll() */
+        netdev_tx_sent_queue(txq, skb->len);
+        vnet_stats_add(&q->tx_stats, skb->len);
+        bytes += skb->len;
+        vnet_ring_produce(&q->rx_ring, skb);
+    }
+
+    if (xmit) {
+        u64_stats_update_begin(&q->xdp_xmit_stats.syncp);
+        u64_stats_add(&q->xdp_xmit_stats.packets, i);
+        u64_stats_add(&q->xdp_xmit_stats.bytes, bytes);
+        /* The core frees the frames we did not take */
+        u64_stats_add(&q->xdp_xmit_stats.drops, n - i);
+        u64_stats_update_end(&q->xdp_xmit_stats.syncp);
+    }
+    __netif_tx_unlock(txq);
+
+    if (i)
+        napi_schedule(&q->napi);
+    return i;
+}
+
+static void vnet_xdp_tx_flush(struct vnet_queue *q,
+                              struct vnet_xdp_tx_batch *batch)
+{
+    int sent, i;
+
+    if (!batch->count)
+        return;
+
+    sent = vnet_xdp_queue_frames(q, batch->frames, batch->count, false);
+    for (i = sent; i < batch->count; i++) {
+        xdp_return_frame_rx_napi(batch->frames[i]);
+        vnet_stats_drop(&q->rx_stats);
+    }
+    batch->count = 0;
+}
+
+/*
+ * Run the XDP program on one packet from the RX ring. The ring holds skbs
+ * whose heads come from kmalloc, so the packet is first copied into its
+ * own page: XDP_TX and XDP_REDIRECT need page-backed frames that can be
+ * released with xdp_return_frame(). Returns the skb for the stack on
+ * XDP_PASS, or NULL if XDP consumed the packet.
+ */
+static struct sk_buff *vnet_run_xdp(struct vnet_queue *q,
+                                    struct bpf_prog *prog,
+                                    struct sk_buff *skb,
+                                    struct vnet_xdp_tx_batch *batch,
+                                    bool *redirected)
+{
+    struct net_device *ndev = q->priv->ndev;
+    unsigned int len = skb->len;
+    struct xdp_frame *frame;
+    struct xdp_buff xdp;
+    struct page *page;
+    void *hard_start;
+    u32 act;
+
+    if (len > VNET_XDP_MAX_LEN)
+        goto drop_skb;
+
+    page = alloc_page(GFP_ATOMIC | __GFP_NOWARN);
+    if (!page)
+        goto drop_skb;
+
+    hard_start = page_address(page);
+    if (skb_copy_bits(skb, 0, hard_start + XDP_PACKET_HEADROOM, len)) {
+        put_page(page);
+        goto drop_skb;
+    }
+    consume_skb(skb);
+
+    xdp_init_buff(&xdp, PAGE_SIZE, &q->xdp_rxq);
+    xdp_prepare_buff(&xdp, hard_start, XDP_PACKET_HEADROOM, len, false);
+
+    act = bpf_prog_run_xdp(prog, &xdp);
+    switch (act) {
+    case XDP_PASS:
+        skb = napi_build_skb(hard_start, PAGE_SIZE);
+        if (!skb)
+            goto drop_page;
+        /* The program may have moved data/data_end */
+        skb_reserve(skb, xdp.data - xdp.data_hard_start);
+        __skb_put(skb, xdp.data_end - xdp.data);
+        return skb;
+    case XDP_TX:
+        frame = xdp_convert_buff_to_frame(&xdp);
+        if (!frame)
+            goto drop_page;
+        batch->frames[batch->count++] = frame;
+        if (batch->count == VNET_XDP_TX_BATCH)
+            vnet_xdp_tx_flush(q, batch);
+        vnet_xdp_stats_inc(&q->xdp_stats, &q->xdp_stats.tx);
+        return NULL;
+    case XDP_REDIRECT:
+        if (xdp_do_redirect(ndev, &xdp, prog))
+            goto drop_page;
+        *redirected = true;
+        vnet_xdp_stats_inc(&q->xdp_stats, &q->xdp_stats.redirect);
+        return NULL;
+    default:
+        bpf_warn_invalid_xdp_action(ndev, prog, act);
+        fallthrough;
+    case XDP_ABORTED:
+        trace_xdp_exception(ndev, prog, act);
+        fallthrough;
+    case XDP_DROP:
+        put_page(page);
+        vnet_xdp_stats_inc(&q->xdp_stats, &q->xdp_stats.drop);
+        return NULL;
+    }
+
+drop_page:
+    put_page(page);
+    vnet_stats_drop(&q->rx_stats);
+    return NULL;
+
+drop_skb:
+    kfree_skb(skb);
+    vnet_stats_drop(&q->rx_stats);
+    return NULL;
+}
+
+static int vnet_xdp_set(struct net_device *ndev, struct bpf_prog *prog,
+                        struct netlink_ext_ack *extack)
+{
+    struct vnet_priv *priv = netdev_priv(ndev);
+    struct bpf_prog *old;
+
+    if (prog && ndev->mtu + ETH_HLEN > VNET_XDP_MAX_LEN) {
+        NL_SET_ERR_MSG_MOD(extack, "MTU too large for XDP");
+        return -EOPNOTSUPP;
+    }
+
+    /* NAPI picks up the new program on its next poll */
+    old = rcu_replace_pointer(priv->xdp_prog, prog, lockdep_rtnl_is_held());
+    if (old)
+        bpf_prog_put(old);
+    return 0;
+}
+
+static int vnet_bpf(struct net_device *ndev, struct netdev_bpf *bpf)
+{
+    switch (bpf->command) {
+    case XDP_SETUP_PROG:
+        return vnet_xdp_set(ndev, bpf->prog, bpf->extack);
+    default:
+        return -EINVAL;
+    }
+}
+
+/* Frames redirected to us by XDP on another device: "transmit" them */
+static int vnet_xdp_xmit(struct net_device *ndev, int n,
+                         struct xdp_frame **frames, u32 flags)
+{
+    struct vnet_priv *priv = netdev_priv(ndev);
+
+    if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+        return -EINVAL;
+    if (unlikely(!netif_running(ndev)))
+        return -ENETDOWN;
+
+    /* Runs with BH disabled, so the CPU is stable */
+    return vnet_xdp_queue_frames(&priv->queues[smp_processor_id() %
+                                               priv->num_queues],
+                                 frames, n, true);
+}
+
 /* ============ NAPI Poll Function ============ */
 
 static int vnet_poll(struct napi_struct *napi, int budget)
 {
-    struct vnet_priv *priv = container_of(napi, struct vnet_priv, napi);
+    struct vnet_queue *q = container_of(napi, struct vnet_queue, napi);
+    struct vnet_priv *priv = q->priv;
     struct net_device *ndev = priv->ndev;
+    struct netdev_queue *txq = netdev_get_tx_queue(ndev, q->index);
+    struct vnet_xdp_tx_batch xdp_tx = { .count = 0 };
+    unsigned int done_bytes = 0;
+    bool xdp_redirected = false;
+    struct bpf_prog *prog;
     int processed = 0;
-    unsigned long flags;
+
+    rcu_read_lock();
+    prog = rcu_dereference(priv->xdp_prog);
 
     while (processed < budget) {
         struct sk_buff *skb;
 
-        spin_lock_irqsave(&priv->rx_lock, flags);
-        if (rx_ring_empty(priv)) {
-            spin_unlock_irqrestore(&priv->rx_lock, flags);
-            break;
-        }
-        skb = rx_ring_dequeue(priv);
-        spin_unlock_irqrestore(&priv->rx_lock, flags);
-
+        skb = vnet_ring_consume(&q->rx_ring);
         if (!skb)
             break;
 
+        /* Taking it off the ring is this device's "TX completion" */
+        done_bytes += skb->len;
+
+        /* XDP sees the raw frame before any skb processing */
+        if (prog && !VNET_SKB_CB(skb)->from_xdp) {
+            skb = vnet_run_xdp(q, prog, skb, &xdp_tx, &xdp_redirected);
+            if (!skb) {
+                processed++;
+                continue;
+            }
+        }
+
         /* Set up skb for network stack */
         skb->protocol = eth_type_trans(skb, ndev);
+        /* Lets RPS and sk_rx_queue_mapping see which ring it came from */
+        skb_record_rx_queue(skb, q->index);
 
         /* Update stats */
-        priv->rx_packets++;
-        priv->rx_bytes += skb->len;
+        vnet_stats_add(&q->rx_stats, skb->len);
 
         /* Hand to network stack */
         napi_gro_receive(napi, skb);
         processed++;
     }
 
+    /* One burst for everything the program bounced or redirected */
+    vnet_xdp_tx_flush(q, &xdp_tx);
+    if (xdp_redirected)
+        xdp_do_flush();
+    rcu_read_unlock();
+
+    /*
+     * Report completions to BQL once per poll; it re-enables the queue if
+     * BQL had stopped it. If start_xmit stopped it because the ring was
+     * full, wake it once there is room again. The barrier pairs with the
+     * one in start_xmit so a stop is never missed.
+     */
+    if (processed) {
+        netdev_tx_completed_queue(txq, processed, done_bytes);
+        smp_mb();
+        if (netif_tx_queue_stopped(txq) &&
+            q->rx_ring.mask + 1 - vnet_ring_count(&q->rx_ring) >=
+            vnet_ring_wake_thresh(&q->rx_ring))
+            netif_tx_wake_queue(txq);
+    }
+
     /* If we processed fewer than budget, we're done */
     if (processed < budget)
         napi_complete_done(napi, processed);
@@ -109,12 +584,14 @@ static int vnet_poll(struct napi_struct *napi, int budget)
 static int vnet_open(struct net_device *ndev)
 {
     struct vnet_priv *priv = netdev_priv(ndev);
+    unsigned int i;
 
     /* Enable NAPI */
-    napi_enable(&priv->napi);
+    for (i = 0; i < priv->num_queues; i++)
+        napi_enable(&priv->queues[i].napi);
 
     /* Allow transmit */
-    netif_start_queue(ndev);
+    netif_tx_start_all_queues(ndev);
 
     netdev_info(ndev, "Interface opened\n");
     return 0;
@@ -123,85 +600,326 @@ static int vnet_open(struct net_device *ndev)
 static int vnet_stop(struct net_device *ndev)
 {
     struct vnet_priv *priv = netdev_priv(ndev);
-    int i;
+    unsigned int i;
 
     /* Stop transmit */
-    netif_stop_queue(ndev);
+    netif_tx_stop_all_queues(ndev);
 
-    /* Disable NAPI */
-    napi_disable(&priv->napi);
+    for (i = 0; i < priv->num_queues; i++) {
+        /* Disable NAPI */
+        napi_disable(&priv->queues[i].napi);
 
-    /* Clear RX ring */
-    for (i = 0; i < RX_RING_SIZE; i++) {
-        if (priv->rx_ring[i]) {
-            dev_kfree_skb(priv->rx_ring[i]);
-            priv->rx_ring[i] = NULL;
-        }
+        /* Clear RX ring; the dropped entries never complete for BQL */
+        vnet_ring_drain(&priv->queues[i].rx_ring);
+        netdev_tx_reset_queue(netdev_get_tx_queue(ndev, i));
     }
-    priv->rx_head = priv->rx_tail = 0;
 
     netdev_info(ndev, "Interface stopped\n");
     return 0;
 }
 
+/*
+ * Turn a transmitted skb into one that can be received. Consumes @skb and
+ * returns the skb to put on the RX ring, or NULL if it had to be dropped.
+ *
+ * In zero-copy mode the TX skb itself is handed over, after removing
+ * everything that belongs to the transmit side: the socket's memory
+ * charge, the route, conntrack state and skb extensions. A cloned skb is
+ * fine to pass on, since the RX stack never writes to shared data without
+ * unsharing it first. A shared skb (extra users, e.g. from pktgen) is
+ * still referenced by someone else and must be copied.
+ */
+static struct sk_buff *vnet_tx_to_rx(struct sk_buff *skb)
+{
+    struct sk_buff *rx_skb;
+
+    if (zerocopy && !skb_shared(skb)) {
+        /* Userspace MSG_ZEROCOPY pages must not be held by the RX side */
+        if (skb_orphan_frags_rx(skb, GFP_ATOMIC)) {
+            dev_kfree_skb_any(skb);
+            return NULL;
+        }
+        skb_orphan(skb);
+        skb_scrub_packet(skb, false);
+        return skb;
+    }
+
+    rx_skb = skb_copy(skb, GFP_ATOMIC);
+    dev_consume_skb_any(skb);
+    return rx_skb;
+}
+
 static netdev_tx_t vnet_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 {
     struct vnet_priv *priv = netdev_priv(ndev);
+    u16 qidx = skb_get_queue_mapping(skb);
+    struct vnet_queue *q = &priv->queues[qidx];
+    struct netdev_queue *txq = netdev_get_tx_queue(ndev, qidx);
+    bool more = netdev_xmit_more();
+    unsigned int len = skb->len;
     struct sk_buff *rx_skb;
-    unsigned long flags;
+    bool kick;
+
+    /*
+     * The queue is stopped before the ring fills, so this only happens
+     * when ndo_xdp_xmit took the last slots. Let the qdisc requeue.
+     */
+    if (unlikely(vnet_ring_full(&q->rx_ring))) {
+        netif_tx_stop_queue(txq);
+        napi_schedule(&q->napi);
+        return NETDEV_TX_BUSY;
+    }
 
     /* Update TX stats */
-    priv->tx_packets++;
-    priv->tx_bytes += skb->len;
+    vnet_stats_add(&q->tx_stats, len);
 
     /*
-     * Loopback: copy the packet and queue it for RX.
+     * Loopback: queue the packet for RX.
      * Real drivers would DMA to hardware here.
      */
-    rx_skb = skb_copy(skb, GFP_ATOMIC);
-    if (rx_skb) {
-        spin_lock_irqsave(&priv->rx_lock, flags);
-        if (!rx_ring_full(priv)) {
-            rx_ring_enqueue(priv, rx_skb);
-            /* Schedule NAPI to process it */
-            napi_schedule(&priv->napi);
-        } else {
-            /* Ring full, drop packet */
-            dev_kfree_skb(rx_skb);
-            ndev->stats.rx_dropped++;
-        }
-        spin_unlock_irqrestore(&priv->rx_lock, flags);
+    rx_skb = vnet_tx_to_rx(skb);
+    if (!rx_skb) {
+        vnet_stats_drop(&q->tx_stats);
+        /* Earlier packets of this burst may still be waiting */
+        if (!more)
+            napi_schedule(&q->napi);
+        return NETDEV_TX_OK;
     }
 
-    /* Free original skb */
-    dev_consume_skb_any(skb);
+    /* cb still holds the qdisc's state; this one runs through XDP */
+    VNET_SKB_CB(rx_skb)->from_xdp = false;
+
+    /* Cannot fail: we are the only producer and checked for space */
+    vnet_ring_produce(&q->rx_ring, rx_skb);
+
+    /*
+     * BQL: account the bytes. The return value says whether to ring the
+     * doorbell now: false while the stack has more packets for us
+     * (xmit_more) and BQL has not stopped the queue.
+     */
+    kick = __netdev_tx_sent_queue(txq, len, more);
+
+    /* Stop while the ring is full and re-check against a racing poll */
+    if (vnet_ring_full(&q->rx_ring)) {
+        netif_tx_stop_queue(txq);
+        smp_mb();
+        if (!vnet_ring_full(&q->rx_ring))
+            netif_tx_start_queue(txq);
+        kick = true;
+    }
+
+    /* The "doorbell": schedule NAPI once per burst, not per packet */
+    if (kick)
+        napi_schedule(&q->napi);
 
     return NETDEV_TX_OK;
 }
 
+/*
+ * Like RSS on a real NIC: hash the flow so every packet of a flow uses the
+ * same queue pair (no reordering) while different flows spread over all
+ * of them. With rss=0 the core chooses, which honours XPS maps.
+ */
+static u16 vnet_select_queue(struct net_device *ndev, struct sk_buff *skb,
+                             struct net_device *sb_dev)
+{
+    if (!rss)
+        return netdev_pick_tx(ndev, skb, sb_dev);
+
+    return reciprocal_scale(skb_get_hash(skb), ndev->real_num_tx_queues);
+}
+
+/* Sum the per-queue counters; never touches the fast-path cache lines */
 static void vnet_get_stats64(struct net_device *ndev,
                              struct rtnl_link_stats64 *stats)
 {
     struct vnet_priv *priv = netdev_priv(ndev);
+    u64 packets, bytes, drops;
+    unsigned int i;
 
-    stats->tx_packets = priv->tx_packets;
-    stats->tx_bytes = priv->tx_bytes;
-    stats->rx_packets = priv->rx_packets;
-    stats->rx_bytes = priv->rx_bytes;
-    stats->rx_dropped = ndev->stats.rx_dropped;
+    for (i = 0; i < priv->num_queues; i++) {
+        struct vnet_queue *q = &priv->queues[i];
+
+        vnet_stats_read(&q->tx_stats, &packets, &bytes, &drops);
+        stats->tx_packets += packets;
+        stats->tx_bytes += bytes;
+        stats->rx_dropped += drops;
+
+        /* Already in tx_packets/tx_bytes; only the drops are separate */
+        vnet_stats_read(&q->xdp_xmit_stats, &packets, &bytes, &drops);
+        stats->tx_dropped += drops;
+
+        vnet_stats_read(&q->rx_stats, &packets, &bytes, &drops);
+        stats->rx_packets += packets;
+        stats->rx_bytes += bytes;
+        stats->rx_dropped += drops;
+    }
 }
 
 static const struct net_device_ops vnet_netdev_ops = {
     .ndo_open       = vnet_open,
     .ndo_stop       = vnet_stop,
     .ndo_start_xmit = vnet_start_xmit,
+    .ndo_select_queue = vnet_select_queue,
     .ndo_get_stats64 = vnet_get_stats64,
     .ndo_set_mac_address = eth_mac_addr,
     .ndo_validate_addr = eth_validate_addr,
+    .ndo_bpf        = vnet_bpf,
+    .ndo_xdp_xmit   = vnet_xdp_xmit,
+};
+
+/* ============ ethtool Operations ============ */
+
+static void vnet_get_drvinfo(struct net_device *ndev,
+                             struct ethtool_drvinfo *info)
+{
+    strscpy(info->driver, DRIVER_NAME, sizeof(info->driver));
+}
+
+static int vnet_get_sset_count(struct net_device *ndev, int sset)
+{
+    struct vnet_priv *priv = netdev_priv(ndev);
+
+    if (sset != ETH_SS_STATS)
+        return -EOPNOTSUPP;
+
+    return priv->num_queues * VNET_QUEUE_STATS;
+}
+
+static void vnet_get_strings(struct net_device *ndev, u32 sset, u8 *data)
+{
+    struct vnet_priv *priv = netdev_priv(ndev);
+    unsigned int i, j;
+
+    if (sset != ETH_SS_STATS)
+        return;
+
+    for (i = 0; i < priv->num_queues; i++)
+        for (j = 0; j < VNET_QUEUE_STATS; j++)
+            ethtool_sprintf(&data, vnet_queue_stat_names[j], i);
+}
+
+/* Order must match vnet_queue_stat_names */
+static void vnet_get_ethtool_stats(struct net_device *ndev,
+                                   struct ethtool_stats *estats, u64 *data)
+{
+    struct vnet_priv *priv = netdev_priv(ndev);
+    u64 packets, bytes, drops, tx_drops;
+    u64 xdp_drop, xdp_tx, xdp_redirect;
+    unsigned int i;
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct vnet_queue *q = &priv->queues[i];
+
+        vnet_stats_read(&q->tx_stats, &packets, &bytes, &tx_drops);
+        *data++ = packets;
+        *data++ = bytes;
+
+        vnet_stats_read(&q->xdp_xmit_stats, &packets, &bytes, &drops);
+        *data++ = packets;
+        *data++ = drops;
+
+        vnet_stats_read(&q->rx_stats, &packets, &bytes, &drops);
+        *data++ = packets;
+        *data++ = bytes;
+        /* Loopback drops are counted on the TX side but are RX drops */
+        *data++ = drops + tx_drops;
+
+        vnet_xdp_stats_read(&q->xdp_stats, &xdp_drop, &xdp_tx, &xdp_redirect);
+        *data++ = xdp_drop;
+        *data++ = xdp_tx;
+        *data++ = xdp_redirect;
+    }
+}
+
+static const struct ethtool_ops vnet_ethtool_ops = {
+    .get_drvinfo = vnet_get_drvinfo,
+    .get_link = ethtool_op_get_link,
+    .get_sset_count = vnet_get_sset_count,
+    .get_strings = vnet_get_strings,
+    .get_ethtool_stats = vnet_get_ethtool_stats,
 };
 
 /* ============ Module Init/Exit ============ */
 
+static int vnet_alloc_queues(struct vnet_priv *priv, unsigned int count)
+{
+    unsigned int i;
+    int err;
+
+    priv->queues = kcalloc(count, sizeof(*priv->queues), GFP_KERNEL);
+    if (!priv->queues)
+        return -ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        struct vnet_queue *q = &priv->queues[i];
+
+        q->priv = priv;
+        q->index = i;
+        u64_stats_init(&q->tx_stats.syncp);
+        u64_stats_init(&q->xdp_xmit_stats.syncp);
+        u64_stats_init(&q->rx_stats.syncp);
+        u64_stats_init(&q->xdp_stats.syncp);
+        err = vnet_ring_init(&q->rx_ring, rx_ring_size);
+        if (err)
+            goto free_rings;
+
+        /* XDP frames are single pages, released with put_page() */
+        err = xdp_rxq_info_reg(&q->xdp_rxq, priv->ndev, i, 0);
+        if (err) {
+            vnet_ring_free(&q->rx_ring);
+            goto free_rings;
+        }
+        err = xdp_rxq_info_reg_mem_model(&q->xdp_rxq, MEM_TYPE_PAGE_ORDER0,
+                                         NULL);
+        if (err) {
+            xdp_rxq_info_unreg(&q->xdp_rxq);
+            vnet_ring_free(&q->rx_ring);
+            goto free_rings;
+        }
+    }
+
+    /* Nothing can fail past this point, so NAPI is added last */
+    for (i = 0; i < count; i++)
+        netif_napi_add(priv->ndev, &priv->queues[i].napi, vnet_poll);
+
+    priv->num_queues = count;
+    return 0;
+
+free_rings:
+    while (i--) {
+        xdp_rxq_info_unreg(&priv->queues[i].xdp_rxq);
+        vnet_ring_free(&priv->queues[i].rx_ring);
+    }
+    kfree(priv->queues);
+    priv->queues = NULL;
+    return err;
+}
+
+/* Safe to call twice; free_netdev() must not see the NAPIs afterwards */
+static void vnet_free_queues(struct vnet_priv *priv)
+{
+    unsigned int i;
+
+    if (!priv->queues)
+        return;
+
+    for (i = 0; i < priv->num_queues; i++) {
+        netif_napi_del(&priv->queues[i].napi);
+        xdp_rxq_info_unreg(&priv->queues[i].xdp_rxq);
+        vnet_ring_free(&priv->queues[i].rx_ring);
+    }
+    kfree(priv->queues);
+    priv->queues = NULL;
+    priv->num_queues = 0;
+}
+
+/* Runs from unregister_netdev() right before the device is freed */
+static void vnet_priv_destructor(struct net_device *ndev)
+{
+    vnet_free_queues(netdev_priv(ndev));
+}
+
 static struct net_device *vnet_dev;
 
 static int __init vnet_init(void)
@@ -209,46 +927,67 @@ static int __init vnet_init(void)
     struct vnet_priv *priv;
     int err;
 
-    /* Allocate net_device with private data */
-    vnet_dev = alloc_etherdev(sizeof(struct vnet_priv));
+    if (rx_ring_size < RX_RING_MIN || rx_ring_size > RX_RING_MAX) {
+        pr_err("rx_ring_size must be %d..%d\n", RX_RING_MIN, RX_RING_MAX);
+        return -EINVAL;
+    }
+    rx_ring_size = roundup_pow_of_two(rx_ring_size);
+
+    if (num_queues < 1 || num_queues > VNET_MAX_QUEUES) {
+        pr_err("num_queues must be 1..%d\n", VNET_MAX_QUEUES);
+        return -EINVAL;
+    }
+
+    /* Allocate net_device with private data and one TX/RX pair per queue */
+    vnet_dev = alloc_etherdev_mqs(sizeof(struct vnet_priv),
+                                  num_queues, num_queues);
     if (!vnet_dev)
         return -ENOMEM;
 
     /* Set up private data */
     priv = netdev_priv(vnet_dev);
     priv->ndev = vnet_dev;
-    spin_lock_init(&priv->rx_lock);
+
+    /* Set up RX rings and register one NAPI per queue */
+    err = vnet_alloc_queues(priv, num_queues);
+    if (err) {
+        free_netdev(vnet_dev);
+        return err;
+    }
 
     /* Configure device */
     vnet_dev->netdev_ops = &vnet_netdev_ops;
+    vnet_dev->ethtool_ops = &vnet_ethtool_ops;
+    vnet_dev->xdp_features = NETDEV_XDP_ACT_BASIC | NETDEV_XDP_ACT_REDIRECT |
+                             NETDEV_XDP_ACT_NDO_XMIT;
     vnet_dev->needs_free_netdev = true;
+    vnet_dev->priv_destructor = vnet_priv_destructor;
 
     /* Generate random MAC address */
     eth_hw_addr_random(vnet_dev);
 
-    /* Register NAPI */
-    netif_napi_add(vnet_dev, &priv->napi, vnet_poll);
-
     /* Register with network stack */
     err = register_netdev(vnet_dev);
     if (err) {
         pr_err("Failed to register netdev: %d\n", err);
+        vnet_free_queues(priv);
         free_netdev(vnet_dev);
         return err;
     }
 
-    pr_info("Virtual network device '%s' registered (MAC: %pM)\n",
-            vnet_dev->name, vnet_dev->dev_addr);
+    pr_info("Virtual network device '%s' registered (MAC: %pM, %u queues, RX ring %u)\n",
+            vnet_dev->name, vnet_dev->dev_addr, num_queues, rx_ring_size);
     return 0;
 }
 
 static void __exit vnet_exit(void)
 {
-    struct vnet_priv *priv = netdev_priv(vnet_dev);
-
+    /*
+     * needs_free_netdev frees the device inside unregister_netdev(), so
+     * priv must not be touched after this call. The queues, rings and
+     * NAPI instances are released by vnet_priv_destructor() just before.
+     */
     unregister_netdev(vnet_dev);
-    netif_napi_del(&priv->napi);
-    /* free_netdev handled by needs_free_netdev */
 
     pr_info("Virtual network device unregistered\n");
 }
@@ -6,75 +6,514 @@
  * - blk-mq setup (tag_set, disk allocation)
  * - queue_rq callback for request processing
  * - Segment iteration with rq_for_each_segment
+ * - Multiple hardware queues (per-CPU or per-NUMA-node hctx mapping)
+ * - Batched completion driven by bd->last and .commit_rqs
+ * - Sparse, xarray-indexed page store allocated on first write
+ * - REQ_OP_DISCARD / REQ_OP_WRITE_ZEROES that free backing pages
+ * - Polled completion (HCTX_TYPE_POLL, .poll) for io_uring IOPOLL
+ * - Per-hctx completion latency histogram in debugfs
  *
- * Creates /dev/ramdemo0 - a 16MB RAM disk
+ * Creates /dev/ramdemo0 - a 16MB RAM disk (size set by disk_size_mb)
+ *
+ * Usage:
+ *   insmod ramdisk_demo.ko                      # one hctx per CPU
+ *   insmod ramdisk_demo.ko queue_mode=2         # one hctx per NUMA node
+ *   insmod ramdisk_demo.ko queue_mode=0 queue_depth=64
+ *   insmod ramdisk_demo.ko disk_size_mb=8192  # only written pages use RAM
+ *   insmod ramdisk_demo.ko poll_queues=0       # no polled queues
  */
 
 #include <linux/module.h>
 #include <linux/blkdev.h>
 #include <linux/blk-mq.h>
-#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/nodemask.h>
+#include <linux/xarray.h>
+#include <linux/highmem.h>
+#include <linux/rcupdate.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 
 #define DRIVER_NAME "ramdisk_demo"
-#define DISK_SIZE_MB 16
-#define DISK_SIZE (DISK_SIZE_MB * 1024 * 1024)
 #define SECTOR_SIZE 512
+#define LAT_BUCKETS 32  /* log2(ns) buckets: 1ns .. ~2s */
+
+enum ramdisk_queue_mode {
+    RAMDISK_QUEUE_SINGLE = 0,   /* One hctx shared by all CPUs */
+    RAMDISK_QUEUE_PER_CPU = 1,  /* One hctx per possible CPU */
+    RAMDISK_QUEUE_PER_NODE = 2, /* One hctx per online NUMA node */
+};
+
+static unsigned long disk_size_mb = 16;
+module_param(disk_size_mb, ulong, 0444);
+MODULE_PARM_DESC(disk_size_mb, "Disk size in MiB (default: 16)");
+
+static int queue_mode = RAMDISK_QUEUE_PER_CPU;
+module_param(queue_mode, int, 0444);
+MODULE_PARM_DESC(queue_mode, "0=single queue, 1=per-CPU, 2=per-NUMA-node (default: 1)");
+
+static int queue_depth = 128;
+module_param(queue_depth, int, 0444);
+MODULE_PARM_DESC(queue_depth, "Tags per hardware queue (default: 128)");
+
+static int poll_queues = 1;
+module_param(poll_queues, int, 0444);
+MODULE_PARM_DESC(poll_queues, "Extra hardware queues for polled I/O (default: 1)");
+
+static int home_node = NUMA_NO_NODE;
+module_param(home_node, int, 0444);
+MODULE_PARM_DESC(home_node, "NUMA node for backing pages (default: -1, writer's node)");
 
 struct ramdisk_dev {
     struct gendisk *disk;
     struct blk_mq_tag_set tag_set;
-    void *data;
-    size_t size;
+    struct xarray pages;        /* Page index -> backing page */
+    atomic_long_t nr_pages;     /* Backing pages currently allocated */
+    u64 size;
+
+    /* Discard / write-zeroes statistics */
+    atomic64_t discard_ops;
+    atomic64_t write_zeroes_ops;
+    atomic64_t bytes_freed;     /* Backing memory returned to the system */
+
+    struct dentry *debugfs_dir;
+};
+
+/*
+ * Per-hctx state, allocated on the hctx's NUMA node so the submitting
+ * CPUs never touch another queue's cache lines.
+ */
+struct ramdisk_queue {
+    spinlock_t lock;
+    struct list_head pending;   /* Copied, waiting for bd->last or .poll */
+    unsigned int index;
+
+    /* queue_rq entry to completion, bucketed by ilog2(ns) */
+    atomic64_t lat_hist[LAT_BUCKETS];
+    atomic64_t lat_total_ns;
+    atomic64_t completed;
+};
+
+/* Per-request driver data (tag_set.cmd_size) */
+struct ramdisk_cmd {
+    struct list_head list;
+    blk_status_t status;
+    u64 start_ns;
 };
 
 static struct ramdisk_dev ramdisk;
 
+/* hctx index for each online node in RAMDISK_QUEUE_PER_NODE mode */
+static unsigned int node_to_queue[MAX_NUMNODES];
+
+/* ============ Backing Store ============ */
+
+/*
+ * The disk is a sparse array of pages indexed by page number, like brd.
+ * Pages are allocated the first time a sector inside them is written;
+ * reading a sector that was never written returns zeroes without
+ * allocating anything.
+ */
+#define PAGE_SECTORS_SHIFT (PAGE_SHIFT - SECTOR_SHIFT)
+#define PAGE_SECTORS (1 << PAGE_SECTORS_SHIFT)
+
+/*
+ * Discard can free a page while another queue is copying to or from it,
+ * so lookups and copies run under rcu_read_lock() and pages are freed
+ * only after a grace period.
+ */
+static struct page *ramdisk_lookup_page(struct ramdisk_dev *dev,
+                                        sector_t sector)
+{
+    return xa_load(&dev->pages, sector >> PAGE_SECTORS_SHIFT);
+}
+
+/*
+ * Make sure a backing page exists for @sector. Called from queue_rq, which
+ * must not sleep, so allocations are GFP_NOWAIT and the caller turns a
+ * failure into BLK_STS_RESOURCE. Without home_node the page comes from the
+ * submitting CPU's node, i.e. the node of the hctx doing the write.
+ */
+static int ramdisk_insert_page(struct ramdisk_dev *dev, sector_t sector)
+{
+    pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+    gfp_t gfp = GFP_NOWAIT | __GFP_NOWARN;
+    struct page *page, *cur;
+
+    if (xa_load(&dev->pages, idx))
+        return 0;
+
+    page = alloc_pages_node(home_node, gfp | __GFP_ZERO | __GFP_HIGHMEM, 0);
+    if (!page)
+        return -ENOMEM;
+
+    /* Another queue may have raced us to the same page */
+    cur = xa_cmpxchg(&dev->pages, idx, NULL, page, gfp);
+    if (cur) {
+        __free_page(page);
+        return xa_is_err(cur) ? xa_err(cur) : 0;
+    }
+
+    atomic_long_inc(&dev->nr_pages);
+    return 0;
+}
+
+/* Allocate every missing page a write will touch, before starting it */
+static int ramdisk_prepare_write(struct ramdisk_dev *dev, struct request *rq)
+{
+    sector_t sector = blk_rq_pos(rq) & ~((sector_t)PAGE_SECTORS - 1);
+    sector_t end = blk_rq_pos(rq) + blk_rq_sectors(rq);
+    int err;
+
+    for (; sector < end; sector += PAGE_SECTORS) {
+        err = ramdisk_insert_page(dev, sector);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+static void ramdisk_copy_to_dev(struct ramdisk_dev *dev, const void *src,
+                                sector_t sector, unsigned int len)
+{
+    while (len) {
+        unsigned int offset = (sector & (PAGE_SECTORS - 1)) << SECTOR_SHIFT;
+        unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+        struct page *page;
+        void *dst;
+
+        rcu_read_lock();
+        /*
+         * ramdisk_prepare_write() allocated the page; it can only be gone
+         * if a discard of the same range raced with this write, in which
+         * case either outcome is valid.
+         */
+        page = ramdisk_lookup_page(dev, sector);
+        if (page) {
+            dst = kmap_local_page(page);
+            memcpy(dst + offset, src, chunk);
+            kunmap_local(dst);
+        }
+        rcu_read_unlock();
+
+        src += chunk;
+        sector += chunk >> SECTOR_SHIFT;
+        len -= chunk;
+    }
+}
+
+static void ramdisk_copy_from_dev(struct ramdisk_dev *dev, void *dst,
+                                  sector_t sector, unsigned int len)
+{
+    while (len) {
+        unsigned int offset = (sector & (PAGE_SECTORS - 1)) << SECTOR_SHIFT;
+        unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+        struct page *page;
+        void *src;
+
+        rcu_read_lock();
+        page = ramdisk_lookup_page(dev, sector);
+        if (page) {
+            src = kmap_local_page(page);
+            memcpy(dst, src + offset, chunk);
+            kunmap_local(src);
+        } else {
+            /* Never written (or discarded): reads as zeroes */
+            memset(dst, 0, chunk);
+        }
+        rcu_read_unlock();
+
+        dst += chunk;
+        sector += chunk >> SECTOR_SHIFT;
+        len -= chunk;
+    }
+}
+
+static void ramdisk_free_page_rcu(struct rcu_head *head)
+{
+    __free_page(container_of(head, struct page, rcu_head));
+}
+
+/*
+ * Zero [sector, sector + nr_sects). Whole pages are removed from the
+ * store (they read back as zeroes), so discarding a range gives the
+ * memory back instead of writing zeroes into it. Partial pages at either
+ * end are cleared in place. With @unmap false every page is kept and
+ * only cleared, as REQ_NOUNMAP requires.
+ */
+static void ramdisk_zero_range(struct ramdisk_dev *dev, sector_t sector,
+                               u64 nr_sects, bool unmap)
+{
+    while (nr_sects) {
+        unsigned int offset = (sector & (PAGE_SECTORS - 1)) << SECTOR_SHIFT;
+        unsigned int chunk = min_t(u64, nr_sects << SECTOR_SHIFT,
+                                   PAGE_SIZE - offset);
+        pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+        struct page *page;
+        void *dst;
+
+        if (unmap && chunk == PAGE_SIZE) {
+            page = xa_erase(&dev->pages, idx);
+            if (page) {
+                atomic_long_dec(&dev->nr_pages);
+                atomic64_add(PAGE_SIZE, &dev->bytes_freed);
+                call_rcu(&page->rcu_head, ramdisk_free_page_rcu);
+            }
+        } else {
+            rcu_read_lock();
+            page = xa_load(&dev->pages, idx);
+            if (page) {
+                dst = kmap_local_page(page);
+                memset(dst + offset, 0, chunk);
+                kunmap_local(dst);
+            }
+            rcu_read_unlock();
+        }
+
+        sector += chunk >> SECTOR_SHIFT;
+        nr_sects -= chunk >> SECTOR_SHIFT;
+    }
+}
+
+static void ramdisk_free_pages(struct ramdisk_dev *dev)
+{
+    struct page *page;
+    unsigned long idx;
+
+    xa_for_each(&dev->pages, idx, page) {
+        xa_erase(&dev->pages, idx);
+        __free_page(page);
+    }
+    xa_destroy(&dev->pages);
+    atomic_long_set(&dev->nr_pages, 0);
+}
+
 /* ============ Request Processing ============ */
 
-static blk_status_t ramdisk_queue_rq(struct blk_mq_hw_ctx *hctx,
-                                      const struct blk_mq_queue_data *bd)
+static blk_status_t ramdisk_do_request(struct ramdisk_dev *dev,
+                                       struct request *rq)
 {
-    struct request *rq = bd->rq;
-    struct ramdisk_dev *dev = rq->q->queuedata;
     struct req_iterator iter;
     struct bio_vec bvec;
-    loff_t pos = blk_rq_pos(rq) << SECTOR_SHIFT;
-    loff_t dev_size = dev->size;
+    sector_t sector = blk_rq_pos(rq);
+
+    /* Bounds check */
+    if (sector + blk_rq_sectors(rq) > get_capacity(dev->disk)) {
+        pr_err("I/O beyond device size: sector=%llu nr=%u capacity=%llu\n",
+               (unsigned long long)sector, blk_rq_sectors(rq),
+               (unsigned long long)get_capacity(dev->disk));
+        return BLK_STS_IOERR;
+    }
 
-    /* Must call before processing */
-    blk_mq_start_request(rq);
+    switch (req_op(rq)) {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE:
+        break;
+    case REQ_OP_DISCARD:
+        atomic64_inc(&dev->discard_ops);
+        ramdisk_zero_range(dev, sector, blk_rq_sectors(rq), true);
+        return BLK_STS_OK;
+    case REQ_OP_WRITE_ZEROES:
+        atomic64_inc(&dev->write_zeroes_ops);
+        ramdisk_zero_range(dev, sector, blk_rq_sectors(rq),
+                           !(rq->cmd_flags & REQ_NOUNMAP));
+        return BLK_STS_OK;
+    default:
+        return BLK_STS_NOTSUPP;
+    }
 
     /* Iterate over all segments in the request */
     rq_for_each_segment(bvec, rq, iter) {
         unsigned int len = bvec.bv_len;
         void *buf;
 
-        /* Bounds check */
-        if (pos + len > dev_size) {
-            pr_err("I/O beyond device size: pos=%lld len=%u size=%lld\n",
-                   pos, len, dev_size);
-            blk_mq_end_request(rq, BLK_STS_IOERR);
-            return BLK_STS_IOERR;
-        }
-
         /* Map page to kernel address */
         buf = kmap_local_page(bvec.bv_page) + bvec.bv_offset;
 
-        if (rq_data_dir(rq) == WRITE)
-            memcpy(dev->data + pos, buf, len);
+        if (req_op(rq) == REQ_OP_WRITE)
+            ramdisk_copy_to_dev(dev, buf, sector, len);
         else
-            memcpy(buf, dev->data + pos, len);
+            ramdisk_copy_from_dev(dev, buf, sector, len);
 
         kunmap_local(buf);
-        pos += len;
+        sector += len >> SECTOR_SHIFT;
+    }
+
+    return BLK_STS_OK;
+}
+
+static void ramdisk_account_latency(struct ramdisk_queue *rq_queue, u64 ns)
+{
+    unsigned int bucket = min_t(unsigned int, ilog2(ns | 1), LAT_BUCKETS - 1);
+
+    atomic64_inc(&rq_queue->lat_hist[bucket]);
+    atomic64_add(ns, &rq_queue->lat_total_ns);
+    atomic64_inc(&rq_queue->completed);
+}
+
+/*
+ * Complete every command on @done. From .poll, @iob lets blk-mq finish
+ * successful requests as one batch once the poller returns.
+ */
+static int ramdisk_complete_list(struct ramdisk_queue *rq_queue,
+                                 struct list_head *done,
+                                 struct io_comp_batch *iob)
+{
+    struct ramdisk_cmd *cmd, *tmp;
+    u64 now = ktime_get_ns();
+    int nr = 0;
+
+    list_for_each_entry_safe(cmd, tmp, done, list) {
+        struct request *rq = blk_mq_rq_from_pdu(cmd);
+
+        list_del_init(&cmd->list);
+        ramdisk_account_latency(rq_queue, now - cmd->start_ns);
+
+        if (!iob || !blk_mq_add_to_batch(rq, iob, cmd->status != BLK_STS_OK,
+                                         blk_mq_end_request_batch))
+            blk_mq_end_request(rq, cmd->status);
+        nr++;
     }
+    return nr;
+}
+
+static blk_status_t ramdisk_queue_rq(struct blk_mq_hw_ctx *hctx,
+                                      const struct blk_mq_queue_data *bd)
+{
+    struct request *rq = bd->rq;
+    struct ramdisk_dev *dev = rq->q->queuedata;
+    struct ramdisk_queue *rq_queue = hctx->driver_data;
+    struct ramdisk_cmd *cmd = blk_mq_rq_to_pdu(rq);
+    bool polled = hctx->type == HCTX_TYPE_POLL;
+    LIST_HEAD(done);
+
+    cmd->start_ns = ktime_get_ns();
+
+    /*
+     * Allocate backing pages up front so a write never fails half-way.
+     * The request has not been started yet, so blk-mq will simply retry.
+     */
+    if (req_op(rq) == REQ_OP_WRITE &&
+        blk_rq_pos(rq) + blk_rq_sectors(rq) <= get_capacity(dev->disk) &&
+        ramdisk_prepare_write(dev, rq))
+        return BLK_STS_RESOURCE;
+
+    /* Must call before processing */
+    blk_mq_start_request(rq);
 
-    blk_mq_end_request(rq, BLK_STS_OK);
+    cmd->status = ramdisk_do_request(dev, rq);
+
+    /*
+     * A RAM disk has no doorbell to ring, but the same rule applies:
+     * while bd->last is false more requests are coming in this batch,
+     * so park the completion and finish the whole batch at once.
+     * blk-mq guarantees either a later bd->last or a .commit_rqs call.
+     *
+     * On a poll queue nothing is completed here: the submitter reaps the
+     * request itself from .poll, as it would from an NVMe CQ.
+     */
+    spin_lock(&rq_queue->lock);
+    list_add_tail(&cmd->list, &rq_queue->pending);
+    if (bd->last && !polled)
+        list_splice_init(&rq_queue->pending, &done);
+    spin_unlock(&rq_queue->lock);
+
+    ramdisk_complete_list(rq_queue, &done, NULL);
     return BLK_STS_OK;
 }
 
+/* Called when a batch ends without a bd->last request (e.g. on error) */
+static void ramdisk_commit_rqs(struct blk_mq_hw_ctx *hctx)
+{
+    struct ramdisk_queue *rq_queue = hctx->driver_data;
+    LIST_HEAD(done);
+
+    /* Poll queues are drained by .poll instead */
+    if (hctx->type == HCTX_TYPE_POLL)
+        return;
+
+    spin_lock(&rq_queue->lock);
+    list_splice_init(&rq_queue->pending, &done);
+    spin_unlock(&rq_queue->lock);
+
+    ramdisk_complete_list(rq_queue, &done, NULL);
+}
+
+/* Reap finished requests on a poll queue; returns how many were found */
+static int ramdisk_poll(struct blk_mq_hw_ctx *hctx, struct io_comp_batch *iob)
+{
+    struct ramdisk_queue *rq_queue = hctx->driver_data;
+    LIST_HEAD(done);
+
+    spin_lock(&rq_queue->lock);
+    list_splice_init(&rq_queue->pending, &done);
+    spin_unlock(&rq_queue->lock);
+
+    return ramdisk_complete_list(rq_queue, &done, iob);
+}
+
+static int ramdisk_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+                             unsigned int hctx_idx)
+{
+    struct ramdisk_queue *rq_queue;
+
+    rq_queue = kzalloc_node(sizeof(*rq_queue), GFP_KERNEL, hctx->numa_node);
+    if (!rq_queue)
+        return -ENOMEM;
+
+    spin_lock_init(&rq_queue->lock);
+    INIT_LIST_HEAD(&rq_queue->pending);
+    rq_queue->index = hctx_idx;
+    hctx->driver_data = rq_queue;
+    return 0;
+}
+
+static void ramdisk_exit_hctx(struct blk_mq_hw_ctx *hctx,
+                              unsigned int hctx_idx)
+{
+    kfree(hctx->driver_data);
+    hctx->driver_data = NULL;
+}
+
+static void ramdisk_map_queues(struct blk_mq_tag_set *set)
+{
+    struct blk_mq_queue_map *map = &set->map[HCTX_TYPE_DEFAULT];
+    unsigned int cpu;
+
+    /* hctxs [0, nr - poll_queues) serve normal I/O, the rest poll */
+    map->nr_queues = set->nr_hw_queues - (set->nr_maps > 1 ? poll_queues : 0);
+    map->queue_offset = 0;
+
+    if (queue_mode == RAMDISK_QUEUE_PER_NODE) {
+        /* Every CPU submits to the hctx that belongs to its node */
+        for_each_possible_cpu(cpu)
+            map->mq_map[cpu] = node_to_queue[cpu_to_node(cpu)];
+    } else {
+        blk_mq_map_queues(map);
+    }
+
+    if (set->nr_maps == 1)
+        return;
+
+    /* No separate read queues; blk-mq falls back to the default map */
+    set->map[HCTX_TYPE_READ].nr_queues = 0;
+
+    map = &set->map[HCTX_TYPE_POLL];
+    map->nr_queues = poll_queues;
+    map->queue_offset = set->map[HCTX_TYPE_DEFAULT].nr_queues;
+    blk_mq_map_queues(map);
+}
+
 static const struct blk_mq_ops ramdisk_mq_ops = {
     .queue_rq = ramdisk_queue_rq,
+    .commit_rqs = ramdisk_commit_rqs,
+    .poll = ramdisk_poll,
+    .init_hctx = ramdisk_init_hctx,
+    .exit_hctx = ramdisk_exit_hctx,
+    .map_queues = ramdisk_map_queues,
 };
 
 /* ============ Block Device Operations ============ */
@@ -96,32 +535,130 @@ static const struct block_device_operations ramdisk_fops = {
     .release = ramdisk_release,
 };
 
+/* ============ debugfs ============ */
+
+static int ramdisk_stats_show(struct seq_file *s, void *unused)
+{
+    struct ramdisk_dev *dev = s->private;
+    long pages = atomic_long_read(&dev->nr_pages);
+
+    seq_printf(s, "capacity_bytes:   %llu\n", dev->size);
+    seq_printf(s, "pages_allocated:  %ld\n", pages);
+    seq_printf(s, "bytes_allocated:  %llu\n", (u64)pages << PAGE_SHIFT);
+    seq_printf(s, "discard_ops:      %lld\n",
+               atomic64_read(&dev->discard_ops));
+    seq_printf(s, "write_zeroes_ops: %lld\n",
+               atomic64_read(&dev->write_zeroes_ops));
+    seq_printf(s, "bytes_freed:      %lld\n",
+               atomic64_read(&dev->bytes_freed));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ramdisk_stats);
+
+static const char *const ramdisk_hctx_type_names[HCTX_MAX_TYPES] = {
+    [HCTX_TYPE_DEFAULT] = "default",
+    [HCTX_TYPE_READ] = "read",
+    [HCTX_TYPE_POLL] = "poll",
+};
+
+/* One histogram per hctx; only non-empty buckets are printed */
+static int ramdisk_latency_show(struct seq_file *s, void *unused)
+{
+    struct ramdisk_dev *dev = s->private;
+    struct blk_mq_hw_ctx *hctx;
+    unsigned long i;
+    int b;
+
+    queue_for_each_hw_ctx(dev->disk->queue, hctx, i) {
+        struct ramdisk_queue *rq_queue = hctx->driver_data;
+        u64 completed = atomic64_read(&rq_queue->completed);
+        u64 total = atomic64_read(&rq_queue->lat_total_ns);
+
+        seq_printf(s, "hctx%u (%s): completed=%llu mean_ns=%llu\n",
+                   rq_queue->index, ramdisk_hctx_type_names[hctx->type],
+                   completed, completed ? div64_u64(total, completed) : 0);
+
+        for (b = 0; b < LAT_BUCKETS; b++) {
+            u64 count = atomic64_read(&rq_queue->lat_hist[b]);
+
+            if (count)
+                seq_printf(s, "  [%10llu, %10llu) ns: %llu\n",
+                           1ULL << b, 1ULL << (b + 1), count);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ramdisk_latency);
+
 /* ============ Module Init/Exit ============ */
 
+static unsigned int ramdisk_nr_hw_queues(void)
+{
+    unsigned int nr = 0;
+    int node;
+
+    switch (queue_mode) {
+    case RAMDISK_QUEUE_PER_CPU:
+        return num_possible_cpus();
+    case RAMDISK_QUEUE_PER_NODE:
+        /* Node IDs can be sparse; give each online node a dense index */
+        for_each_online_node(node)
+            node_to_queue[node] = nr++;
+        return nr;
+    default:
+        return 1;
+    }
+}
+
 static int __init ramdisk_init(void)
 {
     int err;
 
-    /* Allocate backing memory */
-    ramdisk.size = DISK_SIZE;
-    ramdisk.data = vzalloc(ramdisk.size);
-    if (!ramdisk.data) {
-        pr_err("Failed to allocate %zu bytes\n", ramdisk.size);
-        return -ENOMEM;
+    if (queue_mode < RAMDISK_QUEUE_SINGLE ||
+        queue_mode > RAMDISK_QUEUE_PER_NODE) {
+        pr_err("Invalid queue_mode %d\n", queue_mode);
+        return -EINVAL;
+    }
+    if (queue_depth < 1 || queue_depth > BLK_MQ_MAX_DEPTH) {
+        pr_err("Invalid queue_depth %d\n", queue_depth);
+        return -EINVAL;
+    }
+    if (poll_queues < 0 || poll_queues > nr_cpu_ids) {
+        pr_err("Invalid poll_queues %d\n", poll_queues);
+        return -EINVAL;
     }
+    if (home_node != NUMA_NO_NODE && !node_online(home_node)) {
+        pr_err("NUMA node %d is not online\n", home_node);
+        return -EINVAL;
+    }
+    if (!disk_size_mb) {
+        pr_err("disk_size_mb must be non-zero\n");
+        return -EINVAL;
+    }
+
+    /* Backing pages are allocated lazily on first write */
+    ramdisk.size = (u64)disk_size_mb << 20;
+    xa_init(&ramdisk.pages);
+    atomic_long_set(&ramdisk.nr_pages, 0);
+    atomic64_set(&ramdisk.discard_ops, 0);
+    atomic64_set(&ramdisk.write_zeroes_ops, 0);
+    atomic64_set(&ramdisk.bytes_freed, 0);
 
     /* Set up tag set for blk-mq */
     memset(&ramdisk.tag_set, 0, sizeof(ramdisk.tag_set));
     ramdisk.tag_set.ops = &ramdisk_mq_ops;
-    ramdisk.tag_set.nr_hw_queues = 1;
-    ramdisk.tag_set.queue_depth = 128;
-    ramdisk.tag_set.numa_node = NUMA_NO_NODE;
+    ramdisk.tag_set.nr_hw_queues = ramdisk_nr_hw_queues() + poll_queues;
+    ramdisk.tag_set.nr_maps = poll_queues ? HCTX_MAX_TYPES : 1;
+    ramdisk.tag_set.queue_depth = queue_depth;
+    ramdisk.tag_set.numa_node = home_node;
+    ramdisk.tag_set.cmd_size = sizeof(struct ramdisk_cmd);
     ramdisk.tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+    ramdisk.tag_set.driver_data = &ramdisk;
 
     err = blk_mq_alloc_tag_set(&ramdisk.tag_set);
     if (err) {
         pr_err("Failed to allocate tag set: %d\n", err);
-        goto free_data;
+        return err;
     }
 
     /* Allocate gendisk and request queue */
@@ -147,6 +684,15 @@ static int __init ramdisk_init(void)
     blk_queue_physical_block_size(ramdisk.disk->queue, SECTOR_SIZE);
     blk_queue_logical_block_size(ramdisk.disk->queue, SECTOR_SIZE);
 
+    /*
+     * Advertise discard and write-zeroes. Only whole pages can be freed,
+     * so tell filesystems to discard in page-sized units.
+     */
+    ramdisk.disk->queue->limits.discard_granularity = PAGE_SIZE;
+    blk_queue_max_discard_sectors(ramdisk.disk->queue, UINT_MAX >> SECTOR_SHIFT);
+    blk_queue_max_write_zeroes_sectors(ramdisk.disk->queue,
+                                       UINT_MAX >> SECTOR_SHIFT);
+
     /* Register the disk */
     err = add_disk(ramdisk.disk);
     if (err) {
@@ -154,26 +700,35 @@ static int __init ramdisk_init(void)
         goto cleanup_disk;
     }
 
-    pr_info("RAM disk registered: /dev/%s (%d MB)\n",
-            ramdisk.disk->disk_name, DISK_SIZE_MB);
+    ramdisk.debugfs_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+    debugfs_create_file("stats", 0444, ramdisk.debugfs_dir, &ramdisk,
+                        &ramdisk_stats_fops);
+    debugfs_create_file("latency", 0444, ramdisk.debugfs_dir, &ramdisk,
+                        &ramdisk_latency_fops);
+
+    pr_info("RAM disk registered: /dev/%s (%lu MB, %u hw queues (%d poll), depth %u)\n",
+            ramdisk.disk->disk_name, disk_size_mb,
+            ramdisk.tag_set.nr_hw_queues, poll_queues,
+            ramdisk.tag_set.queue_depth);
     return 0;
 
 cleanup_disk:
     put_disk(ramdisk.disk);
 free_tag_set:
     blk_mq_free_tag_set(&ramdisk.tag_set);
-free_data:
-    vfree(ramdisk.data);
     return err;
 }
 
 static void __exit ramdisk_exit(void)
 {
+    debugfs_remove_recursive(ramdisk.debugfs_dir);
     del_gendisk(ramdisk.disk);
     put_disk(ramdisk.disk);
     blk_mq_free_tag_set(&ramdisk.tag_set);
-    vfree(ramdisk.data);
-    pr_info("RAM disk unregistered\n");
+    pr_info("RAM disk unregistered (%ld pages were in use)\n",
+            atomic_long_read(&ramdisk.nr_pages));
+    rcu_barrier();  /* Wait for pages freed by discard */
+    ramdisk_free_pages(&ramdisk);
 }
 
 module_init(ramdisk_init);
@@ -6,11 +6,16 @@
  * - Device matching by VID:PID
  * - Endpoint discovery in probe
  * - Bulk transfers (sync and async)
+ * - Anchored multi-URB streaming for bulk IN and OUT
  * - Proper disconnect handling
  *
  * This driver creates a misc device for userspace access.
  * Write data to send to device, read to receive.
  *
+ * With in_urbs/out_urbs > 0 (the default), several bulk-IN URBs stay in
+ * flight and stream into a kfifo, and writes queue bulk-OUT URBs without
+ * waiting for them. Setting either to 0 falls back to usb_bulk_msg().
+ *
  * NOTE: Modify VID:PID to match your actual device, or use
  * the loopback test with dummy_hcd for testing.
  */
@@ -20,18 +25,42 @@
 #include <linux/slab.h>
 #include <linux/miscdevice.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
 
 #define DRIVER_NAME "usb_demo"
 #define BUFFER_SIZE 64
+#define MAX_URBS    32
+#define MAX_URB_SIZE (1024 * 1024)
 
 /* Change these to match your device */
 #define DEMO_VID 0x1234
 #define DEMO_PID 0x5678
 
+static unsigned int in_urbs = 4;
+module_param(in_urbs, uint, 0444);
+MODULE_PARM_DESC(in_urbs, "Bulk-IN URBs kept in flight, 0 for synchronous reads (default: 4)");
+
+static unsigned int out_urbs = 8;
+module_param(out_urbs, uint, 0444);
+MODULE_PARM_DESC(out_urbs, "Bulk-OUT URBs that may be queued, 0 for synchronous writes (default: 8)");
+
+static unsigned int urb_size = 16384;
+module_param(urb_size, uint, 0444);
+MODULE_PARM_DESC(urb_size, "Bytes per URB, rounded up to the IN max packet size (default: 16384)");
+
+static unsigned int rx_fifo_size = 65536;
+module_param(rx_fifo_size, uint, 0444);
+MODULE_PARM_DESC(rx_fifo_size, "Receive ring size in bytes, at least in_urbs * urb_size (default: 65536)");
+
 struct usb_demo {
     struct usb_device *udev;
     struct usb_interface *intf;
     struct miscdevice misc;
+    struct kref kref;           /* Held by probe and by each open file */
 
     /* Endpoints */
     unsigned char bulk_in_addr;
@@ -45,14 +74,327 @@ struct usb_demo {
     /* Synchronization */
     struct mutex io_mutex;
     bool connected;
-
-    /* For async read */
-    struct urb *read_urb;
-    struct completion read_done;
-    int read_status;
-    int read_actual;
+    int open_count;
+
+    /*
+     * Async engine. Every URB is owned by exactly one anchor: in flight
+     * on in_anchor/out_anchor, or idle on in_idle/out_idle.
+     */
+    unsigned int in_urbs;
+    unsigned int out_urbs;
+    size_t urb_size;
+
+    struct usb_anchor in_anchor;
+    struct usb_anchor in_idle;
+    struct mutex read_mutex;    /* One reader drains the fifo at a time */
+    spinlock_t rx_lock;         /* Producer side of rx_fifo and below */
+    struct kfifo rx_fifo;
+    size_t rx_reserved;         /* Fifo space promised to in-flight URBs */
+    bool rx_streaming;
+    int rx_error;
+    wait_queue_head_t rx_wait;
+
+    struct usb_anchor out_anchor;
+    struct usb_anchor out_idle;
+    int out_error;              /* First failed OUT URB, reported once */
+    wait_queue_head_t out_wait;
 };
 
+static void usb_demo_delete(struct kref *kref);
+
+/* ============ Async Engine ============ */
+
+static bool usb_demo_urb_unlinked(int status)
+{
+    return status == -ENOENT || status == -ECONNRESET || status == -ESHUTDOWN;
+}
+
+/* Queue an IN URB, reserving fifo room for a full transfer; rx_lock held */
+static int usb_demo_rx_submit(struct usb_demo *dev, struct urb *urb)
+{
+    int ret;
+
+    usb_anchor_urb(urb, &dev->in_anchor);
+    ret = usb_submit_urb(urb, GFP_ATOMIC);
+    if (ret) {
+        usb_unanchor_urb(urb);
+        usb_anchor_urb(urb, &dev->in_idle);
+        dev->rx_error = ret;
+        return ret;
+    }
+
+    dev->rx_reserved += dev->urb_size;
+    return 0;
+}
+
+/* Submit idle IN URBs while the fifo can take what they return; rx_lock held */
+static void usb_demo_rx_refill(struct usb_demo *dev)
+{
+    struct urb *urb;
+    int ret;
+
+    while (dev->rx_streaming && !dev->rx_error &&
+           kfifo_avail(&dev->rx_fifo) >= dev->rx_reserved + dev->urb_size) {
+        urb = usb_get_from_anchor(&dev->in_idle);
+        if (!urb)
+            break;
+
+        ret = usb_demo_rx_submit(dev, urb);
+        usb_free_urb(urb);      /* The anchor now holds the reference */
+        if (ret)
+            break;
+    }
+}
+
+/*
+ * The URB payload goes straight into the fifo, which always has room
+ * because of the reservation. The URB is then parked and refill()
+ * resubmits it if the fifo still has space, so a slow reader stalls the
+ * device instead of losing data.
+ */
+static void usb_demo_rx_complete(struct urb *urb)
+{
+    struct usb_demo *dev = urb->context;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev->rx_lock, flags);
+
+    dev->rx_reserved -= dev->urb_size;
+
+    if (!urb->status)
+        kfifo_in(&dev->rx_fifo, urb->transfer_buffer, urb->actual_length);
+    else if (!usb_demo_urb_unlinked(urb->status) && !dev->rx_error)
+        dev->rx_error = urb->status;
+
+    usb_anchor_urb(urb, &dev->in_idle);
+    usb_demo_rx_refill(dev);
+
+    spin_unlock_irqrestore(&dev->rx_lock, flags);
+
+    wake_up_interruptible(&dev->rx_wait);
+}
+
+/* First open: start streaming into an empty fifo */
+static void usb_demo_rx_start(struct usb_demo *dev)
+{
+    spin_lock_irq(&dev->rx_lock);
+    kfifo_reset(&dev->rx_fifo);
+    dev->rx_error = 0;
+    dev->rx_streaming = true;
+    usb_demo_rx_refill(dev);
+    spin_unlock_irq(&dev->rx_lock);
+}
+
+/* Last close or disconnect: kill the IN URBs; they park themselves */
+static void usb_demo_rx_stop(struct usb_demo *dev)
+{
+    spin_lock_irq(&dev->rx_lock);
+    dev->rx_streaming = false;
+    spin_unlock_irq(&dev->rx_lock);
+
+    usb_kill_anchored_urbs(&dev->in_anchor);
+}
+
+static void usb_demo_tx_complete(struct urb *urb)
+{
+    struct usb_demo *dev = urb->context;
+
+    if (urb->status && !usb_demo_urb_unlinked(urb->status))
+        cmpxchg(&dev->out_error, 0, urb->status);
+
+    usb_anchor_urb(urb, &dev->out_idle);
+    wake_up_interruptible(&dev->out_wait);
+}
+
+static struct urb *usb_demo_alloc_urb(struct usb_demo *dev, unsigned int pipe,
+                                      usb_complete_t complete)
+{
+    struct urb *urb;
+    void *buf;
+
+    urb = usb_alloc_urb(0, GFP_KERNEL);
+    if (!urb)
+        return NULL;
+
+    buf = usb_alloc_coherent(dev->udev, dev->urb_size, GFP_KERNEL,
+                             &urb->transfer_dma);
+    if (!buf) {
+        usb_free_urb(urb);
+        return NULL;
+    }
+
+    usb_fill_bulk_urb(urb, dev->udev, pipe, buf, dev->urb_size, complete, dev);
+    urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+    return urb;
+}
+
+/* Allocate count URBs and park them on an idle anchor */
+static int usb_demo_alloc_urbs(struct usb_demo *dev, struct usb_anchor *idle,
+                               unsigned int count, unsigned int pipe,
+                               usb_complete_t complete)
+{
+    struct urb *urb;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        urb = usb_demo_alloc_urb(dev, pipe, complete);
+        if (!urb)
+            return -ENOMEM;
+
+        usb_anchor_urb(urb, idle);
+        usb_free_urb(urb);
+    }
+
+    return 0;
+}
+
+static void usb_demo_free_urbs(struct usb_demo *dev, struct usb_anchor *idle)
+{
+    struct urb *urb;
+
+    while ((urb = usb_get_from_anchor(idle))) {
+        usb_free_coherent(dev->udev, dev->urb_size, urb->transfer_buffer,
+                          urb->transfer_dma);
+        usb_free_urb(urb);
+    }
+}
+
+static ssize_t usb_demo_read_async(struct usb_demo *dev, struct file *file,
+                                   char __user *buf, size_t count)
+{
+    unsigned int copied;
+    int ret;
+
+    if (mutex_lock_interruptible(&dev->read_mutex))
+        return -ERESTARTSYS;
+
+    while (kfifo_is_empty(&dev->rx_fifo)) {
+        if (!dev->connected) {
+            ret = -ENODEV;
+            goto unlock;
+        }
+
+        /* Report a transfer error once, then resume streaming */
+        spin_lock_irq(&dev->rx_lock);
+        ret = dev->rx_error;
+        dev->rx_error = 0;
+        spin_unlock_irq(&dev->rx_lock);
+
+        if (ret) {
+            dev_err(&dev->intf->dev, "Bulk read failed: %d\n", ret);
+            if (ret == -EPIPE)
+                usb_clear_halt(dev->udev,
+                               usb_rcvbulkpipe(dev->udev, dev->bulk_in_addr));
+
+            spin_lock_irq(&dev->rx_lock);
+            usb_demo_rx_refill(dev);
+            spin_unlock_irq(&dev->rx_lock);
+            goto unlock;
+        }
+
+        if (file->f_flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            goto unlock;
+        }
+
+        ret = wait_event_interruptible(dev->rx_wait,
+                                       !kfifo_is_empty(&dev->rx_fifo) ||
+                                       READ_ONCE(dev->rx_error) ||
+                                       !dev->connected);
+        if (ret)
+            goto unlock;
+    }
+
+    ret = kfifo_to_user(&dev->rx_fifo, buf, count, &copied);
+    if (!ret)
+        ret = copied;
+
+    /* Space freed: restart any URBs that were parked for lack of room */
+    spin_lock_irq(&dev->rx_lock);
+    usb_demo_rx_refill(dev);
+    spin_unlock_irq(&dev->rx_lock);
+
+unlock:
+    mutex_unlock(&dev->read_mutex);
+    return ret;
+}
+
+/*
+ * Fill idle OUT URBs from the user buffer and submit them without waiting.
+ * Blocks only when every URB is in flight and nothing was queued yet.
+ */
+static ssize_t usb_demo_write_async(struct usb_demo *dev, struct file *file,
+                                    const char __user *buf, size_t count)
+{
+    size_t done = 0, len;
+    struct urb *urb;
+    int ret;
+
+    if (mutex_lock_interruptible(&dev->io_mutex))
+        return -ERESTARTSYS;
+
+    /* An earlier queued write failed */
+    ret = xchg(&dev->out_error, 0);
+    if (ret)
+        goto unlock;
+
+    while (done < count) {
+        if (!dev->connected) {
+            ret = -ENODEV;
+            break;
+        }
+
+        urb = usb_get_from_anchor(&dev->out_idle);
+        if (!urb) {
+            if (done)
+                break;
+
+            if (file->f_flags & O_NONBLOCK) {
+                ret = -EAGAIN;
+                break;
+            }
+
+            mutex_unlock(&dev->io_mutex);
+            ret = wait_event_interruptible(dev->out_wait,
+                                           !usb_anchor_empty(&dev->out_idle) ||
+                                           !dev->connected);
+            if (ret)
+                return ret;
+            if (mutex_lock_interruptible(&dev->io_mutex))
+                return -ERESTARTSYS;
+            continue;
+        }
+
+        len = min(count - done, dev->urb_size);
+        if (copy_from_user(urb->transfer_buffer, buf + done, len)) {
+            ret = -EFAULT;
+            goto park;
+        }
+
+        urb->transfer_buffer_length = len;
+        usb_anchor_urb(urb, &dev->out_anchor);
+        ret = usb_submit_urb(urb, GFP_KERNEL);
+        if (ret) {
+            dev_err(&dev->intf->dev, "Bulk write failed: %d\n", ret);
+            usb_unanchor_urb(urb);
+            goto park;
+        }
+
+        usb_free_urb(urb);
+        done += len;
+    }
+    goto unlock;
+
+park:
+    usb_anchor_urb(urb, &dev->out_idle);
+    usb_free_urb(urb);
+
+unlock:
+    mutex_unlock(&dev->io_mutex);
+    return done ? done : ret;
+}
+
 /* ============ File Operations ============ */
 
 static int usb_demo_open(struct inode *inode, struct file *file)
@@ -65,9 +407,71 @@ static int usb_demo_open(struct inode *inode, struct file *file)
     if (!dev->connected)
         return -ENODEV;
 
+    kref_get(&dev->kref);
+
+    mutex_lock(&dev->io_mutex);
+    if (dev->in_urbs && dev->open_count++ == 0)
+        usb_demo_rx_start(dev);
+    mutex_unlock(&dev->io_mutex);
+
     return 0;
 }
 
+static int usb_demo_release(struct inode *inode, struct file *file)
+{
+    struct usb_demo *dev = file->private_data;
+
+    mutex_lock(&dev->io_mutex);
+    if (dev->in_urbs && --dev->open_count == 0)
+        usb_demo_rx_stop(dev);
+    mutex_unlock(&dev->io_mutex);
+
+    kref_put(&dev->kref, usb_demo_delete);
+    return 0;
+}
+
+/* Wait for queued writes to reach the device and report their errors */
+static int usb_demo_flush(struct file *file, fl_owner_t id)
+{
+    struct usb_demo *dev = file->private_data;
+
+    if (!dev->out_urbs)
+        return 0;
+
+    if (!usb_wait_anchor_empty_timeout(&dev->out_anchor, 5000))
+        return -ETIMEDOUT;
+
+    return xchg(&dev->out_error, 0);
+}
+
+static int usb_demo_fsync(struct file *file, loff_t start, loff_t end,
+                          int datasync)
+{
+    return usb_demo_flush(file, NULL);
+}
+
+static __poll_t usb_demo_poll(struct file *file, poll_table *wait)
+{
+    struct usb_demo *dev = file->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(file, &dev->rx_wait, wait);
+    poll_wait(file, &dev->out_wait, wait);
+
+    if (!dev->connected)
+        return EPOLLHUP | EPOLLERR;
+
+    /* The synchronous paths never report "not ready" */
+    if (!dev->in_urbs || !kfifo_is_empty(&dev->rx_fifo) ||
+        READ_ONCE(dev->rx_error))
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    if (!dev->out_urbs || !usb_anchor_empty(&dev->out_idle))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+
+    return mask;
+}
+
 static ssize_t usb_demo_read(struct file *file, char __user *buf,
                               size_t count, loff_t *ppos)
 {
@@ -78,6 +482,9 @@ static ssize_t usb_demo_read(struct file *file, char __user *buf,
     if (!dev->connected)
         return -ENODEV;
 
+    if (dev->in_urbs)
+        return usb_demo_read_async(dev, file, buf, count);
+
     if (count > dev->bulk_in_size)
         count = dev->bulk_in_size;
 
@@ -125,6 +532,9 @@ static ssize_t usb_demo_write(struct file *file, const char __user *buf,
     if (!dev->connected)
         return -ENODEV;
 
+    if (dev->out_urbs)
+        return usb_demo_write_async(dev, file, buf, count);
+
     if (count > BUFFER_SIZE)
         count = BUFFER_SIZE;
 
@@ -165,12 +575,62 @@ unlock:
 static const struct file_operations usb_demo_fops = {
     .owner = THIS_MODULE,
     .open = usb_demo_open,
+    .release = usb_demo_release,
     .read = usb_demo_read,
     .write = usb_demo_write,
+    .flush = usb_demo_flush,
+    .fsync = usb_demo_fsync,
+    .poll = usb_demo_poll,
 };
 
 /* ============ USB Probe/Disconnect ============ */
 
+/* Last reference gone: disconnected and no file open */
+static void usb_demo_delete(struct kref *kref)
+{
+    struct usb_demo *dev = container_of(kref, struct usb_demo, kref);
+
+    usb_demo_free_urbs(dev, &dev->in_idle);
+    usb_demo_free_urbs(dev, &dev->out_idle);
+    kfifo_free(&dev->rx_fifo);
+    kfree(dev->bulk_in_buffer);
+    kfree(dev->bulk_out_buffer);
+    usb_put_dev(dev->udev);
+    kfree(dev);
+}
+
+static int usb_demo_setup_async(struct usb_demo *dev)
+{
+    size_t fifo_size;
+    int ret;
+
+    dev->in_urbs = min_t(unsigned int, in_urbs, MAX_URBS);
+    dev->out_urbs = min_t(unsigned int, out_urbs, MAX_URBS);
+    if (!dev->in_urbs && !dev->out_urbs)
+        return 0;
+
+    /* Whole packets per URB, or a short packet would end it early */
+    dev->urb_size = clamp_t(size_t, urb_size, dev->bulk_in_size, MAX_URB_SIZE);
+    dev->urb_size = roundup(dev->urb_size, dev->bulk_in_size);
+
+    if (dev->in_urbs) {
+        fifo_size = max_t(size_t, rx_fifo_size, dev->in_urbs * dev->urb_size);
+        ret = kfifo_alloc(&dev->rx_fifo, fifo_size, GFP_KERNEL);
+        if (ret)
+            return ret;
+
+        ret = usb_demo_alloc_urbs(dev, &dev->in_idle, dev->in_urbs,
+                                  usb_rcvbulkpipe(dev->udev, dev->bulk_in_addr),
+                                  usb_demo_rx_complete);
+        if (ret)
+            return ret;
+    }
+
+    return usb_demo_alloc_urbs(dev, &dev->out_idle, dev->out_urbs,
+                               usb_sndbulkpipe(dev->udev, dev->bulk_out_addr),
+                               usb_demo_tx_complete);
+}
+
 static int usb_demo_probe(struct usb_interface *intf,
                           const struct usb_device_id *id)
 {
@@ -184,10 +644,18 @@ static int usb_demo_probe(struct usb_interface *intf,
     if (!dev)
         return -ENOMEM;
 
-    dev->udev = interface_to_usbdev(intf);
+    kref_init(&dev->kref);
+    dev->udev = usb_get_dev(interface_to_usbdev(intf));
     dev->intf = intf;
     mutex_init(&dev->io_mutex);
-    init_completion(&dev->read_done);
+    mutex_init(&dev->read_mutex);
+    spin_lock_init(&dev->rx_lock);
+    init_waitqueue_head(&dev->rx_wait);
+    init_waitqueue_head(&dev->out_wait);
+    init_usb_anchor(&dev->in_anchor);
+    init_usb_anchor(&dev->in_idle);
+    init_usb_anchor(&dev->out_anchor);
+    init_usb_anchor(&dev->out_idle);
     dev->connected = true;
 
     /* Find bulk endpoints */
@@ -218,6 +686,10 @@ static int usb_demo_probe(struct usb_interface *intf,
         goto error;
     }
 
+    ret = usb_demo_setup_async(dev);
+    if (ret)
+        goto error;
+
     /* Register misc device */
     dev->misc.minor = MISC_DYNAMIC_MINOR;
     dev->misc.name = DRIVER_NAME;
@@ -231,15 +703,14 @@ static int usb_demo_probe(struct usb_interface *intf,
 
     usb_set_intfdata(intf, dev);
 
-    dev_info(&intf->dev, "USB demo device attached (IN:0x%02x OUT:0x%02x)\n",
-             dev->bulk_in_addr, dev->bulk_out_addr);
+    dev_info(&intf->dev, "USB demo device attached (IN:0x%02x OUT:0x%02x, %u+%u URBs of %zu bytes)\n",
+             dev->bulk_in_addr, dev->bulk_out_addr,
+             dev->in_urbs, dev->out_urbs, dev->urb_size);
 
     return 0;
 
 error:
-    kfree(dev->bulk_in_buffer);
-    kfree(dev->bulk_out_buffer);
-    kfree(dev);
+    kref_put(&dev->kref, usb_demo_delete);
     return ret;
 }
 
@@ -252,17 +723,21 @@ static void usb_demo_disconnect(struct usb_interface *intf)
     dev->connected = false;
     mutex_unlock(&dev->io_mutex);
 
-    /* Unregister misc device */
+    /* Unregister misc device; no new opens after this */
     misc_deregister(&dev->misc);
 
-    usb_set_intfdata(intf, NULL);
+    /* Stop the engine and wake anyone blocked in read, write or poll */
+    usb_demo_rx_stop(dev);
+    usb_kill_anchored_urbs(&dev->out_anchor);
+    wake_up_interruptible_all(&dev->rx_wait);
+    wake_up_interruptible_all(&dev->out_wait);
 
-    /* Free resources */
-    kfree(dev->bulk_in_buffer);
-    kfree(dev->bulk_out_buffer);
-    kfree(dev);
+    usb_set_intfdata(intf, NULL);
 
     dev_info(&intf->dev, "USB demo device disconnected\n");
+
+    /* Freed here, or by the last release() if a file is still open */
+    kref_put(&dev->kref, usb_demo_delete);
 }
 
 /* ============ Module Registration ============ */
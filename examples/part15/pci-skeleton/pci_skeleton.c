@@ -5,7 +5,8 @@
  * A minimal PCI driver template demonstrating:
  * - Device matching by VID:PID
  * - BAR mapping with managed resources
- * - MSI interrupt setup
+ * - MSI-X per-queue interrupts with spread affinity, MSI/INTx fallback
+ * - DMA descriptor rings with budgeted, interrupt-masked completion polling
  * - Proper error handling
  *
  * NOTE: Modify VID:PID to match your actual device.
@@ -14,6 +15,11 @@
 #include <linux/module.h>
 #include <linux/pci.h>
 #include <linux/interrupt.h>
+#include <linux/cpumask.h>
+#include <linux/dma-mapping.h>
+#include <linux/irq_poll.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
 
 #define DRIVER_NAME "pci_skeleton"
 
@@ -26,10 +32,98 @@
 #define REG_CONTROL   0x04
 #define REG_DATA      0x08
 
+/* REG_STATUS bits: device events, plus queue events when sharing one IRQ */
+#define STATUS_DEVICE_IRQ     BIT(0)
+#define STATUS_QUEUE_SHIFT    8
+#define STATUS_QUEUE_MASK     GENMASK(23, STATUS_QUEUE_SHIFT)
+
+/* Per-queue register block (device-specific) */
+#define REG_QUEUE_BASE        0x100
+#define REG_QUEUE_STRIDE      0x40
+#define REG_Q_IRQ_VECTOR      0x00    /* MSI-X entry the queue raises */
+#define REG_Q_IRQ_MASK        0x04    /* 1 = queue interrupt masked */
+#define REG_Q_SQ_BASE_LO      0x08
+#define REG_Q_SQ_BASE_HI      0x0c
+#define REG_Q_CQ_BASE_LO      0x10
+#define REG_Q_CQ_BASE_HI      0x14
+#define REG_Q_RING_SIZE       0x18    /* Entries; 0 disables the queue */
+#define REG_Q_SQ_TAIL         0x1c    /* Submission doorbell */
+#define REG_Q_CQ_HEAD         0x20    /* Completion doorbell */
+
+#define SKEL_MAX_QUEUES       16
+#define SKEL_RING_SIZE        256     /* Power of two */
+
+static unsigned int queues;
+module_param(queues, uint, 0444);
+MODULE_PARM_DESC(queues, "Queues to create, 0 for one per online CPU (max 16)");
+
+static unsigned int poll_budget = 64;
+module_param(poll_budget, uint, 0444);
+MODULE_PARM_DESC(poll_budget, "Completions reaped per queue poll before yielding (default: 64)");
+
+static unsigned int dma_test;
+module_param(dma_test, uint, 0444);
+MODULE_PARM_DESC(dma_test, "Descriptors to push through queue 0 at probe as a self-test (default: 0)");
+
+/* Submission descriptor, written by the driver (device-specific) */
+struct skel_desc {
+    __le64 addr;
+    __le32 len;
+    __le16 id;                  /* Echoed back in the completion */
+    __le16 flags;
+};
+
+#define SKEL_DESC_TO_DEVICE   BIT(0)
+
+/* Completion entry, written by the device (device-specific) */
+struct skel_cpl {
+    __le32 len;                 /* Bytes transferred */
+    __le16 id;
+    __le16 status;              /* Bit 0 phase, bits 15:1 error code */
+};
+
+#define SKEL_CPL_PHASE        BIT(0)
+
+struct skeleton_dev;
+
+struct skel_queue {
+    struct skeleton_dev *dev;
+    void __iomem *regs;
+    unsigned int index;
+    int irq;                    /* Own vector, or the shared one */
+    unsigned long irq_count;
+
+    /*
+     * Rings. Counters run freely and are masked to a slot. The device
+     * completes descriptors in order, so each completion frees the
+     * oldest slot.
+     */
+    struct skel_desc *sq;
+    dma_addr_t sq_dma;
+    struct skel_cpl *cq;
+    dma_addr_t cq_dma;
+    void **ctx;                 /* Caller cookie per descriptor slot */
+    spinlock_t lock;            /* Submission side */
+    u16 sq_tail;
+    u16 sq_head;                /* Written by the poller only */
+    u16 cq_head;
+    u16 pending;                /* Submitted since the last doorbell */
+    bool cq_phase;              /* Phase that marks a new completion */
+    struct irq_poll iop;
+    void (*complete)(struct skel_queue *q, void *ctx, int status, u32 len);
+    unsigned long polls;
+    unsigned long completions;
+};
+
 struct skeleton_dev {
     struct pci_dev *pdev;
     void __iomem *regs;
-    int irq;
+    int irq;                    /* Device events (vector 0) */
+
+    /* Queues; each has its own vector when per_queue_vectors is set */
+    bool per_queue_vectors;
+    unsigned int nr_queues;
+    struct skel_queue queues[SKEL_MAX_QUEUES];
 
     /* Device state */
     u32 hw_version;
@@ -47,31 +141,458 @@ static inline void skel_write(struct skeleton_dev *dev, int reg, u32 val)
     writel(val, dev->regs + reg);
 }
 
-/* ============ Interrupt Handler ============ */
+static inline void skel_q_write(struct skel_queue *q, int reg, u32 val)
+{
+    writel(val, q->regs + reg);
+}
+
+/* ============ Interrupt Handlers ============ */
+
+/*
+ * One queue's interrupt, however it was delivered. Like NAPI, mask the
+ * queue and move completion processing to the poll; the device does not
+ * interrupt again until the poll runs dry and unmasks.
+ */
+static void skeleton_queue_event(struct skel_queue *q)
+{
+    q->irq_count++;
+
+    /* Posted write; no read back over the bus */
+    skel_q_write(q, REG_Q_IRQ_MASK, 1);
+    irq_poll_sched(&q->iop);
+}
+
+/*
+ * Per-queue vector. The vector itself says which queue fired, so there is
+ * no REG_STATUS read, and with spread affinity it runs on a CPU served by
+ * that queue.
+ */
+static irqreturn_t skeleton_queue_irq(int irq, void *data)
+{
+    skeleton_queue_event(data);
+    return IRQ_HANDLED;
+}
 
+/*
+ * Device events on vector 0. Without per-queue vectors this is the only
+ * interrupt, and REG_STATUS also says which queues need service.
+ */
 static irqreturn_t skeleton_irq(int irq, void *data)
 {
     struct skeleton_dev *dev = data;
+    unsigned long pending;
+    unsigned int q;
     u32 status;
 
     status = skel_read(dev, REG_STATUS);
 
     /* Check if this interrupt is from our device */
-    if (!(status & 0x1))
+    if (!(status & (STATUS_DEVICE_IRQ | STATUS_QUEUE_MASK)))
         return IRQ_NONE;
 
     /* Acknowledge/clear interrupt */
     skel_write(dev, REG_STATUS, status);
 
+    if (!dev->per_queue_vectors) {
+        pending = (status & STATUS_QUEUE_MASK) >> STATUS_QUEUE_SHIFT;
+        for_each_set_bit(q, &pending, dev->nr_queues)
+            skeleton_queue_event(&dev->queues[q]);
+    }
+
     dev_dbg(&dev->pdev->dev, "Interrupt handled, status=0x%08x\n", status);
 
     return IRQ_HANDLED;
 }
 
+/* ============ Descriptor Rings ============ */
+
+/*
+ * Queue one descriptor without ringing the doorbell, so a burst of
+ * submissions costs one MMIO write in skel_ring_kick(). ctx is handed to
+ * q->complete when the device finishes the descriptor.
+ * Returns -EBUSY if the ring is full. One slot always stays free: the
+ * doorbell carries only the tail index, and a tail equal to the head
+ * would tell the device the ring is empty.
+ */
+static int skel_ring_submit(struct skel_queue *q, dma_addr_t addr, u32 len,
+                            u16 flags, void *ctx)
+{
+    struct skel_desc *d;
+    unsigned int slot;
+
+    spin_lock_bh(&q->lock);
+
+    /* Pairs with the release in skel_ring_reap() */
+    if ((u16)(q->sq_tail - smp_load_acquire(&q->sq_head)) == SKEL_RING_SIZE - 1) {
+        spin_unlock_bh(&q->lock);
+        return -EBUSY;
+    }
+
+    slot = q->sq_tail & (SKEL_RING_SIZE - 1);
+    d = &q->sq[slot];
+    d->addr = cpu_to_le64(addr);
+    d->len = cpu_to_le32(len);
+    d->id = cpu_to_le16(slot);
+    d->flags = cpu_to_le16(flags);
+    q->ctx[slot] = ctx;
+
+    q->sq_tail++;
+    q->pending++;
+
+    spin_unlock_bh(&q->lock);
+    return 0;
+}
+
+/* Ring the doorbell once for everything submitted since the last kick */
+static void skel_ring_kick(struct skel_queue *q)
+{
+    spin_lock_bh(&q->lock);
+    if (q->pending) {
+        /* writel() orders the descriptor writes before the doorbell */
+        skel_q_write(q, REG_Q_SQ_TAIL, q->sq_tail & (SKEL_RING_SIZE - 1));
+        q->pending = 0;
+    }
+    spin_unlock_bh(&q->lock);
+}
+
+static bool skel_ring_cpl_ready(struct skel_queue *q)
+{
+    struct skel_cpl *c = &q->cq[q->cq_head & (SKEL_RING_SIZE - 1)];
+
+    return !!(le16_to_cpu(READ_ONCE(c->status)) & SKEL_CPL_PHASE) == q->cq_phase;
+}
+
+/* Consume up to budget completions, then write the CQ doorbell once */
+static int skel_ring_reap(struct skel_queue *q, int budget)
+{
+    struct skel_cpl *c;
+    u16 status, id;
+    void *ctx;
+    int done = 0;
+
+    while (done < budget && skel_ring_cpl_ready(q)) {
+        c = &q->cq[q->cq_head & (SKEL_RING_SIZE - 1)];
+
+        /* Read the entry only after its phase bit says it is complete */
+        dma_rmb();
+
+        status = le16_to_cpu(c->status);
+        id = le16_to_cpu(c->id) & (SKEL_RING_SIZE - 1);
+        ctx = q->ctx[id];
+
+        if (!(++q->cq_head & (SKEL_RING_SIZE - 1)))
+            q->cq_phase = !q->cq_phase;
+
+        /* In-order completion: the oldest slot may now be reused */
+        smp_store_release(&q->sq_head, q->sq_head + 1);
+
+        if (q->complete)
+            q->complete(q, ctx, (status >> 1) ? -EIO : 0, le32_to_cpu(c->len));
+        done++;
+    }
+
+    if (done)
+        skel_q_write(q, REG_Q_CQ_HEAD, q->cq_head & (SKEL_RING_SIZE - 1));
+
+    q->completions += done;
+    return done;
+}
+
+/*
+ * irq_poll callback, run in softirq context on the CPU that took the
+ * interrupt. Using the whole budget keeps the queue scheduled with its
+ * interrupt masked. Finishing early completes the poll and unmasks the
+ * interrupt, then checks once more for a completion that landed before
+ * the unmask and would otherwise sit there without an interrupt.
+ */
+static int skel_ring_poll(struct irq_poll *iop, int budget)
+{
+    struct skel_queue *q = container_of(iop, struct skel_queue, iop);
+    int done;
+
+    q->polls++;
+    done = skel_ring_reap(q, budget);
+    if (done < budget) {
+        irq_poll_complete(iop);
+        skel_q_write(q, REG_Q_IRQ_MASK, 0);
+
+        if (skel_ring_cpl_ready(q)) {
+            skel_q_write(q, REG_Q_IRQ_MASK, 1);
+            irq_poll_sched(iop);
+        }
+    }
+
+    return done;
+}
+
+/* Queue structs and coherent rings; the device is not touched yet */
+static int skel_rings_init(struct skeleton_dev *dev)
+{
+    struct device *d = &dev->pdev->dev;
+    struct skel_queue *q;
+    unsigned int i;
+    int budget;
+
+    budget = clamp_t(unsigned int, poll_budget, 1, SKEL_RING_SIZE);
+
+    for (i = 0; i < dev->nr_queues; i++) {
+        q = &dev->queues[i];
+        q->dev = dev;
+        q->index = i;
+        q->regs = dev->regs + REG_QUEUE_BASE + i * REG_QUEUE_STRIDE;
+
+        q->sq = dmam_alloc_coherent(d, SKEL_RING_SIZE * sizeof(*q->sq),
+                                    &q->sq_dma, GFP_KERNEL);
+        q->cq = dmam_alloc_coherent(d, SKEL_RING_SIZE * sizeof(*q->cq),
+                                    &q->cq_dma, GFP_KERNEL);
+        q->ctx = devm_kcalloc(d, SKEL_RING_SIZE, sizeof(*q->ctx), GFP_KERNEL);
+        if (!q->sq || !q->cq || !q->ctx)
+            return -ENOMEM;
+
+        spin_lock_init(&q->lock);
+        q->cq_phase = true;     /* Zeroed ring: first pass writes phase 1 */
+        irq_poll_init(&q->iop, budget, skel_ring_poll);
+    }
+
+    return 0;
+}
+
+/*
+ * Hand the rings to the device (device-specific). Queue interrupts stay
+ * masked until skeleton_hw_init(), after the handlers are requested.
+ */
+static void skel_rings_enable(struct skeleton_dev *dev)
+{
+    struct skel_queue *q;
+    unsigned int i;
+
+    for (i = 0; i < dev->nr_queues; i++) {
+        q = &dev->queues[i];
+        skel_q_write(q, REG_Q_IRQ_MASK, 1);
+        skel_q_write(q, REG_Q_SQ_BASE_LO, lower_32_bits(q->sq_dma));
+        skel_q_write(q, REG_Q_SQ_BASE_HI, upper_32_bits(q->sq_dma));
+        skel_q_write(q, REG_Q_CQ_BASE_LO, lower_32_bits(q->cq_dma));
+        skel_q_write(q, REG_Q_CQ_BASE_HI, upper_32_bits(q->cq_dma));
+        skel_q_write(q, REG_Q_RING_SIZE, SKEL_RING_SIZE);
+    }
+}
+
+/* Stop the device using the rings; safe to repeat */
+static void skel_rings_quiesce(struct skeleton_dev *dev)
+{
+    struct skel_queue *q;
+    unsigned int i;
+
+    for (i = 0; i < dev->nr_queues; i++) {
+        q = &dev->queues[i];
+        skel_q_write(q, REG_Q_IRQ_MASK, 1);
+        skel_q_write(q, REG_Q_RING_SIZE, 0);
+    }
+}
+
+/*
+ * devres action, registered right after the rings are allocated: runs
+ * after the IRQs are freed and before the ring memory is, on probe
+ * failure as well as on remove. irq_poll_disable() waits out a running
+ * poll and must be called only once per queue.
+ */
+static void skel_rings_stop(void *data)
+{
+    struct skeleton_dev *dev = data;
+    unsigned int i;
+
+    skel_rings_quiesce(dev);
+    for (i = 0; i < dev->nr_queues; i++)
+        irq_poll_disable(&dev->queues[i].iop);
+}
+
+/* ============ DMA Self-Test ============ */
+
+struct skel_dma_test {
+    struct completion done;
+    atomic_t remaining;
+    int status;
+};
+
+static void skel_dma_test_complete(struct skel_queue *q, void *ctx,
+                                   int status, u32 len)
+{
+    struct skel_dma_test *t = ctx;
+
+    if (status)
+        t->status = status;
+
+    if (atomic_dec_and_test(&t->remaining))
+        complete(&t->done);
+}
+
+/* Submit a burst of descriptors on queue 0 with a single doorbell */
+static void skeleton_dma_test(struct skeleton_dev *dev)
+{
+    struct device *d = &dev->pdev->dev;
+    struct skel_queue *q = &dev->queues[0];
+    unsigned int n = min_t(unsigned int, dma_test, SKEL_RING_SIZE - 1);
+    struct skel_dma_test *t;
+    dma_addr_t dma;
+    ktime_t start;
+    unsigned int i;
+    void *buf;
+    int ret;
+
+    /* devm: a late completion after a timeout must not hit freed memory */
+    t = devm_kzalloc(d, sizeof(*t), GFP_KERNEL);
+    buf = dmam_alloc_coherent(d, PAGE_SIZE, &dma, GFP_KERNEL);
+    if (!t || !buf)
+        return;
+
+    init_completion(&t->done);
+    atomic_set(&t->remaining, n);
+    memset(buf, 0xa5, PAGE_SIZE);
+    q->complete = skel_dma_test_complete;
+
+    start = ktime_get();
+    for (i = 0; i < n; i++) {
+        ret = skel_ring_submit(q, dma, PAGE_SIZE, SKEL_DESC_TO_DEVICE, t);
+        if (ret) {
+            dev_warn(d, "DMA test: submit failed after %u descriptors: %d\n",
+                     i, ret);
+            break;
+        }
+    }
+    if (!i)
+        return;
+    /* Nothing is in flight before the kick, so the count can shrink */
+    n = i;
+    atomic_set(&t->remaining, n);
+    skel_ring_kick(q);
+
+    if (!wait_for_completion_timeout(&t->done, HZ)) {
+        dev_warn(d, "DMA test: %d of %u descriptors still pending\n",
+                 atomic_read(&t->remaining), n);
+        return;
+    }
+
+    dev_info(d, "DMA test: %u x %lu bytes in %lld us, status %d, %lu polls\n",
+             n, PAGE_SIZE, ktime_us_delta(ktime_get(), start), t->status,
+             q->polls);
+}
+
+/* ============ Interrupt Setup ============ */
+
+static void skeleton_free_irq_vectors(void *data)
+{
+    pci_free_irq_vectors(data);
+}
+
+/*
+ * Ask for one vector for device events plus one per queue, spread across
+ * CPUs by the IRQ core. pre_vectors keeps vector 0 out of the spreading.
+ * If MSI-X and multi-message MSI are unavailable, fall back to one MSI or
+ * INTx vector shared by all queues.
+ */
+static int skeleton_alloc_vectors(struct skeleton_dev *dev)
+{
+    struct pci_dev *pdev = dev->pdev;
+    struct irq_affinity affd = { .pre_vectors = 1 };
+    unsigned int nr;
+    int ret;
+
+    nr = queues ? queues : num_online_cpus();
+    nr = min_t(unsigned int, nr, SKEL_MAX_QUEUES);
+
+    ret = pci_alloc_irq_vectors_affinity(pdev, 2, nr + 1,
+                                         PCI_IRQ_MSIX | PCI_IRQ_MSI |
+                                         PCI_IRQ_AFFINITY, &affd);
+    if (ret > 0) {
+        /* May get fewer vectors than asked; run that many queues */
+        dev->per_queue_vectors = true;
+        dev->nr_queues = ret - 1;
+    } else {
+        dev_info(&pdev->dev, "Per-queue vectors unavailable (%d), sharing one IRQ\n",
+                 ret);
+
+        ret = pci_alloc_irq_vectors(pdev, 1, 1, PCI_IRQ_MSI | PCI_IRQ_LEGACY);
+        if (ret < 0)
+            return ret;
+
+        dev->per_queue_vectors = false;
+        dev->nr_queues = nr;
+    }
+
+    /* Registered before the IRQs, so devres frees the IRQs first */
+    return devm_add_action_or_reset(&pdev->dev, skeleton_free_irq_vectors, pdev);
+}
+
+static int skeleton_request_irqs(struct skeleton_dev *dev)
+{
+    struct pci_dev *pdev = dev->pdev;
+    const struct cpumask *mask;
+    struct skel_queue *q;
+    unsigned long flags;
+    unsigned int i;
+    char *name;
+    int ret;
+
+    /* An INTx line may be shared with other devices */
+    flags = (pdev->msix_enabled || pdev->msi_enabled) ? 0 : IRQF_SHARED;
+
+    dev->irq = pci_irq_vector(pdev, 0);
+    ret = devm_request_irq(&pdev->dev, dev->irq, skeleton_irq,
+                           flags, DRIVER_NAME, dev);
+    if (ret) {
+        dev_err(&pdev->dev, "Failed to request IRQ %d: %d\n",
+                dev->irq, ret);
+        return ret;
+    }
+
+    for (i = 0; i < dev->nr_queues; i++) {
+        q = &dev->queues[i];
+
+        if (!dev->per_queue_vectors) {
+            q->irq = dev->irq;
+            continue;
+        }
+
+        q->irq = pci_irq_vector(pdev, i + 1);
+
+        /* Shows up as pci_skeleton-qN in /proc/interrupts */
+        name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "%s-q%u",
+                              DRIVER_NAME, i);
+        if (!name)
+            return -ENOMEM;
+
+        ret = devm_request_irq(&pdev->dev, q->irq, skeleton_queue_irq,
+                               0, name, q);
+        if (ret) {
+            dev_err(&pdev->dev, "Failed to request queue %u IRQ %d: %d\n",
+                    i, q->irq, ret);
+            return ret;
+        }
+
+        /* Route the queue's events to its vector (device-specific) */
+        skel_q_write(q, REG_Q_IRQ_VECTOR, i + 1);
+
+        mask = pci_irq_get_affinity(pdev, i + 1);
+        if (mask)
+            dev_dbg(&pdev->dev, "Queue %u: IRQ %d, CPUs %*pbl\n",
+                    i, q->irq, cpumask_pr_args(mask));
+    }
+
+    dev_info(&pdev->dev, "%u queues, %s, IRQ %d for device events\n",
+             dev->nr_queues,
+             !dev->per_queue_vectors ? "one shared IRQ" :
+             pdev->msix_enabled ? "MSI-X per queue" : "MSI per queue",
+             dev->irq);
+
+    return 0;
+}
+
 /* ============ Device Initialization ============ */
 
 static int skeleton_hw_init(struct skeleton_dev *dev)
 {
+    unsigned int i;
+
     /* Read hardware version (example) */
     dev->hw_version = skel_read(dev, REG_STATUS);
 
@@ -80,6 +601,10 @@ static int skeleton_hw_init(struct skeleton_dev *dev)
     /* Initialize hardware (device-specific) */
     /* skel_write(dev, REG_CONTROL, ...); */
 
+    /* Handlers are in place; let the queues interrupt */
+    for (i = 0; i < dev->nr_queues; i++)
+        skel_q_write(&dev->queues[i], REG_Q_IRQ_MASK, 0);
+
     return 0;
 }
 
@@ -141,37 +666,42 @@ static int skeleton_probe(struct pci_dev *pdev,
         dev_info(&pdev->dev, "Using 64-bit DMA\n");
     }
 
-    /* Allocate MSI interrupt */
-    ret = pci_alloc_irq_vectors(pdev, 1, 1,
-                                PCI_IRQ_MSI | PCI_IRQ_LEGACY);
-    if (ret < 0) {
+    /* Allocate per-queue MSI-X vectors, or one shared MSI/INTx */
+    ret = skeleton_alloc_vectors(dev);
+    if (ret) {
         dev_err(&pdev->dev, "Failed to allocate IRQ: %d\n", ret);
         return ret;
     }
 
-    dev->irq = pci_irq_vector(pdev, 0);
+    /* Rings before IRQs, so devres frees the IRQs before the rings */
+    ret = skel_rings_init(dev);
+    if (ret)
+        return ret;
 
-    ret = devm_request_irq(&pdev->dev, dev->irq, skeleton_irq,
-                           0, DRIVER_NAME, dev);
-    if (ret) {
-        dev_err(&pdev->dev, "Failed to request IRQ %d: %d\n",
-                dev->irq, ret);
-        goto free_irq_vectors;
-    }
+    /*
+     * Disable the queues before devres frees their rings, so a failure
+     * below cannot leave the device DMAing into freed memory
+     */
+    ret = devm_add_action_or_reset(&pdev->dev, skel_rings_stop, dev);
+    if (ret)
+        return ret;
 
-    dev_info(&pdev->dev, "IRQ %d allocated\n", dev->irq);
+    skel_rings_enable(dev);
+
+    ret = skeleton_request_irqs(dev);
+    if (ret)
+        return ret;
 
     /* Initialize hardware */
     ret = skeleton_hw_init(dev);
     if (ret)
-        goto free_irq_vectors;
+        return ret;
+
+    if (dma_test)
+        skeleton_dma_test(dev);
 
     dev_info(&pdev->dev, "PCI skeleton driver loaded\n");
     return 0;
-
-free_irq_vectors:
-    pci_free_irq_vectors(pdev);
-    return ret;
 }
 
 static void skeleton_remove(struct pci_dev *pdev)
@@ -181,7 +711,10 @@ static void skeleton_remove(struct pci_dev *pdev)
     /* Disable hardware interrupts first (device-specific) */
     /* skel_write(dev, REG_CONTROL, 0); */
 
-    pci_free_irq_vectors(pdev);
+    /* Stop queue DMA and interrupts now; devres repeats it after free_irq */
+    skel_rings_quiesce(dev);
+
+    /* IRQs, rings, then vectors are released by devres after this returns */
 
     dev_info(&pdev->dev, "PCI skeleton driver removed\n");
 }
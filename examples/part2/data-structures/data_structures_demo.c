@@ -5,6 +5,8 @@
  * Demonstrates:
  * - Linked lists (list_head)
  * - Hash tables (DEFINE_HASHTABLE)
+ * - Resizable hash tables (rhashtable) with RCU lookups
+ * - XArray as an ID index
  * - Safe iteration and deletion
  * - container_of / list_entry usage
  */
@@ -12,10 +14,28 @@
 #include <linux/module.h>
 #include <linux/list.h>
 #include <linux/hashtable.h>
+#include <linux/hash.h>
+#include <linux/rhashtable.h>
+#include <linux/xarray.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 
+static bool use_rhashtable = true;
+module_param(use_rhashtable, bool, 0444);
+MODULE_PARM_DESC(use_rhashtable, "Back the device table with a resizable rhashtable instead of 64 fixed buckets (default: true)");
+
+/*
+ * Serializes all writers and the benchmark. Device lookups take no
+ * lock; they run under rcu_read_lock() and entries are freed with
+ * kfree_rcu().
+ */
+static DEFINE_MUTEX(data_lock);
+
 /* --- Linked List --- */
 
 struct client {
@@ -25,6 +45,7 @@ struct client {
 };
 
 static LIST_HEAD(client_list);
+static DEFINE_XARRAY(client_index);  /* id -> client, keeps remove O(log n) */
 static int client_count;
 
 /* --- Hash Table --- */
@@ -32,12 +53,26 @@ static int client_count;
 struct device_entry {
 	int dev_id;
 	char description[48];
-	struct hlist_node node;
+	struct hlist_node node;         /* Fixed table */
+	struct rhash_head rnode;        /* rhashtable */
+	struct list_head list;          /* All devices, for clear */
+	struct rcu_head rcu;
 };
 
 static DEFINE_HASHTABLE(device_table, 6);  /* 2^6 = 64 buckets */
+static LIST_HEAD(device_list);
 static int device_count;
 
+/* Starts small, doubles past 75% load and halves below 30% */
+static const struct rhashtable_params device_rht_params = {
+	.key_len = sizeof(int),
+	.key_offset = offsetof(struct device_entry, dev_id),
+	.head_offset = offsetof(struct device_entry, rnode),
+	.automatic_shrinking = true,
+};
+
+static struct rhashtable device_rht;
+
 /* --- Linked list operations --- */
 
 static void add_client(int id, const char *name)
@@ -50,22 +85,29 @@ static void add_client(int id, const char *name)
 
 	c->id = id;
 	strscpy(c->name, name, sizeof(c->name));
+
+	/* Fails with -EBUSY if the id is taken */
+	if (xa_insert(&client_index, id, c, GFP_KERNEL)) {
+		kfree(c);
+		return;
+	}
+
 	list_add_tail(&c->list, &client_list);
 	client_count++;
 }
 
 static void remove_client(int id)
 {
-	struct client *c, *tmp;
+	struct client *c;
 
-	list_for_each_entry_safe(c, tmp, &client_list, list) {
-		if (c->id == id) {
-			list_del(&c->list);
-			kfree(c);
-			client_count--;
-			return;
-		}
-	}
+	/* Index lookup instead of walking the list */
+	c = xa_erase(&client_index, id);
+	if (!c)
+		return;
+
+	list_del(&c->list);
+	kfree(c);
+	client_count--;
 }
 
 static void clear_clients(void)
@@ -76,14 +118,32 @@ static void clear_clients(void)
 		list_del(&c->list);
 		kfree(c);
 	}
+	xa_destroy(&client_index);
 	client_count = 0;
 }
 
 /* --- Hash table operations --- */
 
+/* Caller holds rcu_read_lock(); the entry is valid until it drops it */
+static struct device_entry *find_device(int id)
+{
+	struct device_entry *e;
+
+	if (use_rhashtable)
+		return rhashtable_lookup(&device_rht, &id, device_rht_params);
+
+	hash_for_each_possible_rcu(device_table, e, node, id) {
+		if (e->dev_id == id)
+			return e;
+	}
+	return NULL;
+}
+
+/* Caller holds data_lock; an id that is already present is ignored */
 static void add_device(int id, const char *desc)
 {
 	struct device_entry *e;
+	bool dup;
 
 	e = kmalloc(sizeof(*e), GFP_KERNEL);
 	if (!e)
@@ -91,32 +151,223 @@ static void add_device(int id, const char *desc)
 
 	e->dev_id = id;
 	strscpy(e->description, desc, sizeof(e->description));
-	hash_add(device_table, &e->node, e->dev_id);
+
+	if (use_rhashtable) {
+		/* May trigger a deferred resize; readers are never blocked */
+		if (rhashtable_lookup_insert_fast(&device_rht, &e->rnode,
+						  device_rht_params)) {
+			kfree(e);
+			return;
+		}
+	} else {
+		/* data_lock keeps the id from appearing between check and add */
+		rcu_read_lock();
+		dup = find_device(id) != NULL;
+		rcu_read_unlock();
+		if (dup) {
+			kfree(e);
+			return;
+		}
+		hash_add_rcu(device_table, &e->node, e->dev_id);
+	}
+
+	list_add_tail(&e->list, &device_list);
 	device_count++;
 }
 
-static struct device_entry *find_device(int id)
+static void clear_devices(void)
 {
-	struct device_entry *e;
-
-	hash_for_each_possible(device_table, e, node, id) {
-		if (e->dev_id == id)
-			return e;
+	struct device_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &device_list, list) {
+		if (use_rhashtable)
+			rhashtable_remove_fast(&device_rht, &e->rnode,
+					       device_rht_params);
+		else
+			hash_del_rcu(&e->node);
+		list_del(&e->list);
+		/* Lockless readers may still be looking at it */
+		kfree_rcu(e, rcu);
 	}
-	return NULL;
+	device_count = 0;
 }
 
-static void clear_devices(void)
+/* --- Benchmark --- */
+
+#define BENCH_MAX_ENTRIES   1000000
+#define BENCH_LIST_LOOKUPS  1000    /* Linear search; cap the cost */
+/* 64 chains of n / 64: as many steps as the list's lookups, at any n */
+#define BENCH_HASH_LOOKUPS  (64 * BENCH_LIST_LOOKUPS)
+
+struct bench_entry {
+	u32 key;
+	struct hlist_node hnode;
+	struct rhash_head rnode;
+	struct list_head list;
+};
+
+static const struct rhashtable_params bench_rht_params = {
+	.key_len = sizeof(u32),
+	.key_offset = offsetof(struct bench_entry, key),
+	.head_offset = offsetof(struct bench_entry, rnode),
+	.automatic_shrinking = true,
+};
+
+static DEFINE_HASHTABLE(bench_table, 6);  /* Same size as device_table */
+
+static void bench_report(const char *name, u64 insert_ns, unsigned int inserts,
+			 u64 lookup_ns, unsigned int lookups, unsigned int misses)
 {
-	struct device_entry *e;
-	struct hlist_node *tmp;
-	int bkt;
+	pr_info("data_structures_demo:   %-10s insert %6llu ns/op  lookup %8llu ns/op%s\n",
+		name, div_u64(insert_ns, inserts), div_u64(lookup_ns, lookups),
+		misses ? "  (MISSES)" : "");
+}
 
-	hash_for_each_safe(device_table, bkt, tmp, e, node) {
-		hash_del(&e->node);
-		kfree(e);
+/*
+ * Insert n keys, then look up random keys, in each structure. Each key
+ * sits at a hashed offset in its own 8-index window, so the xarray gets
+ * neither a dense best case nor one node per key: about 8 keys per
+ * 64-slot node, some 70 MB of nodes at BENCH_MAX_ENTRIES.
+ */
+static int run_bench(unsigned int n)
+{
+	struct bench_entry *entries, *e;
+	struct rhashtable rht;
+	struct xarray xa;
+	LIST_HEAD(list);
+	unsigned int i, misses, lookups;
+	u32 *keys;
+	u64 t0, t1, t2;
+	int ret = -ENOMEM;
+
+	entries = kvcalloc(n, sizeof(*entries), GFP_KERNEL);
+	keys = kvmalloc_array(n, sizeof(*keys), GFP_KERNEL);
+	if (!entries || !keys)
+		goto out;
+
+	for (i = 0; i < n; i++)
+		entries[i].key = i * 8 + hash_32(i, 3);  /* Distinct, < n * 8 */
+	for (i = 0; i < n; i++)
+		keys[i] = entries[get_random_u32_below(n)].key;
+
+	pr_info("data_structures_demo: bench %u entries\n", n);
+
+	/* Fixed 64-bucket hashtable: chains grow as n / 64 */
+	lookups = min_t(unsigned int, n, BENCH_HASH_LOOKUPS);
+	hash_init(bench_table);
+	t0 = ktime_get_ns();
+	for (i = 0; i < n; i++)
+		hash_add(bench_table, &entries[i].hnode, entries[i].key);
+	t1 = ktime_get_ns();
+	misses = 0;
+	for (i = 0; i < lookups; i++) {
+		bool found = false;
+
+		hash_for_each_possible(bench_table, e, hnode, keys[i]) {
+			if (e->key == keys[i]) {
+				found = true;
+				break;
+			}
+		}
+		misses += !found;
+		if (!(i & 1023))
+			cond_resched();
 	}
-	device_count = 0;
+	t2 = ktime_get_ns();
+	bench_report("hashtable", t1 - t0, n, t2 - t1, lookups, misses);
+
+	/* rhashtable: resizes to keep chains short */
+	ret = rhashtable_init(&rht, &bench_rht_params);
+	if (ret)
+		goto out;
+	t0 = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		ret = rhashtable_insert_fast(&rht, &entries[i].rnode,
+					     bench_rht_params);
+		if (ret)
+			break;
+		if (!(i & 1023))
+			cond_resched();
+	}
+	t1 = ktime_get_ns();
+	if (!ret) {
+		misses = 0;
+		rcu_read_lock();
+		for (i = 0; i < n; i++) {
+			misses += !rhashtable_lookup(&rht, &keys[i],
+						     bench_rht_params);
+			/* Short read sections, so resched and grace periods run */
+			if (!(i & 1023)) {
+				rcu_read_unlock();
+				cond_resched();
+				rcu_read_lock();
+			}
+		}
+		rcu_read_unlock();
+		t2 = ktime_get_ns();
+		bench_report("rhashtable", t1 - t0, n, t2 - t1, n, misses);
+		rcu_read_lock();
+		pr_info("data_structures_demo:   rhashtable grew to %u buckets\n",
+			rcu_dereference(rht.tbl)->size);
+		rcu_read_unlock();
+	}
+	/* Entries live in the array; nothing to free per element */
+	rhashtable_destroy(&rht);
+	if (ret)
+		goto out;
+
+	/* XArray: radix tree, no hashing */
+	xa_init(&xa);
+	t0 = ktime_get_ns();
+	for (i = 0; i < n; i++) {
+		ret = xa_err(xa_store(&xa, entries[i].key, &entries[i],
+				      GFP_KERNEL));
+		if (ret)
+			break;
+		if (!(i & 1023))
+			cond_resched();
+	}
+	t1 = ktime_get_ns();
+	if (!ret) {
+		misses = 0;
+		for (i = 0; i < n; i++) {
+			misses += !xa_load(&xa, keys[i]);
+			if (!(i & 1023))
+				cond_resched();
+		}
+		t2 = ktime_get_ns();
+		bench_report("xarray", t1 - t0, n, t2 - t1, n, misses);
+	}
+	xa_destroy(&xa);
+	if (ret)
+		goto out;
+
+	/* Linked list: O(n) per lookup */
+	lookups = min_t(unsigned int, n, BENCH_LIST_LOOKUPS);
+	t0 = ktime_get_ns();
+	for (i = 0; i < n; i++)
+		list_add_tail(&entries[i].list, &list);
+	t1 = ktime_get_ns();
+	misses = 0;
+	for (i = 0; i < lookups; i++) {
+		bool found = false;
+
+		list_for_each_entry(e, &list, list) {
+			if (e->key == keys[i]) {
+				found = true;
+				break;
+			}
+		}
+		misses += !found;
+		cond_resched();
+	}
+	t2 = ktime_get_ns();
+	bench_report("list", t1 - t0, n, t2 - t1, lookups, misses);
+
+out:
+	kvfree(keys);
+	kvfree(entries);
+	return ret;
 }
 
 /* --- Proc interface --- */
@@ -125,8 +376,11 @@ static int stats_show(struct seq_file *m, void *v)
 {
 	struct client *c;
 	struct device_entry *e;
+	unsigned int size;
 	int bkt;
 
+	mutex_lock(&data_lock);
+
 	seq_printf(m, "Data Structures Demo\n");
 	seq_printf(m, "====================\n\n");
 
@@ -137,13 +391,28 @@ static int stats_show(struct seq_file *m, void *v)
 	}
 
 	/* Show hash table contents */
-	seq_printf(m, "\nHash Table (%d devices):\n", device_count);
-	hash_for_each(device_table, bkt, e, node) {
-		seq_printf(m, "  [%d] %s (bucket %d)\n",
-			   e->dev_id, e->description, bkt);
+	if (use_rhashtable) {
+		/* The bucket table is replaced on resize */
+		rcu_read_lock();
+		size = rcu_dereference(device_rht.tbl)->size;
+		rcu_read_unlock();
+
+		seq_printf(m, "\nrhashtable (%d devices, %u buckets):\n",
+			   device_count, size);
+		list_for_each_entry(e, &device_list, list) {
+			seq_printf(m, "  [%d] %s\n", e->dev_id, e->description);
+		}
+	} else {
+		seq_printf(m, "\nHash Table (%d devices):\n", device_count);
+		hash_for_each(device_table, bkt, e, node) {
+			seq_printf(m, "  [%d] %s (bucket %d)\n",
+				   e->dev_id, e->description, bkt);
+		}
 	}
 
-	seq_printf(m, "\nCommands: populate, clear, find <id>\n");
+	seq_printf(m, "\nCommands: populate, clear, find <id>, remove <id>, bench <n>\n");
+
+	mutex_unlock(&data_lock);
 	return 0;
 }
 
@@ -166,6 +435,8 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 		cmd[len - 1] = '\0';
 
 	if (strcmp(cmd, "populate") == 0) {
+		mutex_lock(&data_lock);
+
 		/* Add sample data */
 		add_client(1, "uart0");
 		add_client(2, "spi1");
@@ -177,16 +448,21 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 		add_device(300, "display controller");
 		add_device(400, "audio codec");
 
+		mutex_unlock(&data_lock);
 		pr_info("data_structures_demo: populated sample data\n");
 	} else if (strcmp(cmd, "clear") == 0) {
+		mutex_lock(&data_lock);
 		clear_clients();
 		clear_devices();
+		mutex_unlock(&data_lock);
 		pr_info("data_structures_demo: cleared all data\n");
 	} else if (strncmp(cmd, "find ", 5) == 0) {
 		int id;
 		struct device_entry *e;
 
+		/* No mutex: lookups are lock-free */
 		if (kstrtoint(cmd + 5, 10, &id) == 0) {
+			rcu_read_lock();
 			e = find_device(id);
 			if (e)
 				pr_info("data_structures_demo: found device %d: %s\n",
@@ -194,7 +470,28 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 			else
 				pr_info("data_structures_demo: device %d not found\n",
 					id);
+			rcu_read_unlock();
 		}
+	} else if (strncmp(cmd, "remove ", 7) == 0) {
+		int id;
+
+		if (kstrtoint(cmd + 7, 10, &id) == 0) {
+			mutex_lock(&data_lock);
+			remove_client(id);
+			mutex_unlock(&data_lock);
+		}
+	} else if (strncmp(cmd, "bench ", 6) == 0) {
+		unsigned int n;
+		int ret;
+
+		if (kstrtouint(cmd + 6, 10, &n) || !n || n > BENCH_MAX_ENTRIES)
+			return -EINVAL;
+
+		mutex_lock(&data_lock);
+		ret = run_bench(n);
+		mutex_unlock(&data_lock);
+		if (ret)
+			return ret;
 	} else {
 		pr_warn("data_structures_demo: unknown command: %s\n", cmd);
 	}
@@ -214,27 +511,37 @@ static struct proc_dir_entry *proc_entry;
 
 static int __init data_structures_demo_init(void)
 {
+	int ret;
+
 	pr_info("data_structures_demo: initializing\n");
 
 	hash_init(device_table);
 
+	ret = rhashtable_init(&device_rht, &device_rht_params);
+	if (ret)
+		return ret;
+
 	proc_entry = proc_create("data_structures_demo", 0666, NULL,
 				 &stats_proc_ops);
-	if (!proc_entry)
+	if (!proc_entry) {
+		rhashtable_destroy(&device_rht);
 		return -ENOMEM;
+	}
 
-	pr_info("data_structures_demo: use /proc/data_structures_demo\n");
+	pr_info("data_structures_demo: use /proc/data_structures_demo (%s)\n",
+		use_rhashtable ? "rhashtable" : "fixed hashtable");
 	return 0;
 }
 
 static void __exit data_structures_demo_exit(void)
 {
-	clear_clients();
-	clear_devices();
-
 	if (proc_entry)
 		proc_remove(proc_entry);
 
+	clear_clients();
+	clear_devices();
+	rhashtable_destroy(&device_rht);
+
 	pr_info("data_structures_demo: exited\n");
 }
 
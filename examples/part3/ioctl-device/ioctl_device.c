@@ -7,6 +7,9 @@
  * - _IO, _IOR, _IOW, _IOWR macros
  * - Data transfer in IOCTL
  * - Command validation
+ * - Batching many commands into one syscall
+ * - Lock-free per-CPU counters published through a read-only mmap()
+ *   page with a sequence count
  */
 
 #include <linux/module.h>
@@ -15,12 +18,27 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/timekeeping.h>
 
 #include "ioctl_example.h"
 
 #define DEVICE_NAME "ioctl_example"
 #define CLASS_NAME  "ioctl"
 
+static unsigned int stats_interval_ms = 100;
+module_param(stats_interval_ms, uint, 0644);
+MODULE_PARM_DESC(stats_interval_ms, "Stats page refresh interval while mapped (default: 100)");
+
+struct ioctl_pcpu_stats {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long ioctls;
+};
+
 struct ioctl_device {
 	struct cdev cdev;
 	struct mutex lock;
@@ -31,11 +49,14 @@ struct ioctl_device {
 	char name[32];
 	int value;
 
-	/* Statistics */
-	unsigned long read_count;
-	unsigned long write_count;
-	unsigned long ioctl_count;
+	/* Statistics: per-CPU, so the data path never shares a cacheline */
+	struct ioctl_pcpu_stats __percpu *stats;
 	int last_error;
+
+	/* Shared stats page, refreshed by stats_work while mapped */
+	struct ioctl_stats_page *stats_page;
+	struct delayed_work stats_work;
+	atomic_t stats_mappers;
 };
 
 static struct ioctl_device ioctl_dev;
@@ -43,6 +64,60 @@ static dev_t dev_num;
 static struct class *ioctl_class;
 static struct device *ioctl_device;
 
+static void ioctl_sum_stats(struct ioctl_device *dev,
+			    struct ioctl_pcpu_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct ioctl_pcpu_stats *s = per_cpu_ptr(dev->stats, cpu);
+
+		sum->reads += READ_ONCE(s->reads);
+		sum->writes += READ_ONCE(s->writes);
+		sum->ioctls += READ_ONCE(s->ioctls);
+	}
+}
+
+static void ioctl_reset_stats(struct ioctl_device *dev)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(dev->stats, cpu), 0,
+		       sizeof(struct ioctl_pcpu_stats));
+	dev->last_error = 0;
+}
+
+/*
+ * Only this work item writes the stats page, so a bare sequence count
+ * is enough: odd while an update is in progress, user space retries.
+ */
+static void ioctl_stats_work(struct work_struct *work)
+{
+	struct ioctl_device *dev = container_of(to_delayed_work(work),
+						struct ioctl_device, stats_work);
+	struct ioctl_stats_page *page = dev->stats_page;
+	struct ioctl_pcpu_stats sum;
+
+	ioctl_sum_stats(dev, &sum);
+
+	WRITE_ONCE(page->seq, page->seq + 1);
+	smp_wmb();
+	page->reads = sum.reads;
+	page->writes = sum.writes;
+	page->ioctls = sum.ioctls;
+	page->last_error = READ_ONCE(dev->last_error);
+	page->updated_ns = ktime_get_ns();
+	smp_wmb();
+	WRITE_ONCE(page->seq, page->seq + 1);
+
+	/* Stop refreshing once the last mapping is gone */
+	if (atomic_read(&dev->stats_mappers))
+		schedule_delayed_work(&dev->stats_work,
+				      msecs_to_jiffies(stats_interval_ms));
+}
+
 static int ioctl_open(struct inode *inode, struct file *file)
 {
 	struct ioctl_device *dev;
@@ -65,9 +140,7 @@ static ssize_t ioctl_read(struct file *file, char __user *buf,
 {
 	struct ioctl_device *dev = file->private_data;
 
-	mutex_lock(&dev->lock);
-	dev->read_count++;
-	mutex_unlock(&dev->lock);
+	this_cpu_inc(dev->stats->reads);
 
 	/* Simple implementation - return device name */
 	if (*ppos > 0)
@@ -88,8 +161,9 @@ static ssize_t ioctl_write(struct file *file, const char __user *buf,
 {
 	struct ioctl_device *dev = file->private_data;
 
+	this_cpu_inc(dev->stats->writes);
+
 	mutex_lock(&dev->lock);
-	dev->write_count++;
 
 	if (count > sizeof(dev->name) - 1)
 		count = sizeof(dev->name) - 1;
@@ -106,14 +180,8 @@ static ssize_t ioctl_write(struct file *file, const char __user *buf,
 	return count;
 }
 
-static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+static int ioctl_check_cmd(unsigned int cmd)
 {
-	struct ioctl_device *dev = file->private_data;
-	struct ioctl_config config;
-	struct ioctl_stats stats;
-	int value;
-	int ret = 0;
-
 	/* Verify magic number */
 	if (_IOC_TYPE(cmd) != IOCTL_MAGIC) {
 		pr_warn("ioctl_example: invalid magic number\n");
@@ -126,27 +194,41 @@ static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return -ENOTTY;
 	}
 
-	mutex_lock(&dev->lock);
-	dev->ioctl_count++;
+	return 0;
+}
+
+/*
+ * Execute one command with dev->lock held. Shared by the plain ioctl
+ * path and IOCTL_BATCH. Per-command logging is pr_debug(): a control
+ * plane issuing thousands of ioctls per second must not flood the log.
+ */
+static int ioctl_do_cmd(struct ioctl_device *dev, unsigned int cmd,
+			unsigned long arg)
+{
+	struct ioctl_pcpu_stats sum;
+	struct ioctl_config config;
+	struct ioctl_stats stats;
+	int value;
+	int ret = 0;
+
+	this_cpu_inc(dev->stats->ioctls);
 
 	switch (cmd) {
 	case IOCTL_RESET:
-		pr_info("ioctl_example: RESET command\n");
+		pr_debug("ioctl_example: RESET command\n");
 		dev->speed = 0;
 		dev->mode = 0;
 		dev->value = 0;
 		memset(dev->name, 0, sizeof(dev->name));
-		dev->read_count = 0;
-		dev->write_count = 0;
-		dev->ioctl_count = 0;
-		dev->last_error = 0;
+		ioctl_reset_stats(dev);
 		break;
 
 	case IOCTL_GET_STATS:
-		pr_info("ioctl_example: GET_STATS command\n");
-		stats.reads = dev->read_count;
-		stats.writes = dev->write_count;
-		stats.ioctls = dev->ioctl_count;
+		pr_debug("ioctl_example: GET_STATS command\n");
+		ioctl_sum_stats(dev, &sum);
+		stats.reads = sum.reads;
+		stats.writes = sum.writes;
+		stats.ioctls = sum.ioctls;
 		stats.last_error = dev->last_error;
 
 		if (copy_to_user((void __user *)arg, &stats, sizeof(stats))) {
@@ -156,7 +238,7 @@ static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 
 	case IOCTL_GET_VALUE:
-		pr_info("ioctl_example: GET_VALUE command\n");
+		pr_debug("ioctl_example: GET_VALUE command\n");
 		if (put_user(dev->value, (int __user *)arg)) {
 			dev->last_error = -EFAULT;
 			ret = -EFAULT;
@@ -164,7 +246,7 @@ static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 
 	case IOCTL_SET_CONFIG:
-		pr_info("ioctl_example: SET_CONFIG command\n");
+		pr_debug("ioctl_example: SET_CONFIG command\n");
 		if (copy_from_user(&config, (void __user *)arg, sizeof(config))) {
 			dev->last_error = -EFAULT;
 			ret = -EFAULT;
@@ -190,12 +272,12 @@ static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		dev->mode = config.mode;
 		strscpy(dev->name, config.name, sizeof(dev->name));
 
-		pr_info("ioctl_example: config set: speed=%d, mode=%d, name=%s\n",
+		pr_debug("ioctl_example: config set: speed=%d, mode=%d, name=%s\n",
 			dev->speed, dev->mode, dev->name);
 		break;
 
 	case IOCTL_SET_VALUE:
-		pr_info("ioctl_example: SET_VALUE command\n");
+		pr_debug("ioctl_example: SET_VALUE command\n");
 		if (get_user(value, (int __user *)arg)) {
 			dev->last_error = -EFAULT;
 			ret = -EFAULT;
@@ -205,7 +287,7 @@ static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 
 	case IOCTL_XFER_CONFIG:
-		pr_info("ioctl_example: XFER_CONFIG command\n");
+		pr_debug("ioctl_example: XFER_CONFIG command\n");
 
 		/* Read input */
 		if (copy_from_user(&config, (void __user *)arg, sizeof(config))) {
@@ -232,10 +314,136 @@ static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		ret = -ENOTTY;
 	}
 
+	return ret;
+}
+
+/*
+ * Walk a user array of sub-commands under a single lock acquisition.
+ * Each entry gets its own result; by default the walk stops at the
+ * first failure so dependent config steps are not applied out of order.
+ */
+static int ioctl_do_batch(struct ioctl_device *dev, unsigned long arg)
+{
+	struct ioctl_batch __user *ubatch = (void __user *)arg;
+	struct ioctl_batch_cmd __user *ucmds;
+	struct ioctl_batch batch;
+	int ret = 0;
+	u32 i;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.count > IOCTL_BATCH_MAX || batch.reserved ||
+	    (batch.flags & ~IOCTL_BATCH_CONTINUE))
+		return -EINVAL;
+
+	ucmds = u64_to_user_ptr(batch.cmds);
+
+	mutex_lock(&dev->lock);
+
+	for (i = 0; i < batch.count; i++) {
+		struct ioctl_batch_cmd bc;
+		int result;
+
+		if (copy_from_user(&bc, &ucmds[i], sizeof(bc))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		/* No nesting: a batch inside a batch is rejected */
+		result = ioctl_check_cmd(bc.cmd);
+		if (!result && bc.cmd == IOCTL_BATCH)
+			result = -EINVAL;
+		if (!result)
+			result = ioctl_do_cmd(dev, bc.cmd, bc.arg);
+
+		if (put_user(result, &ucmds[i].result)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (result && !(batch.flags & IOCTL_BATCH_CONTINUE)) {
+			ret = result;
+			i++;
+			break;
+		}
+	}
+
+	mutex_unlock(&dev->lock);
+
+	/* done counts every entry executed, including a failing last one */
+	if (put_user(i, &ubatch->done))
+		return -EFAULT;
+
+	return ret;
+}
+
+static long ioctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct ioctl_device *dev = file->private_data;
+	int ret;
+
+	ret = ioctl_check_cmd(cmd);
+	if (ret)
+		return ret;
+
+	if (cmd == IOCTL_BATCH)
+		return ioctl_do_batch(dev, arg);
+
+	mutex_lock(&dev->lock);
+	ret = ioctl_do_cmd(dev, cmd, arg);
 	mutex_unlock(&dev->lock);
+
 	return ret;
 }
 
+static void ioctl_vma_open(struct vm_area_struct *vma)
+{
+	struct ioctl_device *dev = vma->vm_private_data;
+
+	atomic_inc(&dev->stats_mappers);
+}
+
+static void ioctl_vma_close(struct vm_area_struct *vma)
+{
+	struct ioctl_device *dev = vma->vm_private_data;
+
+	/* stats_work notices the count hit zero and stops rearming */
+	atomic_dec(&dev->stats_mappers);
+}
+
+static const struct vm_operations_struct ioctl_vm_ops = {
+	.open  = ioctl_vma_open,
+	.close = ioctl_vma_close,
+};
+
+/*
+ * Map the stats page read-only. Monitoring reads counters with plain
+ * loads instead of issuing IOCTL_GET_STATS.
+ */
+static int ioctl_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ioctl_device *dev = file->private_data;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	ret = remap_vmalloc_range(vma, dev->stats_page, vma->vm_pgoff);
+	if (ret)
+		return ret;
+
+	vma->vm_private_data = dev;
+	vma->vm_ops = &ioctl_vm_ops;
+
+	/* First mapping: publish right away, then every stats_interval_ms */
+	if (atomic_inc_return(&dev->stats_mappers) == 1)
+		mod_delayed_work(system_wq, &dev->stats_work, 0);
+
+	return 0;
+}
+
 static const struct file_operations ioctl_fops = {
 	.owner          = THIS_MODULE,
 	.open           = ioctl_open,
@@ -243,6 +451,7 @@ static const struct file_operations ioctl_fops = {
 	.read           = ioctl_read,
 	.write          = ioctl_write,
 	.unlocked_ioctl = ioctl_ioctl,
+	.mmap           = ioctl_mmap,
 };
 
 static int __init ioctl_init(void)
@@ -252,12 +461,25 @@ static int __init ioctl_init(void)
 	/* Initialize device structure */
 	mutex_init(&ioctl_dev.lock);
 	strscpy(ioctl_dev.name, "default", sizeof(ioctl_dev.name));
+	INIT_DELAYED_WORK(&ioctl_dev.stats_work, ioctl_stats_work);
+	atomic_set(&ioctl_dev.stats_mappers, 0);
+
+	ioctl_dev.stats = alloc_percpu(struct ioctl_pcpu_stats);
+	if (!ioctl_dev.stats)
+		return -ENOMEM;
+
+	/* vmalloc_user() gives a zeroed page that remap_vmalloc_range() accepts */
+	ioctl_dev.stats_page = vmalloc_user(PAGE_SIZE);
+	if (!ioctl_dev.stats_page) {
+		ret = -ENOMEM;
+		goto err_page;
+	}
 
 	/* Allocate device numbers */
 	ret = alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME);
 	if (ret < 0) {
 		pr_err("ioctl_example: failed to allocate device numbers\n");
-		return ret;
+		goto err_region;
 	}
 
 	/* Initialize cdev */
@@ -299,6 +521,10 @@ err_class:
 	cdev_del(&ioctl_dev.cdev);
 err_cdev:
 	unregister_chrdev_region(dev_num, 1);
+err_region:
+	vfree(ioctl_dev.stats_page);
+err_page:
+	free_percpu(ioctl_dev.stats);
 	return ret;
 }
 
@@ -309,6 +535,11 @@ static void __exit ioctl_exit(void)
 	cdev_del(&ioctl_dev.cdev);
 	unregister_chrdev_region(dev_num, 1);
 
+	/* Mappings pin the module, so nothing rearms the work any more */
+	cancel_delayed_work_sync(&ioctl_dev.stats_work);
+	vfree(ioctl_dev.stats_page);
+	free_percpu(ioctl_dev.stats);
+
 	pr_info("ioctl_example: unregistered\n");
 }
 
@@ -13,6 +13,7 @@
 #else
 #include <sys/ioctl.h>
 #endif
+#include <linux/types.h>
 
 /* Magic number for our driver */
 #define IOCTL_MAGIC 'E'
@@ -31,6 +32,45 @@ struct ioctl_stats {
 	int last_error;
 };
 
+/*
+ * IOCTL_BATCH: run many commands with one syscall. Each entry is any
+ * other IOCTL_* command plus the pointer it would normally take as arg.
+ */
+struct ioctl_batch_cmd {
+	__u32 cmd;
+	__s32 result;		/* Out: 0 or -errno for this entry */
+	__u64 arg;		/* User pointer, as for the single ioctl */
+};
+
+#define IOCTL_BATCH_MAX		256
+#define IOCTL_BATCH_CONTINUE	(1U << 0)	/* Don't stop at the first error */
+
+struct ioctl_batch {
+	__u64 cmds;		/* User pointer to struct ioctl_batch_cmd[] */
+	__u32 count;		/* Entries in cmds, at most IOCTL_BATCH_MAX */
+	__u32 flags;		/* IOCTL_BATCH_* */
+	__u32 done;		/* Out: entries executed */
+	__u32 reserved;		/* Must be zero */
+};
+
+/*
+ * Read-only statistics page, mmap()ed at offset 0. The driver refreshes
+ * it periodically; readers retry while seq is odd or changes under them:
+ *
+ *	do {
+ *		seq = load_acquire(&page->seq);
+ *		copy = *page;
+ *	} while ((seq & 1) || seq != load_acquire(&page->seq));
+ */
+struct ioctl_stats_page {
+	__u32 seq;
+	__s32 last_error;
+	__u64 reads;
+	__u64 writes;
+	__u64 ioctls;
+	__u64 updated_ns;	/* CLOCK_MONOTONIC time of the last refresh */
+};
+
 /* IOCTL command definitions */
 
 /* No data transfer */
@@ -46,8 +86,9 @@ struct ioctl_stats {
 
 /* Read and write */
 #define IOCTL_XFER_CONFIG   _IOWR(IOCTL_MAGIC, 5, struct ioctl_config)
+#define IOCTL_BATCH         _IOWR(IOCTL_MAGIC, 6, struct ioctl_batch)
 
 /* Maximum command number for validation */
-#define IOCTL_MAXNR 5
+#define IOCTL_MAXNR 6
 
 #endif /* IOCTL_EXAMPLE_H */
@@ -12,6 +12,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <stdint.h>
 #include <errno.h>
 
 #include "ioctl_example.h"
@@ -35,6 +37,19 @@ void print_config(struct ioctl_config *config)
 	printf("  Name:  %s\n", config->name);
 }
 
+/* Seqcount reader for the mmap()ed stats page, see ioctl_example.h */
+void read_stats_page(const struct ioctl_stats_page *page,
+		     struct ioctl_stats_page *copy)
+{
+	__u32 seq;
+
+	do {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		memcpy(copy, (const void *)page, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&page->seq, __ATOMIC_RELAXED));
+}
+
 int main(int argc, char *argv[])
 {
 	int fd;
@@ -42,6 +57,10 @@ int main(int argc, char *argv[])
 	int value;
 	struct ioctl_config config;
 	struct ioctl_stats stats;
+	struct ioctl_batch batch;
+	struct ioctl_batch_cmd cmds[3];
+	struct ioctl_stats_page *page, snap;
+	int i;
 
 	printf("IOCTL Example Test Program\n");
 	printf("==========================\n\n");
@@ -154,6 +173,48 @@ int main(int argc, char *argv[])
 	}
 	printf("\n");
 
+	/* Test 9: BATCH - three commands, one syscall */
+	printf("Test 9: BATCH command (SET_VALUE, GET_VALUE, GET_STATS)\n");
+	value = 7;
+	memset(cmds, 0, sizeof(cmds));
+	cmds[0].cmd = IOCTL_SET_VALUE;
+	cmds[0].arg = (uintptr_t)&value;
+	cmds[1].cmd = IOCTL_GET_VALUE;
+	cmds[1].arg = (uintptr_t)&value;
+	cmds[2].cmd = IOCTL_GET_STATS;
+	cmds[2].arg = (uintptr_t)&stats;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.cmds = (uintptr_t)cmds;
+	batch.count = 3;
+
+	ret = ioctl(fd, IOCTL_BATCH, &batch);
+	if (ret < 0) {
+		perror("IOCTL_BATCH failed");
+	} else {
+		printf("  Executed %u commands\n", batch.done);
+		for (i = 0; i < 3; i++)
+			printf("    [%d] result %d\n", i, cmds[i].result);
+		printf("  Value read back: %d\n", value);
+	}
+	printf("\n");
+
+	/* Test 10: Stats page via mmap - no syscall per read */
+	printf("Test 10: mmap() stats page\n");
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED) {
+		perror("mmap failed");
+	} else {
+		usleep(200000);	/* Let the driver publish at least once */
+		read_stats_page(page, &snap);
+		printf("  Reads: %llu  Writes: %llu  IOCTLs: %llu  Last error: %d\n",
+		       (unsigned long long)snap.reads,
+		       (unsigned long long)snap.writes,
+		       (unsigned long long)snap.ioctls, snap.last_error);
+		munmap(page, sizeof(*page));
+	}
+	printf("\n");
+
 	/* Final stats */
 	printf("Final Statistics:\n");
 	ret = ioctl(fd, IOCTL_GET_STATS, &stats);
@@ -6,7 +6,15 @@
  * - Character device registration with cdev
  * - File operations (open, release, read, write)
  * - Data transfer with copy_to_user/copy_from_user
+ * - Zero-copy access to the buffer with mmap
+ * - Streaming (pipe) mode on a kfifo with blocking I/O, poll and
+ *   read_iter/write_iter
  * - Automatic device node creation
+ *
+ * Usage:
+ *   insmod simple_char.ko                      # 4 KiB buffer
+ *   insmod simple_char.ko buffer_size=1048576  # 1 MiB, rounded to pages
+ *   insmod simple_char.ko fifo_mode=1          # Behave as a pipe
  */
 
 #include <linux/module.h>
@@ -15,16 +23,38 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
 
 #define DEVICE_NAME "simple_char"
 #define CLASS_NAME  "simple"
-#define BUFFER_SIZE 4096
+#define BUFFER_SIZE_MAX (64UL << 20)
+
+static unsigned long buffer_size = PAGE_SIZE;
+module_param(buffer_size, ulong, 0444);
+MODULE_PARM_DESC(buffer_size, "Device buffer size in bytes, rounded up to pages (default: 4096)");
+
+static bool fifo_mode;
+module_param(fifo_mode, bool, 0444);
+MODULE_PARM_DESC(fifo_mode, "Stream through a kfifo like a pipe instead of a seekable buffer (default: 0)");
 
 struct simple_device {
 	struct cdev cdev;
-	char buffer[BUFFER_SIZE];
-	size_t size;
+	char *buffer;		/* vmalloc_user(): zeroed, mappable pages */
+	size_t buffer_size;
+	size_t size;		/* Bytes of valid data for read() */
 	struct mutex lock;
+
+	/* fifo_mode only */
+	struct kfifo fifo;
+	struct mutex read_lock;	/* Serializes readers (kfifo consumer side) */
+	struct mutex write_lock; /* Serializes writers (kfifo producer side) */
+	wait_queue_head_t read_wq;
+	wait_queue_head_t write_wq;
 };
 
 static struct simple_device simple_dev;
@@ -81,7 +111,8 @@ static ssize_t schar_read(struct file *file, char __user *buf,
 
 	mutex_unlock(&dev->lock);
 
-	pr_info("simple_char: read %zu bytes\n", count);
+	/* Hot path: pr_debug() is a no-op unless enabled via dynamic debug */
+	pr_debug("simple_char: read %zu bytes\n", count);
 
 	return count;
 }
@@ -95,13 +126,13 @@ static ssize_t schar_write(struct file *file, const char __user *buf,
 	mutex_lock(&dev->lock);
 
 	/* Check for space */
-	if (*ppos >= BUFFER_SIZE) {
+	if (*ppos >= dev->buffer_size) {
 		mutex_unlock(&dev->lock);
 		return -ENOSPC;
 	}
 
 	/* Calculate available space */
-	space = BUFFER_SIZE - *ppos;
+	space = dev->buffer_size - *ppos;
 	if (count > space)
 		count = space;
 
@@ -118,11 +149,38 @@ static ssize_t schar_write(struct file *file, const char __user *buf,
 
 	mutex_unlock(&dev->lock);
 
-	pr_info("simple_char: wrote %zu bytes\n", count);
+	pr_debug("simple_char: wrote %zu bytes\n", count);
 
 	return count;
 }
 
+/*
+ * Map the device buffer straight into the caller's address space, so
+ * producer and consumer can share data with no syscall or copy at all.
+ * remap_vmalloc_range() checks that the mapping fits inside the buffer.
+ */
+static int schar_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct simple_device *dev = file->private_data;
+	int ret;
+
+	ret = remap_vmalloc_range(vma, dev->buffer, vma->vm_pgoff);
+	if (ret)
+		return ret;
+
+	/*
+	 * Stores through a shared writable mapping bypass write(), so treat
+	 * the whole buffer as valid data from now on for read().
+	 */
+	if ((vma->vm_flags & (VM_SHARED | VM_WRITE)) == (VM_SHARED | VM_WRITE)) {
+		mutex_lock(&dev->lock);
+		dev->size = dev->buffer_size;
+		mutex_unlock(&dev->lock);
+	}
+
+	return 0;
+}
+
 static loff_t simple_llseek(struct file *file, loff_t offset, int whence)
 {
 	struct simple_device *dev = file->private_data;
@@ -164,25 +222,223 @@ static const struct file_operations simple_fops = {
 	.read    = schar_read,
 	.write   = schar_write,
 	.llseek  = simple_llseek,
+	.mmap    = schar_mmap,
+};
+
+/*
+ * Streaming mode: the device is a pipe. Data written is consumed by the
+ * next read, readers sleep while the fifo is empty and writers sleep
+ * while it is full.
+ *
+ * kfifo is safe with one concurrent producer and one consumer, so a
+ * reader and a writer never contend; read_lock and write_lock only
+ * serialize multiple readers or multiple writers among themselves.
+ */
+static int schar_fifo_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	ret = schar_open(inode, file);
+	if (ret)
+		return ret;
+
+	/* No file position, like a pipe; IOCB_NOWAIT is honoured below */
+	ret = stream_open(inode, file);
+	file->f_mode |= FMODE_NOWAIT;
+
+	return ret;
+}
+
+static bool schar_fifo_nowait(struct kiocb *iocb)
+{
+	return (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+	       (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+/*
+ * Take @lock once @cond holds, sleeping on @wq until it does. Returns 0
+ * with @lock held, or -EAGAIN/-ERESTARTSYS without it. Nonblocking
+ * callers never sleep, not even on the mutex.
+ */
+#define schar_fifo_wait_lock(iocb, lock, wq, cond)			\
+({									\
+	int __ret = 0;							\
+									\
+	for (;;) {							\
+		if (schar_fifo_nowait(iocb)) {				\
+			if (!mutex_trylock(lock)) {			\
+				__ret = -EAGAIN;			\
+				break;					\
+			}						\
+		} else if (mutex_lock_interruptible(lock)) {		\
+			__ret = -ERESTARTSYS;				\
+			break;						\
+		}							\
+		if (cond)						\
+			break;						\
+		mutex_unlock(lock);					\
+		if (schar_fifo_nowait(iocb)) {				\
+			__ret = -EAGAIN;				\
+			break;						\
+		}							\
+		if (wait_event_interruptible(wq, cond)) {		\
+			__ret = -ERESTARTSYS;				\
+			break;						\
+		}							\
+	}								\
+	__ret;								\
+})
+
+/*
+ * readv()/writev() and io_uring hand over many segments in one call;
+ * move each one straight between the fifo and user memory.
+ * kfifo_to_user()/kfifo_from_user() deal with the wrap-around.
+ */
+static ssize_t schar_fifo_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct simple_device *dev = iocb->ki_filp->private_data;
+	size_t total = 0;
+	int ret;
+
+	if (!user_backed_iter(to))
+		return -EINVAL;
+	if (!iov_iter_count(to))
+		return 0;
+
+	ret = schar_fifo_wait_lock(iocb, &dev->read_lock, dev->read_wq,
+				   !kfifo_is_empty(&dev->fifo));
+	if (ret)
+		return ret;
+
+	while (iov_iter_count(to) && !kfifo_is_empty(&dev->fifo)) {
+		struct iovec iov = iov_iter_iovec(to);
+		unsigned int copied;
+
+		ret = kfifo_to_user(&dev->fifo, iov.iov_base,
+				    min_t(size_t, iov.iov_len, UINT_MAX),
+				    &copied);
+		iov_iter_advance(to, copied);
+		total += copied;
+		if (ret)
+			break;
+	}
+
+	mutex_unlock(&dev->read_lock);
+
+	if (total)
+		wake_up_interruptible(&dev->write_wq);
+
+	pr_debug("simple_char: fifo read %zu bytes\n", total);
+
+	return total ? total : ret;
+}
+
+static ssize_t schar_fifo_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct simple_device *dev = iocb->ki_filp->private_data;
+	size_t total = 0;
+	int ret;
+
+	if (!user_backed_iter(from))
+		return -EINVAL;
+	if (!iov_iter_count(from))
+		return 0;
+
+	ret = schar_fifo_wait_lock(iocb, &dev->write_lock, dev->write_wq,
+				   !kfifo_is_full(&dev->fifo));
+	if (ret)
+		return ret;
+
+	/* Like a pipe, a write that only partly fits returns short */
+	while (iov_iter_count(from) && !kfifo_is_full(&dev->fifo)) {
+		struct iovec iov = iov_iter_iovec(from);
+		unsigned int copied;
+
+		ret = kfifo_from_user(&dev->fifo, iov.iov_base,
+				      min_t(size_t, iov.iov_len, UINT_MAX),
+				      &copied);
+		iov_iter_advance(from, copied);
+		total += copied;
+		if (ret)
+			break;
+	}
+
+	mutex_unlock(&dev->write_lock);
+
+	if (total)
+		wake_up_interruptible(&dev->read_wq);
+
+	pr_debug("simple_char: fifo wrote %zu bytes\n", total);
+
+	return total ? total : ret;
+}
+
+static __poll_t schar_fifo_poll(struct file *file, poll_table *wait)
+{
+	struct simple_device *dev = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &dev->read_wq, wait);
+	poll_wait(file, &dev->write_wq, wait);
+
+	if (!kfifo_is_empty(&dev->fifo))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (!kfifo_is_full(&dev->fifo))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static const struct file_operations simple_fifo_fops = {
+	.owner      = THIS_MODULE,
+	.open       = schar_fifo_open,
+	.release    = schar_release,
+	.read_iter  = schar_fifo_read_iter,
+	.write_iter = schar_fifo_write_iter,
+	.poll       = schar_fifo_poll,
+	.llseek     = no_llseek,
 };
 
 static int __init simple_init(void)
 {
 	int ret;
 
+	if (!buffer_size || buffer_size > BUFFER_SIZE_MAX) {
+		pr_err("simple_char: buffer_size must be 1..%lu\n",
+		       BUFFER_SIZE_MAX);
+		return -EINVAL;
+	}
+
 	/* Initialize device structure */
 	mutex_init(&simple_dev.lock);
+	mutex_init(&simple_dev.read_lock);
+	mutex_init(&simple_dev.write_lock);
+	init_waitqueue_head(&simple_dev.read_wq);
+	init_waitqueue_head(&simple_dev.write_wq);
 	simple_dev.size = 0;
+	simple_dev.buffer_size = PAGE_ALIGN(buffer_size);
+	if (fifo_mode) {
+		/* kfifo_alloc() rounds the size up to a power of two */
+		ret = kfifo_alloc(&simple_dev.fifo, simple_dev.buffer_size,
+				  GFP_KERNEL);
+		if (ret)
+			return ret;
+		simple_dev.buffer_size = kfifo_size(&simple_dev.fifo);
+	} else {
+		simple_dev.buffer = vmalloc_user(simple_dev.buffer_size);
+		if (!simple_dev.buffer)
+			return -ENOMEM;
+	}
 
 	/* Allocate device numbers */
 	ret = alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME);
 	if (ret < 0) {
 		pr_err("simple_char: failed to allocate device numbers\n");
-		return ret;
+		goto err_region;
 	}
 
 	/* Initialize cdev */
-	cdev_init(&simple_dev.cdev, &simple_fops);
+	cdev_init(&simple_dev.cdev, fifo_mode ? &simple_fifo_fops : &simple_fops);
 	simple_dev.cdev.owner = THIS_MODULE;
 
 	/* Add cdev to system */
@@ -209,8 +465,9 @@ static int __init simple_init(void)
 		goto err_device;
 	}
 
-	pr_info("simple_char: registered with major=%d, minor=%d\n",
-		MAJOR(dev_num), MINOR(dev_num));
+	pr_info("simple_char: registered with major=%d, minor=%d, %s=%zu bytes\n",
+		MAJOR(dev_num), MINOR(dev_num), fifo_mode ? "fifo" : "buffer",
+		simple_dev.buffer_size);
 
 	return 0;
 
@@ -220,6 +477,9 @@ err_class:
 	cdev_del(&simple_dev.cdev);
 err_cdev:
 	unregister_chrdev_region(dev_num, 1);
+err_region:
+	vfree(simple_dev.buffer);
+	kfifo_free(&simple_dev.fifo);
 	return ret;
 }
 
@@ -229,6 +489,8 @@ static void __exit simple_exit(void)
 	class_destroy(simple_class);
 	cdev_del(&simple_dev.cdev);
 	unregister_chrdev_region(dev_num, 1);
+	vfree(simple_dev.buffer);
+	kfifo_free(&simple_dev.fifo);
 
 	pr_info("simple_char: unregistered\n");
 }
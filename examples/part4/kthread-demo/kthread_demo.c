@@ -7,6 +7,7 @@
  * - kthread_should_stop() cooperative shutdown
  * - Wait queues for event-driven sleeping
  * - Periodic polling with timeout
+ * - Hybrid busy-poll/sleep thread with an adaptive poll budget
  */
 
 #include <linux/module.h>
@@ -14,10 +15,16 @@
 #include <linux/delay.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
 
 /* Thread data */
 static struct task_struct *poll_thread;
 static struct task_struct *event_thread;
+static struct task_struct *hybrid_thread;
 
 /* Shared state */
 static DECLARE_WAIT_QUEUE_HEAD(event_wq);
@@ -26,6 +33,68 @@ static atomic_t event_count = ATOMIC_INIT(0);
 static bool event_pending;
 static int simulated_sensor = 25;  /* "temperature" */
 
+/*
+ * Hybrid polling
+ *
+ * An hrtimer plays a sensor that raises events at a configurable rate,
+ * optionally in bursts. The hybrid thread consumes them in one of
+ * three modes:
+ *
+ *   sleep  - always wait on hybrid_wq, like event_thread_fn()
+ *   busy   - never sleep, spin on the event fifo
+ *   hybrid - after each event keep spinning for poll_budget, then
+ *            sleep; the budget follows the observed inter-arrival
+ *            time (NAPI-style: poll while busy, sleep when idle)
+ *
+ * The producer only issues a wakeup when the thread is actually
+ * sleeping, so events that arrive inside the poll window cost no
+ * wakeup at all.
+ */
+#define HYBRID_FIFO_SIZE 64
+#define HYBRID_MIN_RATE_US 5
+#define HYBRID_MAX_BUDGET_US 10000
+#define HYBRID_EWMA_SHIFT 3		/* 1/8 weight for new samples */
+
+enum hybrid_mode {
+	HYBRID_SLEEP,
+	HYBRID_BUSY,
+	HYBRID_ADAPTIVE,
+	NR_HYBRID_MODES,
+};
+
+static const char * const hybrid_mode_names[NR_HYBRID_MODES] = {
+	[HYBRID_SLEEP] = "sleep",
+	[HYBRID_BUSY] = "busy",
+	[HYBRID_ADAPTIVE] = "hybrid",
+};
+
+struct hybrid_stats {
+	u64 events;
+	u64 lat_sum;
+	u64 lat_max;
+	u64 wakeups;		/* Events that had to wake the thread */
+	u64 busy_ns;		/* Time awake: processing plus spinning */
+	u64 wall_ns;		/* Time spent in this mode */
+};
+
+static DECLARE_WAIT_QUEUE_HEAD(hybrid_wq);
+static DECLARE_KFIFO(hybrid_fifo, u64, HYBRID_FIFO_SIZE);	/* Timestamps */
+static struct hrtimer hybrid_timer;
+static atomic_t hybrid_overruns = ATOMIC_INIT(0);
+
+/* Configuration, written from proc */
+static int hybrid_mode = HYBRID_ADAPTIVE;
+static unsigned int hybrid_rate_us;		/* 0 = generator off */
+static unsigned int hybrid_burst_len;		/* 0 = steady rate */
+static unsigned int hybrid_gap_ms;
+static unsigned int hybrid_max_budget_us = 50;
+
+/* Statistics and adaptive state, under hybrid_lock */
+static DEFINE_SPINLOCK(hybrid_lock);
+static struct hybrid_stats hybrid_stats[NR_HYBRID_MODES];
+static u64 hybrid_ia_ewma_ns;			/* Mean inter-arrival time */
+static u64 hybrid_budget_ns;			/* Current poll budget */
+
 /*
  * Periodic polling thread
  * Reads a simulated sensor every second
@@ -84,6 +153,205 @@ static int event_thread_fn(void *data)
 	return 0;
 }
 
+/* Simulated sensor: one event per tick, optionally in bursts */
+static enum hrtimer_restart hybrid_timer_fn(struct hrtimer *timer)
+{
+	static unsigned int in_burst;
+	unsigned int rate = READ_ONCE(hybrid_rate_us);
+	unsigned int burst = READ_ONCE(hybrid_burst_len);
+	u64 next = (u64)rate * NSEC_PER_USEC;
+
+	if (!rate)
+		return HRTIMER_NORESTART;
+
+	/* Single producer: the fifo needs no lock */
+	if (!kfifo_put(&hybrid_fifo, ktime_get_ns()))
+		atomic_inc(&hybrid_overruns);
+
+	/* Orders the put against the sleeper check (pairs with prepare_to_wait) */
+	if (wq_has_sleeper(&hybrid_wq))
+		wake_up(&hybrid_wq);
+
+	if (burst && ++in_burst >= burst) {
+		in_burst = 0;
+		next = (u64)READ_ONCE(hybrid_gap_ms) * NSEC_PER_MSEC;
+	}
+
+	hrtimer_forward_now(timer, ns_to_ktime(next));
+	return HRTIMER_RESTART;
+}
+
+/* Charge [*since, now) to @mode, as awake time if @awake */
+static void hybrid_account(int mode, u64 *since, u64 now, bool awake)
+{
+	struct hybrid_stats *st = &hybrid_stats[mode];
+
+	spin_lock(&hybrid_lock);
+	st->wall_ns += now - *since;
+	if (awake)
+		st->busy_ns += now - *since;
+	spin_unlock(&hybrid_lock);
+	*since = now;
+}
+
+/* Drain the fifo; returns the number of events handled */
+static unsigned int hybrid_consume(int mode, u64 *prev_ts, bool woken)
+{
+	struct hybrid_stats *st = &hybrid_stats[mode];
+	unsigned int n = 0;
+	u64 ts, now, lat, ia;
+
+	while (kfifo_get(&hybrid_fifo, &ts)) {
+		now = ktime_get_ns();
+		lat = now - ts;
+
+		spin_lock(&hybrid_lock);
+		st->events++;
+		st->lat_sum += lat;
+		st->lat_max = max(st->lat_max, lat);
+		if (woken && !n)
+			st->wakeups++;
+
+		/*
+		 * Spin only when the next event is expected within the
+		 * configured maximum: twice the mean gap leaves headroom
+		 * for jitter. Longer gaps aren't worth the CPU, so sleep.
+		 */
+		if (*prev_ts && ts > *prev_ts) {
+			ia = ts - *prev_ts;
+			hybrid_ia_ewma_ns += ((s64)ia - (s64)hybrid_ia_ewma_ns) >>
+					     HYBRID_EWMA_SHIFT;
+			if (hybrid_ia_ewma_ns <=
+			    (u64)READ_ONCE(hybrid_max_budget_us) * NSEC_PER_USEC)
+				hybrid_budget_ns = 2 * hybrid_ia_ewma_ns;
+			else
+				hybrid_budget_ns = 0;
+		}
+		spin_unlock(&hybrid_lock);
+
+		*prev_ts = ts;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Hybrid polling thread
+ * Consumes simulated sensor events in the configured mode
+ */
+static int hybrid_thread_fn(void *data)
+{
+	u64 since = ktime_get_ns(), last_event = 0, prev_ts = 0, now, budget;
+	unsigned int spins = 0;
+	int mode = READ_ONCE(hybrid_mode);
+	bool woken = false;
+
+	pr_info("kthread_demo: hybrid thread started\n");
+
+	while (!kthread_should_stop()) {
+		int cur = READ_ONCE(hybrid_mode);
+
+		if (cur != mode) {
+			/* Close the old mode's accounting */
+			hybrid_account(mode, &since, ktime_get_ns(), true);
+			mode = cur;
+		}
+
+		if (hybrid_consume(mode, &prev_ts, woken)) {
+			last_event = ktime_get_ns();
+			woken = false;
+			continue;
+		}
+		woken = false;
+
+		/* Only this thread writes the budget */
+		now = ktime_get_ns();
+		budget = READ_ONCE(hybrid_budget_ns);
+
+		if (mode == HYBRID_BUSY ||
+		    (mode == HYBRID_ADAPTIVE && now - last_event < budget)) {
+			cpu_relax();
+			if (!(++spins & 1023)) {
+				hybrid_account(mode, &since, now, true);
+				cond_resched();
+			}
+			continue;
+		}
+
+		/* Idle: charge the awake stretch and sleep until an event */
+		hybrid_account(mode, &since, now, true);
+		wait_event_interruptible(hybrid_wq,
+					 !kfifo_is_empty(&hybrid_fifo) ||
+					 READ_ONCE(hybrid_mode) != mode ||
+					 kthread_should_stop());
+		hybrid_account(mode, &since, ktime_get_ns(), false);
+		woken = true;
+	}
+
+	pr_info("kthread_demo: hybrid thread stopping\n");
+	return 0;
+}
+
+static void hybrid_set_rate(unsigned int rate_us, unsigned int burst_len,
+			    unsigned int gap_ms)
+{
+	hrtimer_cancel(&hybrid_timer);
+
+	WRITE_ONCE(hybrid_rate_us, rate_us);
+	WRITE_ONCE(hybrid_burst_len, burst_len);
+	WRITE_ONCE(hybrid_gap_ms, gap_ms);
+
+	if (rate_us)
+		hrtimer_start(&hybrid_timer, ns_to_ktime((u64)rate_us * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+}
+
+static void hybrid_show(struct seq_file *m)
+{
+	struct hybrid_stats stats[NR_HYBRID_MODES];
+	u64 ewma, budget;
+	int mode;
+
+	spin_lock(&hybrid_lock);
+	memcpy(stats, hybrid_stats, sizeof(stats));
+	ewma = hybrid_ia_ewma_ns;
+	budget = hybrid_budget_ns;
+	spin_unlock(&hybrid_lock);
+
+	seq_printf(m, "\nHybrid thread:\n");
+	seq_printf(m, "  Mode:            %s\n",
+		   hybrid_mode_names[READ_ONCE(hybrid_mode)]);
+	if (hybrid_rate_us && hybrid_burst_len)
+		seq_printf(m, "  Sensor rate:     %u us, bursts of %u every %u ms\n",
+			   hybrid_rate_us, hybrid_burst_len, hybrid_gap_ms);
+	else if (hybrid_rate_us)
+		seq_printf(m, "  Sensor rate:     %u us\n", hybrid_rate_us);
+	else
+		seq_printf(m, "  Sensor rate:     off\n");
+	seq_printf(m, "  Max poll budget: %u us\n", hybrid_max_budget_us);
+	seq_printf(m, "  Inter-arrival:   %llu us (EWMA)\n",
+		   div_u64(ewma, NSEC_PER_USEC));
+	seq_printf(m, "  Poll budget:     %llu us\n",
+		   div_u64(budget, NSEC_PER_USEC));
+	seq_printf(m, "  FIFO overruns:   %d\n", atomic_read(&hybrid_overruns));
+
+	seq_printf(m, "  %-7s %10s %10s %10s %10s %6s\n", "mode", "events",
+		   "avg lat ns", "max lat ns", "wakeups", "cpu %");
+	for (mode = 0; mode < NR_HYBRID_MODES; mode++) {
+		struct hybrid_stats *st = &stats[mode];
+
+		if (!st->wall_ns)
+			continue;
+
+		seq_printf(m, "  %-7s %10llu %10llu %10llu %10llu %6llu\n",
+			   hybrid_mode_names[mode], st->events,
+			   st->events ? div64_u64(st->lat_sum, st->events) : 0,
+			   st->lat_max, st->wakeups,
+			   div64_u64(st->busy_ns * 100, st->wall_ns));
+	}
+}
+
 /* Trigger an event (simulates external stimulus) */
 static void trigger_event(void)
 {
@@ -104,7 +372,13 @@ static int stats_show(struct seq_file *m, void *v)
 	seq_printf(m, "  Events handled:  %d\n", atomic_read(&event_count));
 	seq_printf(m, "  Event pending:   %s\n",
 		   event_pending ? "yes" : "no");
-	seq_printf(m, "\nCommands: event\n");
+	hybrid_show(m);
+	seq_printf(m, "\nCommands:\n");
+	seq_printf(m, "  event                       - Wake the event thread\n");
+	seq_printf(m, "  mode <sleep|busy|hybrid>    - Hybrid thread mode\n");
+	seq_printf(m, "  rate <us> [<burst> <gap_ms>] - Sensor event rate, 0 = off\n");
+	seq_printf(m, "  budget <us>                 - Max adaptive poll budget\n");
+	seq_printf(m, "  reset                       - Clear hybrid statistics\n");
 	return 0;
 }
 
@@ -116,8 +390,10 @@ static int stats_open(struct inode *inode, struct file *file)
 static ssize_t stats_write(struct file *file, const char __user *buf,
 			   size_t count, loff_t *ppos)
 {
-	char cmd[32];
+	char cmd[48], arg[16];
+	unsigned int rate, burst = 0, gap = 0;
 	size_t len = min(count, sizeof(cmd) - 1);
+	int mode;
 
 	if (copy_from_user(cmd, buf, len))
 		return -EFAULT;
@@ -126,10 +402,32 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 	if (len > 0 && cmd[len - 1] == '\n')
 		cmd[len - 1] = '\0';
 
-	if (strcmp(cmd, "event") == 0)
+	if (strcmp(cmd, "event") == 0) {
 		trigger_event();
-	else
+	} else if (sscanf(cmd, "mode %15s", arg) == 1) {
+		mode = match_string(hybrid_mode_names, NR_HYBRID_MODES, arg);
+		if (mode < 0)
+			return -EINVAL;
+		WRITE_ONCE(hybrid_mode, mode);
+		wake_up(&hybrid_wq);
+	} else if (sscanf(cmd, "rate %u %u %u", &rate, &burst, &gap) >= 1) {
+		if (rate && rate < HYBRID_MIN_RATE_US)
+			return -EINVAL;
+		if (burst && !gap)
+			return -EINVAL;
+		hybrid_set_rate(rate, burst, gap);
+	} else if (sscanf(cmd, "budget %u", &rate) == 1) {
+		if (rate > HYBRID_MAX_BUDGET_US)
+			return -EINVAL;
+		WRITE_ONCE(hybrid_max_budget_us, rate);
+	} else if (strcmp(cmd, "reset") == 0) {
+		spin_lock(&hybrid_lock);
+		memset(hybrid_stats, 0, sizeof(hybrid_stats));
+		spin_unlock(&hybrid_lock);
+		atomic_set(&hybrid_overruns, 0);
+	} else {
 		pr_warn("kthread_demo: unknown command: %s\n", cmd);
+	}
 
 	return count;
 }
@@ -148,6 +446,10 @@ static int __init kthread_demo_init(void)
 {
 	pr_info("kthread_demo: initializing\n");
 
+	INIT_KFIFO(hybrid_fifo);
+	hrtimer_init(&hybrid_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hybrid_timer.function = hybrid_timer_fn;
+
 	/* Create proc entry first */
 	proc_entry = proc_create("kthread_demo", 0666, NULL, &stats_proc_ops);
 	if (!proc_entry) {
@@ -172,6 +474,16 @@ static int __init kthread_demo_init(void)
 		return PTR_ERR(event_thread);
 	}
 
+	/* Start hybrid polling thread; the sensor stays off until "rate" */
+	hybrid_thread = kthread_run(hybrid_thread_fn, NULL, "kdemo_hybrid");
+	if (IS_ERR(hybrid_thread)) {
+		kthread_stop(event_thread);
+		kthread_stop(poll_thread);
+		proc_remove(proc_entry);
+		pr_err("kthread_demo: failed to create hybrid thread\n");
+		return PTR_ERR(hybrid_thread);
+	}
+
 	pr_info("kthread_demo: initialized - use /proc/kthread_demo\n");
 	return 0;
 }
@@ -180,13 +492,18 @@ static void __exit kthread_demo_exit(void)
 {
 	pr_info("kthread_demo: exiting\n");
 
+	/* No more commands, so nothing can restart the sensor */
+	if (proc_entry)
+		proc_remove(proc_entry);
+
+	/* Stop the sensor first so nothing wakes a stopping thread */
+	hrtimer_cancel(&hybrid_timer);
+
 	/* Stop threads (blocks until each thread exits) */
+	kthread_stop(hybrid_thread);
 	kthread_stop(event_thread);
 	kthread_stop(poll_thread);
 
-	if (proc_entry)
-		proc_remove(proc_entry);
-
 	pr_info("kthread_demo: exited\n");
 }
 
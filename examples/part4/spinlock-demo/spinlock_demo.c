@@ -7,6 +7,8 @@
  * - spin_lock_irqsave for interrupt-safe locking
  * - Reader-writer spinlocks
  * - Per-CPU data as an alternative
+ * - Contention benchmark: spinlock, rwlock, seqlock, RCU, atomic, per-CPU
+ * - False sharing: packed vs cache-line-aligned vs sharded counters
  */
 
 #include <linux/module.h>
@@ -17,9 +19,27 @@
 #include <linux/seq_file.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/perf_event.h>
 
 #define NUM_THREADS 4
 
+static bool demo_threads = true;
+module_param(demo_threads, bool, 0444);
+MODULE_PARM_DESC(demo_threads, "Run the background demo threads (disable for clean benchmarks)");
+
+/* Benchmark limits */
+#define BENCH_PAYLOAD_WORDS 16
+#define BENCH_MAX_CS 1024
+#define BENCH_DEF_DURATION_MS 1000
+#define BENCH_MAX_DURATION_MS 60000
+
 /* Basic spinlock protected data */
 struct basic_counter {
 	spinlock_t lock;
@@ -87,7 +107,7 @@ static int reader_thread(void *data)
 		read_lock(&rwdata.lock);
 		local_value = rwdata.value;
 		strscpy(local_name, rwdata.name, sizeof(local_name));
-		rwdata.reads++;  /* Technically should be atomic, demo only */
+		rwdata.reads++;  /* Shared write under a read lock: see "bench layout" */
 		read_unlock(&rwdata.lock);
 
 		/* Simulate using the data */
@@ -144,6 +164,614 @@ static int percpu_thread(void *data)
 	return 0;
 }
 
+/*
+ * Contention benchmark
+ *
+ * Threads pinned to the chosen CPUs run a tight loop, each iteration
+ * one read or one write of a shared payload. The critical section
+ * touches cs_len payload words; write_pct of the iterations are
+ * writes. Nothing sleeps between iterations, so every primitive sees
+ * real contention. Atomic and per-CPU ops are single-word by nature
+ * and ignore cs_len.
+ */
+enum bench_prim {
+	PRIM_SPINLOCK,
+	PRIM_RWLOCK,
+	PRIM_SEQLOCK,
+	PRIM_RCU,
+	PRIM_ATOMIC,
+	PRIM_PERCPU,
+	NR_LOCK_PRIMS,
+
+	/* rw_data workload with three memory layouts */
+	PRIM_PACKED = NR_LOCK_PRIMS,
+	PRIM_ALIGNED,
+	PRIM_SHARDED,
+	NR_PRIMS,
+};
+
+static const char * const prim_names[NR_PRIMS] = {
+	[PRIM_SPINLOCK] = "spinlock",
+	[PRIM_RWLOCK] = "rwlock",
+	[PRIM_SEQLOCK] = "seqlock",
+	[PRIM_RCU] = "rcu",
+	[PRIM_ATOMIC] = "atomic",
+	[PRIM_PERCPU] = "percpu",
+	[PRIM_PACKED] = "packed",
+	[PRIM_ALIGNED] = "aligned",
+	[PRIM_SHARDED] = "sharded",
+};
+
+struct bench_payload {
+	unsigned long words[BENCH_PAYLOAD_WORDS];
+	struct rcu_head rcu;
+};
+
+/* State all benchmark threads hammer */
+static struct {
+	spinlock_t spin;
+	rwlock_t rw;
+	seqlock_t seq;
+	spinlock_t rcu_update;		/* Serializes RCU updaters */
+	struct bench_payload __rcu *rcu_data;
+	struct bench_payload data;	/* For the lock-based primitives */
+	atomic_long_t atomic;
+} bench_shared = {
+	.spin = __SPIN_LOCK_UNLOCKED(bench_shared.spin),
+	.rw = __RW_LOCK_UNLOCKED(bench_shared.rw),
+	.seq = __SEQLOCK_UNLOCKED(bench_shared.seq),
+	.rcu_update = __SPIN_LOCK_UNLOCKED(bench_shared.rcu_update),
+	.atomic = ATOMIC_LONG_INIT(0),
+};
+
+static DEFINE_PER_CPU(unsigned long, bench_pcpu);
+
+/*
+ * The rw_data pattern: readers take the read lock and bump a shared
+ * counter. In the packed layout the lock, the data and both counters
+ * share a cache line, so every reader's increment steals the line the
+ * other readers need for the lock and the data.
+ */
+struct layout_packed {
+	rwlock_t lock;
+	int value;
+	char name[32];
+	atomic_long_t reads;
+	unsigned long writes;
+};
+
+/* Same fields, but lock, read-mostly data and hot counter each get a line */
+struct layout_aligned {
+	rwlock_t lock ____cacheline_aligned_in_smp;
+	unsigned long writes;		/* Only written under the write lock */
+	int value ____cacheline_aligned_in_smp;
+	char name[32];
+	atomic_long_t reads ____cacheline_aligned_in_smp;
+};
+
+/* One read counter per reader, folded when someone asks for the total */
+struct layout_shard {
+	unsigned long reads;
+} ____cacheline_aligned_in_smp;
+
+static struct layout_packed layout_packed = {
+	.lock = __RW_LOCK_UNLOCKED(layout_packed.lock),
+};
+
+/* Used by both the aligned and the sharded runs */
+static struct layout_aligned layout_aligned = {
+	.lock = __RW_LOCK_UNLOCKED(layout_aligned.lock),
+};
+
+struct bench_ctx {
+	enum bench_prim prim;
+	unsigned int cs_len;
+	unsigned int write_pct;
+	struct layout_shard *shards;	/* PRIM_SHARDED, one per thread */
+	struct completion start;
+	bool stop;
+};
+
+struct bench_thread {
+	struct bench_ctx *ctx;
+	unsigned int id;
+	u64 reads;
+	u64 writes;
+	u64 retries;		/* seqlock read retries */
+	u64 misses;		/* Cache misses of this thread during the run */
+	bool misses_valid;
+	u64 ns;
+	unsigned long sink;	/* Keeps read results alive */
+	int err;
+	struct completion done;
+};
+
+struct bench_result {
+	bool valid;
+	unsigned int threads;
+	u64 reads;
+	u64 writes;
+	u64 retries;
+	u64 ops_per_sec;
+	u64 ns_per_op;		/* Thread time per op */
+	u64 min_ops;
+	u64 max_ops;
+	u64 misses;
+	bool misses_valid;
+	u64 counted;		/* Layout runs: read counter after the run */
+};
+
+/* Configuration and results, under bench_lock */
+static DEFINE_MUTEX(bench_lock);
+/* One benchmark at a time; not held by readers of the results */
+static DEFINE_MUTEX(bench_run_lock);
+static cpumask_var_t bench_cpus;
+static unsigned int bench_nr_threads;	/* 0 = one per chosen CPU */
+static unsigned int bench_duration_ms = BENCH_DEF_DURATION_MS;
+static unsigned int bench_cs_len = 4;
+static unsigned int bench_write_pct = 10;
+static struct bench_result bench_results[NR_PRIMS];
+
+#ifdef CONFIG_PERF_EVENTS
+static struct perf_event_attr bench_miss_attr = {
+	.type = PERF_TYPE_HARDWARE,
+	.config = PERF_COUNT_HW_CACHE_MISSES,
+	.size = sizeof(struct perf_event_attr),
+	.pinned = 1,
+};
+
+/*
+ * Counter for the calling thread only, wherever it runs. A CPU-wide
+ * counter per thread would count each CPU once for every thread on it.
+ * NULL when the PMU doesn't provide the event.
+ */
+static struct perf_event *bench_miss_start(void)
+{
+	struct perf_event *event;
+
+	event = perf_event_create_kernel_counter(&bench_miss_attr, -1,
+						 current, NULL, NULL);
+	return IS_ERR(event) ? NULL : event;
+}
+
+static u64 bench_miss_stop(struct perf_event *event)
+{
+	u64 enabled, running, count;
+
+	count = perf_event_read_value(event, &enabled, &running);
+	perf_event_release_kernel(event);
+	return count;
+}
+#else
+static struct perf_event *bench_miss_start(void)
+{
+	return NULL;
+}
+
+static u64 bench_miss_stop(struct perf_event *event)
+{
+	return 0;
+}
+#endif
+
+static inline u32 bench_rand(u32 *state)
+{
+	u32 x = *state;
+
+	/* xorshift32: cheap enough not to show up next to the lock */
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static inline unsigned long cs_read(const unsigned long *words,
+				    unsigned int len)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		sum += READ_ONCE(words[i % BENCH_PAYLOAD_WORDS]);
+	return sum;
+}
+
+static inline void cs_write(unsigned long *words, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		WRITE_ONCE(words[i % BENCH_PAYLOAD_WORDS],
+			   words[i % BENCH_PAYLOAD_WORDS] + 1);
+}
+
+static int bench_rcu_update(unsigned int len)
+{
+	struct bench_payload *new, *old;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	/* Copy, update, publish; readers keep the old copy until done */
+	spin_lock(&bench_shared.rcu_update);
+	old = rcu_dereference_protected(bench_shared.rcu_data,
+			lockdep_is_held(&bench_shared.rcu_update));
+	memcpy(new->words, old->words, sizeof(new->words));
+	cs_write(new->words, len);
+	rcu_assign_pointer(bench_shared.rcu_data, new);
+	spin_unlock(&bench_shared.rcu_update);
+
+	kfree_rcu(old, rcu);
+	return 0;
+}
+
+/*
+ * One rw_data iteration. Exactly one of @reads and @shard_reads is
+ * set; it decides whether readers share a counter or own one.
+ */
+static __always_inline unsigned long
+layout_op(rwlock_t *lock, int *value, char *name, unsigned long *writes,
+	  atomic_long_t *reads, unsigned long *shard_reads, bool write)
+{
+	unsigned long val;
+
+	if (write) {
+		write_lock(lock);
+		(*value)++;
+		snprintf(name, 32, "update_%d", *value);
+		(*writes)++;
+		write_unlock(lock);
+		return 0;
+	}
+
+	read_lock(lock);
+	val = READ_ONCE(*value) + READ_ONCE(name[7]);
+	if (reads)
+		atomic_long_inc(reads);
+	else
+		WRITE_ONCE(*shard_reads, *shard_reads + 1);
+	read_unlock(lock);
+
+	return val;
+}
+
+/* One iteration; returns the read result or a negative errno for RCU */
+static long bench_op(struct bench_ctx *ctx, unsigned int id, bool write,
+		     u64 *retries)
+{
+	unsigned long *words = bench_shared.data.words;
+	unsigned long val = 0;
+	unsigned int seq;
+	int cpu;
+
+	switch (ctx->prim) {
+	case PRIM_SPINLOCK:
+		spin_lock(&bench_shared.spin);
+		if (write)
+			cs_write(words, ctx->cs_len);
+		else
+			val = cs_read(words, ctx->cs_len);
+		spin_unlock(&bench_shared.spin);
+		break;
+	case PRIM_RWLOCK:
+		if (write) {
+			write_lock(&bench_shared.rw);
+			cs_write(words, ctx->cs_len);
+			write_unlock(&bench_shared.rw);
+		} else {
+			read_lock(&bench_shared.rw);
+			val = cs_read(words, ctx->cs_len);
+			read_unlock(&bench_shared.rw);
+		}
+		break;
+	case PRIM_SEQLOCK:
+		if (write) {
+			write_seqlock(&bench_shared.seq);
+			cs_write(words, ctx->cs_len);
+			write_sequnlock(&bench_shared.seq);
+			break;
+		}
+		for (;;) {
+			seq = read_seqbegin(&bench_shared.seq);
+			val = cs_read(words, ctx->cs_len);
+			if (!read_seqretry(&bench_shared.seq, seq))
+				break;
+			(*retries)++;
+		}
+		break;
+	case PRIM_RCU:
+		if (write)
+			return bench_rcu_update(ctx->cs_len);
+		rcu_read_lock();
+		val = cs_read(rcu_dereference(bench_shared.rcu_data)->words,
+			      ctx->cs_len);
+		rcu_read_unlock();
+		break;
+	case PRIM_ATOMIC:
+		if (write)
+			atomic_long_inc(&bench_shared.atomic);
+		else
+			val = atomic_long_read(&bench_shared.atomic);
+		break;
+	case PRIM_PERCPU:
+		/* Cheap update, expensive fold */
+		if (write) {
+			this_cpu_inc(bench_pcpu);
+		} else {
+			for_each_possible_cpu(cpu)
+				val += per_cpu(bench_pcpu, cpu);
+		}
+		break;
+	case PRIM_PACKED:
+		val = layout_op(&layout_packed.lock, &layout_packed.value,
+				layout_packed.name, &layout_packed.writes,
+				&layout_packed.reads, NULL, write);
+		break;
+	case PRIM_ALIGNED:
+		val = layout_op(&layout_aligned.lock, &layout_aligned.value,
+				layout_aligned.name, &layout_aligned.writes,
+				&layout_aligned.reads, NULL, write);
+		break;
+	case PRIM_SHARDED:
+		val = layout_op(&layout_aligned.lock, &layout_aligned.value,
+				layout_aligned.name, &layout_aligned.writes,
+				NULL, &ctx->shards[id].reads, write);
+		break;
+	default:
+		break;
+	}
+
+	return val & LONG_MAX;
+}
+
+static int bench_thread_fn(void *arg)
+{
+	struct bench_thread *bt = arg;
+	struct bench_ctx *ctx = bt->ctx;
+	u64 reads = 0, writes = 0, retries = 0, start;
+	u32 rnd = 2463534242U + bt->id;
+	struct perf_event *misses;
+	unsigned long sink = 0;
+	long val;
+
+	wait_for_completion(&ctx->start);
+
+	misses = bench_miss_start();
+	start = ktime_get_ns();
+
+	/* Counters stay in registers so the loop itself doesn't share lines */
+	while (!READ_ONCE(ctx->stop)) {
+		bool write = bench_rand(&rnd) % 100 < ctx->write_pct;
+
+		val = bench_op(ctx, bt->id, write, &retries);
+		if (val < 0) {
+			bt->err = val;
+			break;
+		}
+		sink += val;
+
+		if (write)
+			writes++;
+		else
+			reads++;
+
+		if (!((reads + writes) & 1023))
+			cond_resched();
+	}
+
+	bt->ns = ktime_get_ns() - start;
+	if (misses) {
+		bt->misses = bench_miss_stop(misses);
+		bt->misses_valid = true;
+	}
+	bt->reads = reads;
+	bt->writes = writes;
+	bt->retries = retries;
+	bt->sink = sink;
+
+	kthread_complete_and_exit(&bt->done, 0);
+}
+
+/*
+ * Called with bench_run_lock held. The configuration is copied under
+ * bench_lock, which is then dropped for the run so reading the results
+ * and changing the settings don't wait for it.
+ */
+static int bench_run(enum bench_prim prim)
+{
+	struct bench_result result = {}, *res = &result;
+	struct bench_ctx ctx = { .prim = prim };
+	unsigned int nr, i, started = 0, cpu, duration_ms;
+	struct bench_thread *threads;
+	cpumask_var_t cpus;
+	int ret = 0;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	mutex_lock(&bench_lock);
+	cpumask_copy(cpus, bench_cpus);
+	nr = bench_nr_threads ?: cpumask_weight(cpus);
+	duration_ms = bench_duration_ms;
+	ctx.cs_len = bench_cs_len;
+	ctx.write_pct = bench_write_pct;
+	mutex_unlock(&bench_lock);
+
+	threads = kcalloc(nr, sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		free_cpumask_var(cpus);
+		return -ENOMEM;
+	}
+
+	if (prim == PRIM_SHARDED) {
+		ctx.shards = kcalloc(nr, sizeof(*ctx.shards), GFP_KERNEL);
+		if (!ctx.shards) {
+			kfree(threads);
+			free_cpumask_var(cpus);
+			return -ENOMEM;
+		}
+	}
+
+	/* Layout runs count from zero so the folded total can be checked */
+	atomic_long_set(&layout_packed.reads, 0);
+	atomic_long_set(&layout_aligned.reads, 0);
+
+	init_completion(&ctx.start);
+
+	/* Spread threads round-robin over the chosen CPUs */
+	cpu = cpumask_first(cpus);
+	for (i = 0; i < nr; i++) {
+		struct bench_thread *bt = &threads[i];
+		struct task_struct *task;
+
+		bt->ctx = &ctx;
+		bt->id = i;
+		init_completion(&bt->done);
+
+		task = kthread_create(bench_thread_fn, bt, "lock_bench/%u", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			break;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		started++;
+
+		cpu = cpumask_next(cpu, cpus);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpus);
+	}
+	free_cpumask_var(cpus);
+
+	complete_all(&ctx.start);
+	if (!ret)
+		msleep(duration_ms);
+	WRITE_ONCE(ctx.stop, true);
+
+	res->min_ops = U64_MAX;
+	res->misses_valid = started > 0;
+	for (i = 0; i < started; i++) {
+		struct bench_thread *bt = &threads[i];
+		u64 ops;
+
+		wait_for_completion(&bt->done);
+		if (bt->err && !ret)
+			ret = bt->err;
+
+		ops = bt->reads + bt->writes;
+		res->reads += bt->reads;
+		res->writes += bt->writes;
+		res->retries += bt->retries;
+		res->min_ops = min(res->min_ops, ops);
+		res->max_ops = max(res->max_ops, ops);
+		res->misses += bt->misses;
+		res->misses_valid &= bt->misses_valid;
+		if (bt->ns) {
+			res->ops_per_sec += mul_u64_u64_div_u64(ops, NSEC_PER_SEC, bt->ns);
+			res->ns_per_op += bt->ns;
+		}
+	}
+	kfree(threads);
+
+	if (prim == PRIM_PACKED)
+		res->counted = atomic_long_read(&layout_packed.reads);
+	else if (prim == PRIM_ALIGNED)
+		res->counted = atomic_long_read(&layout_aligned.reads);
+	for (i = 0; ctx.shards && i < nr; i++)
+		res->counted += ctx.shards[i].reads;	/* Fold on read */
+	kfree(ctx.shards);
+
+	if (!ret) {
+		res->threads = started;
+		res->ns_per_op = div64_u64(res->ns_per_op,
+					   max_t(u64, res->reads + res->writes, 1));
+		res->valid = true;
+	}
+
+	mutex_lock(&bench_lock);
+	bench_results[prim] = result;
+	mutex_unlock(&bench_lock);
+
+	if (ret)
+		return ret;
+
+	pr_info("spinlock_demo: %s: %llu ops/s on %u threads\n",
+		prim_names[prim], res->ops_per_sec, started);
+	return 0;
+}
+
+/* Throughput of each layout relative to packed, in tenths of a percent */
+static void bench_show_layout(struct seq_file *m)
+{
+	struct bench_result *base = &bench_results[PRIM_PACKED];
+	enum bench_prim prim;
+
+	if (!base->valid || !base->ops_per_sec)
+		return;
+
+	seq_printf(m, "\nLayout comparison (vs packed, %llu ops/s):\n",
+		   base->ops_per_sec);
+	for (prim = PRIM_PACKED; prim < NR_PRIMS; prim++) {
+		struct bench_result *res = &bench_results[prim];
+		int delta;
+
+		if (!res->valid)
+			continue;
+
+		delta = div64_s64(((s64)res->ops_per_sec - (s64)base->ops_per_sec) * 1000,
+				  base->ops_per_sec);
+		seq_printf(m, "  %-8s %c%4d.%d%%  reads counted %llu of %llu\n",
+			   prim_names[prim], delta < 0 ? '-' : '+',
+			   abs(delta) / 10, abs(delta) % 10,
+			   res->counted, res->reads);
+	}
+}
+
+static void bench_show(struct seq_file *m)
+{
+	enum bench_prim prim;
+
+	mutex_lock(&bench_lock);
+
+	seq_printf(m, "\nBenchmark config:\n");
+	seq_printf(m, "  CPUs: %*pbl\n", cpumask_pr_args(bench_cpus));
+	seq_printf(m, "  Threads: %u\n",
+		   bench_nr_threads ?: cpumask_weight(bench_cpus));
+	seq_printf(m, "  Duration: %u ms\n", bench_duration_ms);
+	seq_printf(m, "  Critical section: %u words\n", bench_cs_len);
+	seq_printf(m, "  Writes: %u%%\n", bench_write_pct);
+
+	seq_printf(m, "\nBenchmark results:\n");
+	seq_printf(m, "  %-9s %7s %10s %7s %12s %12s %5s %10s %9s\n",
+		   "primitive", "threads", "ops/s", "ns/op", "reads", "writes",
+		   "fair", "retries", "miss/kop");
+	for (prim = 0; prim < NR_PRIMS; prim++) {
+		struct bench_result *res = &bench_results[prim];
+		u64 ops = res->reads + res->writes;
+
+		if (prim == NR_LOCK_PRIMS)
+			seq_printf(m, "  (rw_data layouts)\n");
+
+		if (!res->valid)
+			continue;
+
+		seq_printf(m, "  %-9s %7u %10llu %7llu %12llu %12llu %4llu%% %10llu",
+			   prim_names[prim], res->threads, res->ops_per_sec,
+			   res->ns_per_op, res->reads, res->writes,
+			   res->max_ops ? div64_u64(res->min_ops * 100, res->max_ops) : 0,
+			   res->retries);
+		if (res->misses_valid && ops)
+			seq_printf(m, " %9llu\n", div64_u64(res->misses * 1000, ops));
+		else
+			seq_printf(m, " %9s\n", "n/a");
+	}
+
+	bench_show_layout(m);
+
+	mutex_unlock(&bench_lock);
+}
+
 /* Proc file to show stats */
 static int stats_show(struct seq_file *m, void *v)
 {
@@ -170,6 +798,18 @@ static int stats_show(struct seq_file *m, void *v)
 	}
 	seq_printf(m, "  Total: %lu\n", total_percpu);
 
+	bench_show(m);
+
+	seq_printf(m, "\nCommands:\n");
+	seq_printf(m, "  bench <primitive|all> - Run the contention benchmark\n");
+	seq_printf(m, "  bench layout          - Packed vs aligned vs sharded rw_data\n");
+	seq_printf(m, "  cpus <list>           - Pin threads to these CPUs (e.g. 0-3,8)\n");
+	seq_printf(m, "  threads <n>           - Thread count, 0 = one per CPU\n");
+	seq_printf(m, "  duration <ms>         - Run time per primitive\n");
+	seq_printf(m, "  cs <words>            - Critical-section length (0-%d)\n",
+		   BENCH_MAX_CS);
+	seq_printf(m, "  writes <pct>          - Share of iterations that write\n");
+
 	return 0;
 }
 
@@ -178,9 +818,104 @@ static int stats_open(struct inode *inode, struct file *file)
 	return single_open(file, stats_show, NULL);
 }
 
+static int bench_command(const char *name)
+{
+	int prim, first, last, ret;
+
+	if (!strcmp(name, "all")) {
+		first = 0;
+		last = NR_LOCK_PRIMS;
+	} else if (!strcmp(name, "layout")) {
+		first = NR_LOCK_PRIMS;
+		last = NR_PRIMS;
+	} else {
+		first = match_string(prim_names, NR_PRIMS, name);
+		if (first < 0)
+			return -EINVAL;
+		last = first + 1;
+	}
+
+	for (prim = first; prim < last; prim++) {
+		ret = bench_run(prim);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static ssize_t stats_write(struct file *file, const char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	char cmd[64], arg[32];
+	unsigned int val;
+	int ret = 0;
+	size_t len = min(count, sizeof(cmd) - 1);
+
+	if (copy_from_user(cmd, buf, len))
+		return -EFAULT;
+	cmd[len] = '\0';
+
+	if (len > 0 && cmd[len - 1] == '\n')
+		cmd[len - 1] = '\0';
+
+	if (sscanf(cmd, "bench %31s", arg) == 1) {
+		/* Runs synchronously; the write returns when it's done */
+		mutex_lock(&bench_run_lock);
+		ret = bench_command(arg);
+		mutex_unlock(&bench_run_lock);
+		return ret ? ret : count;
+	}
+
+	mutex_lock(&bench_lock);
+	if (sscanf(cmd, "cpus %31s", arg) == 1) {
+		cpumask_var_t mask;
+
+		if (!zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+			ret = -ENOMEM;
+		} else {
+			ret = cpulist_parse(arg, mask);
+			if (!ret && !cpumask_subset(mask, cpu_online_mask))
+				ret = -EINVAL;
+			if (!ret && cpumask_empty(mask))
+				ret = -EINVAL;
+			if (!ret)
+				cpumask_copy(bench_cpus, mask);
+			free_cpumask_var(mask);
+		}
+	} else if (sscanf(cmd, "threads %u", &val) == 1) {
+		if (val > 4 * num_online_cpus())
+			ret = -EINVAL;
+		else
+			bench_nr_threads = val;
+	} else if (sscanf(cmd, "duration %u", &val) == 1) {
+		if (!val || val > BENCH_MAX_DURATION_MS)
+			ret = -EINVAL;
+		else
+			bench_duration_ms = val;
+	} else if (sscanf(cmd, "cs %u", &val) == 1) {
+		if (val > BENCH_MAX_CS)
+			ret = -EINVAL;
+		else
+			bench_cs_len = val;
+	} else if (sscanf(cmd, "writes %u", &val) == 1) {
+		if (val > 100)
+			ret = -EINVAL;
+		else
+			bench_write_pct = val;
+	} else {
+		pr_warn("spinlock_demo: unknown command: %s\n", cmd);
+		ret = -EINVAL;
+	}
+	mutex_unlock(&bench_lock);
+
+	return ret ? ret : count;
+}
+
 static const struct proc_ops stats_proc_ops = {
 	.proc_open = stats_open,
 	.proc_read = seq_read,
+	.proc_write = stats_write,
 	.proc_lseek = seq_lseek,
 	.proc_release = single_release,
 };
@@ -189,17 +924,34 @@ static struct proc_dir_entry *proc_entry;
 
 static int __init spinlock_demo_init(void)
 {
+	struct bench_payload *payload;
 	int i;
 
 	pr_info("spinlock_demo: initializing\n");
 
+	if (!zalloc_cpumask_var(&bench_cpus, GFP_KERNEL))
+		return -ENOMEM;
+	cpumask_copy(bench_cpus, cpu_online_mask);
+
+	payload = kzalloc(sizeof(*payload), GFP_KERNEL);
+	if (!payload) {
+		free_cpumask_var(bench_cpus);
+		return -ENOMEM;
+	}
+	RCU_INIT_POINTER(bench_shared.rcu_data, payload);
+
 	/* Create proc entry */
-	proc_entry = proc_create("spinlock_demo", 0444, NULL, &stats_proc_ops);
+	proc_entry = proc_create("spinlock_demo", 0644, NULL, &stats_proc_ops);
 	if (!proc_entry) {
 		pr_err("spinlock_demo: failed to create proc entry\n");
+		kfree(payload);
+		free_cpumask_var(bench_cpus);
 		return -ENOMEM;
 	}
 
+	if (!demo_threads)
+		goto out;
+
 	/* Create threads */
 	stop_threads = false;
 
@@ -220,6 +972,7 @@ static int __init spinlock_demo_init(void)
 		}
 	}
 
+out:
 	pr_info("spinlock_demo: initialized, check /proc/spinlock_demo\n");
 	return 0;
 }
@@ -237,10 +990,14 @@ static void __exit spinlock_demo_exit(void)
 			kthread_stop(threads[i]);
 	}
 
-	/* Remove proc entry */
+	/* Remove proc entry; waits for a running benchmark write */
 	if (proc_entry)
 		proc_remove(proc_entry);
 
+	/* Old RCU payloads went to kfree_rcu(); no readers remain now */
+	kfree(rcu_dereference_protected(bench_shared.rcu_data, 1));
+	free_cpumask_var(bench_cpus);
+
 	/* Print final stats */
 	pr_info("spinlock_demo: final basic count: %lu\n", basic.count);
 	pr_info("spinlock_demo: final rw writes: %lu\n", rwdata.writes);
@@ -7,6 +7,7 @@
  * - hrtimer for precise timing
  * - Jiffies and time conversions
  * - Proper timer cleanup
+ * - Expiry jitter: hard vs soft hrtimers, slack, timer_list, sleeping thread
  */
 
 #include <linux/module.h>
@@ -16,6 +17,11 @@
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/jiffies.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
 
 /* Statistics */
 static atomic_t timer_fire_count = ATOMIC_INIT(0);
@@ -44,6 +50,428 @@ static void poll_timer_callback(struct timer_list *t)
 			  jiffies + msecs_to_jiffies(poll_interval_ms));
 }
 
+/*
+ * Jitter measurement
+ *
+ * A periodic source runs at jit_period_us and every firing records
+ * actual minus expected expiry. Sources:
+ *
+ *   hard   - hrtimer in hardirq context (HRTIMER_MODE_ABS_HARD)
+ *   soft   - hrtimer in softirq context (HRTIMER_MODE_ABS_SOFT)
+ *   timer  - timer_list re-armed for the same nominal schedule
+ *   thread - kthread sleeping in schedule_hrtimeout_range(), so the
+ *            scheduler wakeup is included: what an acquisition loop
+ *            actually sees
+ *
+ * hrtimer sources are armed with hrtimer_start_range_ns() and
+ * jit_slack_us of slack, which lets the kernel batch the expiry with
+ * other timers. Expected expiry is the soft (earliest) expiry.
+ */
+enum jit_mode {
+	JIT_HARD,
+	JIT_SOFT,
+	JIT_TIMER,
+	JIT_THREAD,
+	NR_JIT_MODES,
+};
+
+static const char * const jit_mode_names[NR_JIT_MODES] = {
+	[JIT_HARD] = "hard",
+	[JIT_SOFT] = "soft",
+	[JIT_TIMER] = "timer",
+	[JIT_THREAD] = "thread",
+};
+
+#define JIT_MIN_PERIOD_US 10
+#define JIT_MAX_PERIOD_US 1000000
+
+/*
+ * Jitter histogram. Timer error ranges from tens of ns on an idle
+ * hrtimer to whole jiffies for timer_list, so bucket widths grow with
+ * the value: exact below LAT_SUB ns, then LAT_SUB linear steps per
+ * power of two, each value within 1/LAT_SUB (12.5%).
+ *
+ * This is deliberately the same code as threaded_irq_demo.c (part7),
+ * so timer jitter and IRQ wakeup latency read on the same scale.
+ * Each module stays self-contained; change both together.
+ */
+#define LAT_SUB_BITS	3
+#define LAT_SUB		(1U << LAT_SUB_BITS)
+#define LAT_BUCKETS	((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct lat_hist {
+	u64 buckets[LAT_BUCKETS];
+	u64 count;
+	u64 sum_ns;
+	u64 min_ns;
+	u64 max_ns;
+};
+
+struct lat_summary {
+	u64 count;
+	u64 min_ns;
+	u64 max_ns;
+	u64 mean_ns;
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 p999_ns;
+};
+
+struct jit_result {
+	struct lat_hist hist;		/* |actual - expected| */
+	u64 early;			/* Fired before the expected time */
+	u64 missed;			/* Whole periods skipped */
+	unsigned int period_us;
+	unsigned int slack_us;
+};
+
+/* Results are written from hardirq, softirq and thread context */
+static DEFINE_RAW_SPINLOCK(jit_lock);
+static struct jit_result jit_results[NR_JIT_MODES];
+
+/* Configuration and the active run, under jit_mutex */
+static DEFINE_MUTEX(jit_mutex);
+static unsigned int jit_period_us = 1000;
+static unsigned int jit_slack_us;
+static int jit_active = -1;		/* Mode being measured, -1 = none */
+
+static struct hrtimer jit_hrtimer;
+static struct timer_list jit_timer;
+static struct task_struct *jit_thread;
+static u64 jit_period_ns;		/* Copy for the running source */
+static u64 jit_slack_ns;
+static u64 jit_timer_expected;		/* Next nominal timer_list expiry */
+static bool jit_stopping;
+
+static unsigned int lat_bucket(u64 ns)
+{
+	unsigned int msb;
+
+	if (ns < LAT_SUB)
+		return ns;
+
+	msb = fls64(ns) - 1;
+	return (msb - LAT_SUB_BITS + 1) * LAT_SUB +
+	       ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* Smallest value that lands in bucket @b */
+static u64 lat_bucket_min(unsigned int b)
+{
+	unsigned int shift;
+
+	if (b < LAT_SUB)
+		return b;
+
+	shift = b / LAT_SUB - 1;
+	return (u64)(LAT_SUB + b % LAT_SUB) << shift;
+}
+
+/* Largest value that lands in bucket @b */
+static u64 lat_bucket_max(unsigned int b)
+{
+	return b + 1 < LAT_BUCKETS ? lat_bucket_min(b + 1) - 1 : U64_MAX;
+}
+
+static void lat_hist_reset(struct lat_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min_ns = U64_MAX;
+}
+
+static void lat_hist_record(struct lat_hist *h, u64 ns)
+{
+	h->buckets[lat_bucket(ns)]++;
+	h->count++;
+	h->sum_ns += ns;
+	h->min_ns = min(h->min_ns, ns);
+	h->max_ns = max(h->max_ns, ns);
+}
+
+/* Jitter that @per_10k / 10000 of the firings stayed within */
+static u64 lat_hist_percentile(const struct lat_hist *h, unsigned int per_10k)
+{
+	u64 target = DIV_ROUND_UP_ULL(h->count * per_10k, 10000);
+	u64 seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen >= target)
+			return min(lat_bucket_max(b), h->max_ns);
+	}
+
+	return h->max_ns;
+}
+
+static void lat_hist_summarize(const struct lat_hist *h,
+			       struct lat_summary *sum)
+{
+	memset(sum, 0, sizeof(*sum));
+	if (!h->count)
+		return;
+
+	sum->count = h->count;
+	sum->min_ns = h->min_ns;
+	sum->max_ns = h->max_ns;
+	sum->mean_ns = div64_u64(h->sum_ns, h->count);
+	sum->p50_ns = lat_hist_percentile(h, 5000);
+	sum->p99_ns = lat_hist_percentile(h, 9900);
+	sum->p999_ns = lat_hist_percentile(h, 9990);
+}
+
+static void jit_record(enum jit_mode mode, u64 expected, u64 actual)
+{
+	struct jit_result *r = &jit_results[mode];
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&jit_lock, flags);
+	if (actual < expected) {
+		r->early++;
+		lat_hist_record(&r->hist, expected - actual);
+	} else {
+		lat_hist_record(&r->hist, actual - expected);
+	}
+	raw_spin_unlock_irqrestore(&jit_lock, flags);
+}
+
+static void jit_record_missed(enum jit_mode mode, u64 missed)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&jit_lock, flags);
+	jit_results[mode].missed += missed;
+	raw_spin_unlock_irqrestore(&jit_lock, flags);
+}
+
+/* hard and soft: the expected time is the soft expiry we programmed */
+static enum hrtimer_restart jit_hrtimer_fn(struct hrtimer *timer)
+{
+	u64 now = ktime_get_ns();
+	u64 expected = ktime_to_ns(hrtimer_get_softexpires(timer));
+	u64 overruns;
+
+	jit_record(jit_active, expected, now);
+
+	if (READ_ONCE(jit_stopping))
+		return HRTIMER_NORESTART;
+
+	/* Keeps the slack: both soft and hard expiry move together */
+	overruns = hrtimer_forward_now(timer, ns_to_ktime(jit_period_ns));
+	if (overruns > 1)
+		jit_record_missed(jit_active, overruns - 1);
+	return HRTIMER_RESTART;
+}
+
+static void jit_timer_fn(struct timer_list *t)
+{
+	u64 now = ktime_get_ns();
+	u64 missed = 0;
+
+	jit_record(JIT_TIMER, jit_timer_expected, now);
+
+	if (READ_ONCE(jit_stopping))
+		return;
+
+	/* Same nominal schedule as the hrtimers, rounded up to jiffies */
+	jit_timer_expected += jit_period_ns;
+	while (jit_timer_expected <= now) {
+		jit_timer_expected += jit_period_ns;
+		missed++;
+	}
+	if (missed)
+		jit_record_missed(JIT_TIMER, missed);
+
+	mod_timer(&jit_timer, jiffies +
+		  nsecs_to_jiffies(jit_timer_expected - now + TICK_NSEC - 1));
+}
+
+static int jit_thread_fn(void *data)
+{
+	ktime_t expected = ktime_add_ns(ktime_get(), jit_period_ns);
+	u64 now, missed;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&expected, jit_slack_ns, HRTIMER_MODE_ABS);
+
+		/* kthread_stop() wakes us early; don't count that */
+		if (kthread_should_stop())
+			break;
+
+		now = ktime_get_ns();
+		jit_record(JIT_THREAD, ktime_to_ns(expected), now);
+
+		missed = 0;
+		expected = ktime_add_ns(expected, jit_period_ns);
+		while (ktime_to_ns(expected) <= now) {
+			expected = ktime_add_ns(expected, jit_period_ns);
+			missed++;
+		}
+		if (missed)
+			jit_record_missed(JIT_THREAD, missed);
+	}
+
+	return 0;
+}
+
+/* Called with jit_mutex held */
+static int jit_start(enum jit_mode mode)
+{
+	struct jit_result *r = &jit_results[mode];
+	unsigned long flags;
+	u64 now;
+
+	if (jit_active >= 0)
+		return -EBUSY;
+
+	jit_period_ns = (u64)jit_period_us * NSEC_PER_USEC;
+	jit_slack_ns = (u64)jit_slack_us * NSEC_PER_USEC;
+	WRITE_ONCE(jit_stopping, false);
+
+	/* A new run replaces the previous result for this mode */
+	raw_spin_lock_irqsave(&jit_lock, flags);
+	lat_hist_reset(&r->hist);
+	r->early = 0;
+	r->missed = 0;
+	r->period_us = jit_period_us;
+	r->slack_us = mode == JIT_TIMER ? 0 : jit_slack_us;
+	raw_spin_unlock_irqrestore(&jit_lock, flags);
+
+	jit_active = mode;
+
+	switch (mode) {
+	case JIT_HARD:
+	case JIT_SOFT:
+		/* Hard/soft is fixed at init time, so init per run */
+		hrtimer_init(&jit_hrtimer, CLOCK_MONOTONIC, mode == JIT_HARD ?
+			     HRTIMER_MODE_ABS_HARD : HRTIMER_MODE_ABS_SOFT);
+		jit_hrtimer.function = jit_hrtimer_fn;
+		hrtimer_start_range_ns(&jit_hrtimer,
+				       ktime_add_ns(ktime_get(), jit_period_ns),
+				       jit_slack_ns, mode == JIT_HARD ?
+				       HRTIMER_MODE_ABS_HARD : HRTIMER_MODE_ABS_SOFT);
+		break;
+	case JIT_TIMER:
+		now = ktime_get_ns();
+		jit_timer_expected = now + jit_period_ns;
+		mod_timer(&jit_timer, jiffies +
+			  nsecs_to_jiffies(jit_period_ns + TICK_NSEC - 1));
+		break;
+	case JIT_THREAD:
+		jit_thread = kthread_run(jit_thread_fn, NULL, "timer_jitter");
+		if (IS_ERR(jit_thread)) {
+			jit_active = -1;
+			return PTR_ERR(jit_thread);
+		}
+		break;
+	default:
+		jit_active = -1;
+		return -EINVAL;
+	}
+
+	pr_info("timer_demo: jitter run started (%s, %u us, slack %u us)\n",
+		jit_mode_names[mode], jit_period_us, jit_slack_us);
+	return 0;
+}
+
+/* Called with jit_mutex held */
+static void jit_stop(void)
+{
+	if (jit_active < 0)
+		return;
+
+	WRITE_ONCE(jit_stopping, true);
+
+	switch (jit_active) {
+	case JIT_HARD:
+	case JIT_SOFT:
+		hrtimer_cancel(&jit_hrtimer);
+		break;
+	case JIT_TIMER:
+		del_timer_sync(&jit_timer);
+		break;
+	case JIT_THREAD:
+		kthread_stop(jit_thread);
+		break;
+	}
+
+	pr_info("timer_demo: jitter run stopped (%s)\n",
+		jit_mode_names[jit_active]);
+	jit_active = -1;
+}
+
+static void jit_show(struct seq_file *m)
+{
+	struct lat_summary sum[NR_JIT_MODES];
+	struct {
+		u64 early;
+		u64 missed;
+		unsigned int period_us;
+		unsigned int slack_us;
+	} info[NR_JIT_MODES];
+	struct lat_hist *hist;
+	unsigned long flags;
+	int mode, shown;
+	unsigned int b;
+
+	hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+
+	mutex_lock(&jit_mutex);
+	shown = jit_active;
+
+	/* Consistent snapshot; printing happens after the lock is dropped */
+	raw_spin_lock_irqsave(&jit_lock, flags);
+	for (mode = 0; mode < NR_JIT_MODES; mode++) {
+		lat_hist_summarize(&jit_results[mode].hist, &sum[mode]);
+		info[mode].early = jit_results[mode].early;
+		info[mode].missed = jit_results[mode].missed;
+		info[mode].period_us = jit_results[mode].period_us;
+		info[mode].slack_us = jit_results[mode].slack_us;
+		if (shown < 0 && sum[mode].count)
+			shown = mode;		/* No run active: first with data */
+	}
+	if (hist && shown >= 0)
+		memcpy(hist, &jit_results[shown].hist, sizeof(*hist));
+	raw_spin_unlock_irqrestore(&jit_lock, flags);
+
+	seq_printf(m, "\nJitter measurement:\n");
+	seq_printf(m, "  Active:     %s\n",
+		   jit_active >= 0 ? jit_mode_names[jit_active] : "none");
+	seq_printf(m, "  Period:     %u us\n", jit_period_us);
+	seq_printf(m, "  Slack:      %u us\n", jit_slack_us);
+	mutex_unlock(&jit_mutex);
+
+	seq_printf(m, "  %-6s %7s %6s %9s %7s %6s %8s %8s %8s %8s %8s %8s\n",
+		   "mode", "period", "slack", "samples", "early", "missed",
+		   "min", "mean", "p50", "p99", "p99.9", "max");
+	for (mode = 0; mode < NR_JIT_MODES; mode++) {
+		if (!sum[mode].count)
+			continue;
+		seq_printf(m, "  %-6s %7u %6u %9llu %7llu %6llu %8llu %8llu %8llu %8llu %8llu %8llu\n",
+			   jit_mode_names[mode], info[mode].period_us,
+			   info[mode].slack_us, sum[mode].count,
+			   info[mode].early, info[mode].missed,
+			   sum[mode].min_ns, sum[mode].mean_ns, sum[mode].p50_ns,
+			   sum[mode].p99_ns, sum[mode].p999_ns, sum[mode].max_ns);
+	}
+	seq_printf(m, "  (period/slack in us, jitter in ns)\n");
+
+	if (hist && shown >= 0 && hist->count) {
+		seq_printf(m, "\nJitter histogram (%s, ns):\n",
+			   jit_mode_names[shown]);
+		for (b = 0; b < LAT_BUCKETS; b++) {
+			if (!hist->buckets[b])
+				continue;
+			seq_printf(m, "  %10llu - %-10llu %10llu\n",
+				   lat_bucket_min(b), lat_bucket_max(b),
+				   hist->buckets[b]);
+		}
+	}
+
+	kfree(hist);
+}
+
 /* High-resolution timer callback */
 static enum hrtimer_restart hrtimer_callback(struct hrtimer *timer)
 {
@@ -112,7 +540,13 @@ static int stats_show(struct seq_file *m, void *v)
 	seq_printf(m, "\nSystem info:\n");
 	seq_printf(m, "  HZ:         %d\n", HZ);
 	seq_printf(m, "  Jiffies:    %lu\n", jiffies);
-	seq_printf(m, "\nCommands: start, stop, hstart, hstop\n");
+	jit_show(m);
+	seq_printf(m, "\nCommands:\n");
+	seq_printf(m, "  start, stop, hstart, hstop - Demo timers\n");
+	seq_printf(m, "  jstart <hard|soft|timer|thread> - Start a jitter run\n");
+	seq_printf(m, "  jstop                      - Stop the jitter run\n");
+	seq_printf(m, "  period <us>                - Jitter run period\n");
+	seq_printf(m, "  slack <us>                 - hrtimer slack (range)\n");
 	return 0;
 }
 
@@ -124,8 +558,10 @@ static int stats_open(struct inode *inode, struct file *file)
 static ssize_t stats_write(struct file *file, const char __user *buf,
 			   size_t count, loff_t *ppos)
 {
-	char cmd[32];
+	char cmd[32], arg[16];
 	size_t len = min(count, sizeof(cmd) - 1);
+	unsigned int val;
+	int ret = 0;
 
 	if (copy_from_user(cmd, buf, len))
 		return -EFAULT;
@@ -134,18 +570,41 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 	if (len > 0 && cmd[len - 1] == '\n')
 		cmd[len - 1] = '\0';
 
-	if (strcmp(cmd, "start") == 0)
+	mutex_lock(&jit_mutex);
+	if (strcmp(cmd, "start") == 0) {
 		start_timer();
-	else if (strcmp(cmd, "stop") == 0)
+	} else if (strcmp(cmd, "stop") == 0) {
 		stop_timer();
-	else if (strcmp(cmd, "hstart") == 0)
+	} else if (strcmp(cmd, "hstart") == 0) {
 		start_hrtimer();
-	else if (strcmp(cmd, "hstop") == 0)
+	} else if (strcmp(cmd, "hstop") == 0) {
 		stop_hrtimer();
-	else
+	} else if (sscanf(cmd, "jstart %15s", arg) == 1) {
+		ret = match_string(jit_mode_names, NR_JIT_MODES, arg);
+		if (ret >= 0)
+			ret = jit_start(ret);
+	} else if (strcmp(cmd, "jstop") == 0) {
+		jit_stop();
+	} else if (sscanf(cmd, "period %u", &val) == 1) {
+		if (jit_active >= 0)
+			ret = -EBUSY;
+		else if (val < JIT_MIN_PERIOD_US || val > JIT_MAX_PERIOD_US)
+			ret = -EINVAL;
+		else
+			jit_period_us = val;
+	} else if (sscanf(cmd, "slack %u", &val) == 1) {
+		if (jit_active >= 0)
+			ret = -EBUSY;
+		else if (val > JIT_MAX_PERIOD_US)
+			ret = -EINVAL;
+		else
+			jit_slack_us = val;
+	} else {
 		pr_warn("timer_demo: unknown command: %s\n", cmd);
+	}
+	mutex_unlock(&jit_mutex);
 
-	return count;
+	return ret < 0 ? ret : count;
 }
 
 static const struct proc_ops stats_proc_ops = {
@@ -160,6 +619,8 @@ static struct proc_dir_entry *proc_entry;
 
 static int __init timer_demo_init(void)
 {
+	int i;
+
 	pr_info("timer_demo: initializing\n");
 
 	/* Setup standard timer */
@@ -169,6 +630,11 @@ static int __init timer_demo_init(void)
 	hrtimer_init(&hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	hr_timer.function = hrtimer_callback;
 
+	/* Jitter sources; jit_hrtimer is initialized per run */
+	timer_setup(&jit_timer, jit_timer_fn, 0);
+	for (i = 0; i < NR_JIT_MODES; i++)
+		lat_hist_reset(&jit_results[i].hist);
+
 	/* Create proc entry */
 	proc_entry = proc_create("timer_demo", 0666, NULL, &stats_proc_ops);
 	if (!proc_entry) {
@@ -184,11 +650,15 @@ static void __exit timer_demo_exit(void)
 {
 	pr_info("timer_demo: exiting\n");
 
+	if (proc_entry)
+		proc_remove(proc_entry);
+
 	stop_timer();
 	stop_hrtimer();
 
-	if (proc_entry)
-		proc_remove(proc_entry);
+	mutex_lock(&jit_mutex);
+	jit_stop();
+	mutex_unlock(&jit_mutex);
 
 	pr_info("timer_demo: exited\n");
 }
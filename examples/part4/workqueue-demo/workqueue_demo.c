@@ -7,6 +7,9 @@
  * - Delayed work
  * - Custom work queue
  * - Periodic work
+ * - Preallocated, lock-free pool of work items
+ * - Batched submission through per-CPU llists
+ * - Bound, unbound and high-priority queue modes with latency stats
  */
 
 #include <linux/module.h>
@@ -15,15 +18,85 @@
 #include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/bitmap.h>
+#include <linux/wait.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#define POOL_MAX 4096
+#define BURST_MAX 100000
+#define WORK_US_MAX 1000000
+
+static unsigned int pool_size = 64;
+module_param(pool_size, uint, 0444);
+MODULE_PARM_DESC(pool_size, "Preallocated custom work items (max 4096)");
 
 /* Statistics */
 static atomic_t immediate_work_count = ATOMIC_INIT(0);
 static atomic_t delayed_work_count = ATOMIC_INIT(0);
 static atomic_t custom_work_count = ATOMIC_INIT(0);
 static atomic_t periodic_work_count = ATOMIC_INIT(0);
+static atomic_t pool_misses = ATOMIC_INIT(0);
+static atomic_t pool_waits = ATOMIC_INIT(0);
+static atomic_t pool_high = ATOMIC_INIT(0);
+static atomic_t pool_in_use = ATOMIC_INIT(0);
+
+/*
+ * Custom work goes to one of several queues, selected at runtime with
+ * the "mode" command, so the same load can be compared across queue
+ * configurations. "default" is the original demo_wq.
+ */
+enum wq_mode {
+	WQ_MODE_DEFAULT,
+	WQ_MODE_PERCPU,
+	WQ_MODE_UNBOUND,
+	WQ_MODE_HIGHPRI,
+	NR_WQ_MODES,
+};
 
-/* Custom work queue */
-static struct workqueue_struct *custom_wq;
+static const struct {
+	const char *name;
+	const char *wq_name;
+	unsigned int flags;
+	int max_active;
+} wq_modes[NR_WQ_MODES] = {
+	[WQ_MODE_DEFAULT] = { "default", "demo_wq",
+			      WQ_UNBOUND | WQ_MEM_RECLAIM, 4 },
+	[WQ_MODE_PERCPU] = { "percpu", "demo_wq_percpu", 0, 0 },
+	[WQ_MODE_UNBOUND] = { "unbound", "demo_wq_unbound", WQ_UNBOUND, 0 },
+	[WQ_MODE_HIGHPRI] = { "highpri", "demo_wq_highpri", WQ_HIGHPRI, 0 },
+};
+
+static struct workqueue_struct *mode_wq[NR_WQ_MODES];
+static int cur_mode = WQ_MODE_DEFAULT;
+static bool batch_mode;
+static unsigned int work_us = 20000;	/* Simulated work per item */
+
+/*
+ * Queue-to-execute statistics per (mode, batched) pair. Updated with
+ * atomics from the handlers; throughput is items over the span from
+ * the first submission to the last completion.
+ */
+struct mode_stats {
+	atomic64_t items;
+	atomic64_t lat_sum;
+	atomic64_t lat_max;
+	atomic64_t first_ns;
+	atomic64_t last_ns;
+	atomic64_t drains;		/* Batched: drain work runs */
+};
+
+static struct mode_stats mode_stats[NR_WQ_MODES][2];
+
+/* Per-CPU batch: submissions append, one work item drains them all */
+struct custom_batch {
+	struct llist_head list;
+	struct work_struct work;
+};
+
+static DEFINE_PER_CPU(struct custom_batch, custom_batches);
 
 /* Work structures */
 static struct work_struct immediate_work;
@@ -34,10 +107,56 @@ static bool periodic_running;
 /* Custom work with data */
 struct custom_work {
 	struct work_struct work;
+	struct llist_node lnode;	/* Batched submissions */
+	unsigned int slot;		/* Index in custom_pool */
+	int mode;
+	bool batched;
+	u64 queued_ns;
 	int id;
 	char message[64];
 };
 
+/*
+ * Custom work items come from a fixed array allocated at load time,
+ * so submission never allocates and never fails because of memory
+ * pressure. A bit in pool_map marks a slot in use; claiming one is a
+ * test_and_set_bit_lock() on the first clear bit, so any context can
+ * take and return slots without a lock. An empty pool is reported to
+ * the caller (and counted) instead of being hidden by an allocation.
+ */
+static struct custom_work *custom_pool;
+static unsigned long *pool_map;
+static DECLARE_WAIT_QUEUE_HEAD(pool_wq);
+
+static struct custom_work *pool_get(void)
+{
+	unsigned int slot, used;
+
+	for (;;) {
+		slot = find_first_zero_bit(pool_map, pool_size);
+		if (slot >= pool_size)
+			return NULL;
+		if (!test_and_set_bit_lock(slot, pool_map))
+			break;
+		/* Lost the race for this slot, look again */
+	}
+
+	used = atomic_inc_return(&pool_in_use);
+	if (used > atomic_read(&pool_high))
+		atomic_set(&pool_high, used);	/* Approximate watermark */
+
+	return &custom_pool[slot];
+}
+
+static void pool_put(struct custom_work *cw)
+{
+	atomic_dec(&pool_in_use);
+	clear_bit_unlock(cw->slot, pool_map);
+	/* wq_has_sleeper() orders the clear against a waiter's check */
+	if (wq_has_sleeper(&pool_wq))
+		wake_up(&pool_wq);
+}
+
 /* Immediate work handler */
 static void immediate_work_handler(struct work_struct *work)
 {
@@ -63,21 +182,63 @@ static void delayed_work_handler(struct work_struct *work)
 	pr_info("workqueue_demo: delayed work done\n");
 }
 
+static void stat_max(atomic64_t *v, s64 val)
+{
+	s64 old = atomic64_read(v);
+
+	while (val > old && !atomic64_try_cmpxchg(v, &old, val))
+		;
+}
+
+/* Process one custom item, from its own work or from a batch drain */
+static void custom_work_run(struct custom_work *cw)
+{
+	struct mode_stats *st = &mode_stats[cw->mode][cw->batched];
+	u64 lat = ktime_get_ns() - cw->queued_ns;
+
+	atomic64_inc(&st->items);
+	atomic64_add(lat, &st->lat_sum);
+	stat_max(&st->lat_max, lat);
+
+	atomic_inc(&custom_work_count);
+	pr_debug("workqueue_demo: custom work id=%d msg='%s' (count: %d)\n",
+		 cw->id, cw->message, atomic_read(&custom_work_count));
+
+	if (READ_ONCE(work_us))
+		fsleep(READ_ONCE(work_us));
+
+	stat_max(&st->last_ns, ktime_get_ns());
+
+	/*
+	 * Return the slot last. The workqueue core no longer touches the
+	 * work_struct once the handler runs, so it may be requeued at once.
+	 */
+	pool_put(cw);
+}
+
 /* Custom work handler */
 static void custom_work_handler(struct work_struct *work)
 {
-	struct custom_work *cw = container_of(work, struct custom_work, work);
+	custom_work_run(container_of(work, struct custom_work, work));
+}
 
-	atomic_inc(&custom_work_count);
-	pr_info("workqueue_demo: custom work id=%d msg='%s' (count: %d)\n",
-		cw->id, cw->message, atomic_read(&custom_work_count));
+/* Drain everything queued on this CPU's batch since the last run */
+static void custom_batch_handler(struct work_struct *work)
+{
+	struct custom_batch *batch = container_of(work, struct custom_batch, work);
+	struct custom_work *cw, *tmp;
+	struct llist_node *first;
 
-	msleep(20);
+	first = llist_reverse_order(llist_del_all(&batch->list));
+	if (!first)
+		return;
 
-	/* Free the work structure */
-	kfree(cw);
+	/* Batches may span a mode switch; charge the drain to the first item */
+	cw = llist_entry(first, struct custom_work, lnode);
+	atomic64_inc(&mode_stats[cw->mode][1].drains);
 
-	pr_info("workqueue_demo: custom work done\n");
+	llist_for_each_entry_safe(cw, tmp, first, lnode)
+		custom_work_run(cw);
 }
 
 /* Periodic work handler */
@@ -107,20 +268,76 @@ static void submit_delayed(void)
 	schedule_delayed_work(&delayed_work, 2 * HZ);
 }
 
-/* Submit custom work to dedicated queue */
+/*
+ * Fill in a pool slot the caller already holds and queue it on the
+ * current mode's workqueue, directly or through this CPU's batch list.
+ * Cannot fail. Never sleeps, and is safe from atomic context.
+ */
+static void queue_custom(struct custom_work *cw, int id, const char *msg)
+{
+	struct workqueue_struct *wq;
+	struct custom_batch *batch;
+
+	cw->id = id;
+	strscpy(cw->message, msg, sizeof(cw->message));
+	cw->mode = READ_ONCE(cur_mode);
+	cw->batched = READ_ONCE(batch_mode);
+	cw->queued_ns = ktime_get_ns();
+	/* Read first so steady-state submits don't dirty the line */
+	if (!atomic64_read(&mode_stats[cw->mode][cw->batched].first_ns))
+		atomic64_cmpxchg(&mode_stats[cw->mode][cw->batched].first_ns, 0,
+				 cw->queued_ns);
+
+	wq = mode_wq[cw->mode];
+	if (!cw->batched) {
+		queue_work(wq, &cw->work);
+		return;
+	}
+
+	/*
+	 * Only the submission that finds the list empty queues the drain.
+	 * If the drain is already running it is queued again and picks up
+	 * whatever it missed.
+	 */
+	batch = get_cpu_ptr(&custom_batches);
+	if (llist_add(&cw->lnode, &batch->list))
+		queue_work_on(smp_processor_id(), wq, &batch->work);
+	put_cpu_ptr(&custom_batches);
+}
+
+/*
+ * Submit custom work to the dedicated queue without sleeping. Returns
+ * -EAGAIN when the pool is exhausted.
+ */
 static int submit_custom(int id, const char *msg)
 {
 	struct custom_work *cw;
 
-	cw = kmalloc(sizeof(*cw), GFP_KERNEL);
-	if (!cw)
-		return -ENOMEM;
+	cw = pool_get();
+	if (!cw) {
+		atomic_inc(&pool_misses);
+		return -EAGAIN;
+	}
 
-	cw->id = id;
-	strscpy(cw->message, msg, sizeof(cw->message));
-	INIT_WORK(&cw->work, custom_work_handler);
+	queue_custom(cw, id, msg);
+	return 0;
+}
 
-	queue_work(custom_wq, &cw->work);
+/* Sleeping variant: apply backpressure by waiting for a free slot */
+static int submit_custom_wait(int id, const char *msg)
+{
+	struct custom_work *cw;
+	int ret;
+
+	cw = pool_get();
+	if (!cw) {
+		atomic_inc(&pool_waits);
+		ret = wait_event_interruptible(pool_wq, (cw = pool_get()));
+		if (ret)
+			return ret;
+	}
+
+	queue_custom(cw, id, msg);
 	return 0;
 }
 
@@ -143,6 +360,64 @@ static void stop_periodic(void)
 	pr_info("workqueue_demo: periodic work stopped\n");
 }
 
+static void show_mode_stats(struct seq_file *m)
+{
+	int mode, batched;
+
+	seq_printf(m, "\nCustom work mode: %s%s, work %u us\n",
+		   wq_modes[READ_ONCE(cur_mode)].name,
+		   READ_ONCE(batch_mode) ? " (batched)" : "", READ_ONCE(work_us));
+	seq_printf(m, "  %-16s %10s %12s %10s %10s %9s\n", "mode", "items",
+		   "items/s", "avg lat us", "max lat us", "per drain");
+
+	for (mode = 0; mode < NR_WQ_MODES; mode++) {
+		for (batched = 0; batched < 2; batched++) {
+			struct mode_stats *st = &mode_stats[mode][batched];
+			u64 items = atomic64_read(&st->items);
+			u64 drains = atomic64_read(&st->drains);
+			s64 span;
+			char name[24];
+
+			if (!items)
+				continue;
+
+			span = atomic64_read(&st->last_ns) -
+			       atomic64_read(&st->first_ns);
+			snprintf(name, sizeof(name), "%s%s", wq_modes[mode].name,
+				 batched ? "+batch" : "");
+
+			seq_printf(m, "  %-16s %10llu %12llu %10llu %10llu",
+				   name, items,
+				   span > 0 ? mul_u64_u64_div_u64(items, NSEC_PER_SEC, span) : 0,
+				   div64_u64(atomic64_read(&st->lat_sum),
+					     items * NSEC_PER_USEC),
+				   div_u64(atomic64_read(&st->lat_max), NSEC_PER_USEC));
+			if (batched && drains)
+				seq_printf(m, " %9llu\n", div64_u64(items, drains));
+			else
+				seq_printf(m, " %9s\n", "-");
+		}
+	}
+}
+
+static void reset_mode_stats(void)
+{
+	int mode, batched;
+
+	for (mode = 0; mode < NR_WQ_MODES; mode++) {
+		for (batched = 0; batched < 2; batched++) {
+			struct mode_stats *st = &mode_stats[mode][batched];
+
+			atomic64_set(&st->items, 0);
+			atomic64_set(&st->lat_sum, 0);
+			atomic64_set(&st->lat_max, 0);
+			atomic64_set(&st->first_ns, 0);
+			atomic64_set(&st->last_ns, 0);
+			atomic64_set(&st->drains, 0);
+		}
+	}
+}
+
 /* Proc file interface */
 static int stats_show(struct seq_file *m, void *v)
 {
@@ -158,10 +433,22 @@ static int stats_show(struct seq_file *m, void *v)
 		   atomic_read(&periodic_work_count));
 	seq_printf(m, "Periodic running:     %s\n",
 		   periodic_running ? "yes" : "no");
+	seq_printf(m, "\nCustom work pool:\n");
+	seq_printf(m, "  Size:          %u\n", pool_size);
+	seq_printf(m, "  In use:        %d\n", atomic_read(&pool_in_use));
+	seq_printf(m, "  High water:    %d\n", atomic_read(&pool_high));
+	seq_printf(m, "  Misses:        %d\n", atomic_read(&pool_misses));
+	seq_printf(m, "  Waits:         %d\n", atomic_read(&pool_waits));
+	show_mode_stats(m);
 	seq_printf(m, "\nWrite commands:\n");
 	seq_printf(m, "  immediate - Queue immediate work\n");
 	seq_printf(m, "  delayed   - Queue delayed work (2s)\n");
-	seq_printf(m, "  custom    - Queue custom work\n");
+	seq_printf(m, "  custom    - Queue custom work (waits for a free slot)\n");
+	seq_printf(m, "  burst <n> [wait] - Queue n custom items (drop or wait when full)\n");
+	seq_printf(m, "  mode <default|percpu|unbound|highpri> - Queue for custom work\n");
+	seq_printf(m, "  batch <on|off>   - Coalesce custom work via per-CPU llists\n");
+	seq_printf(m, "  work_us <n>      - Simulated work per custom item\n");
+	seq_printf(m, "  reset_stats      - Clear per-mode statistics\n");
 	seq_printf(m, "  start     - Start periodic work\n");
 	seq_printf(m, "  stop      - Stop periodic work\n");
 	return 0;
@@ -175,8 +462,11 @@ static int stats_open(struct inode *inode, struct file *file)
 static ssize_t stats_write(struct file *file, const char __user *buf,
 			   size_t count, loff_t *ppos)
 {
-	char cmd[32];
+	char cmd[48], arg[16];
+	unsigned int n;
+	int ret;
 	size_t len = min(count, sizeof(cmd) - 1);
+	static atomic_t custom_id = ATOMIC_INIT(0);
 
 	if (copy_from_user(cmd, buf, len))
 		return -EFAULT;
@@ -193,12 +483,56 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 		submit_delayed();
 		pr_info("workqueue_demo: queued delayed work (2s)\n");
 	} else if (strcmp(cmd, "custom") == 0) {
-		static int custom_id;
+		int id = atomic_inc_return(&custom_id);
+		char msg[32];
+		int ret;
+
+		snprintf(msg, sizeof(msg), "custom job %d", id);
+		ret = submit_custom_wait(id, msg);
+		if (ret)
+			return ret;
+		pr_info("workqueue_demo: queued custom work %d\n", id);
+	} else if (strncmp(cmd, "burst ", 6) == 0) {
+		unsigned int i, queued = 0;
 		char msg[32];
-		snprintf(msg, sizeof(msg), "custom job %d", ++custom_id);
-		if (submit_custom(custom_id, msg) == 0)
-			pr_info("workqueue_demo: queued custom work %d\n",
-				custom_id);
+		bool wait;
+
+		ret = sscanf(cmd, "burst %u %15s", &n, arg);
+		if (ret < 1 || n > BURST_MAX)
+			return -EINVAL;
+		wait = ret == 2 && strcmp(arg, "wait") == 0;
+
+		/* Hot-path style by default: a full pool is a miss, not a wait */
+		for (i = 0; i < n; i++) {
+			int id = atomic_inc_return(&custom_id);
+
+			snprintf(msg, sizeof(msg), "burst job %d", id);
+			if (wait)
+				ret = submit_custom_wait(id, msg);
+			else
+				ret = submit_custom(id, msg);
+			if (ret == 0)
+				queued++;
+			else if (ret != -EAGAIN)
+				break;		/* Interrupted */
+		}
+		pr_info("workqueue_demo: burst queued %u of %u\n", queued, n);
+	} else if (sscanf(cmd, "mode %15s", arg) == 1) {
+		for (n = 0; n < NR_WQ_MODES; n++)
+			if (strcmp(arg, wq_modes[n].name) == 0)
+				break;
+		if (n == NR_WQ_MODES)
+			return -EINVAL;
+		WRITE_ONCE(cur_mode, n);
+	} else if (sscanf(cmd, "batch %15s", arg) == 1) {
+		if (kstrtobool(arg, &batch_mode))
+			return -EINVAL;
+	} else if (sscanf(cmd, "work_us %u", &n) == 1) {
+		if (n > WORK_US_MAX)
+			return -EINVAL;
+		WRITE_ONCE(work_us, n);
+	} else if (strcmp(cmd, "reset_stats") == 0) {
+		reset_mode_stats();
 	} else if (strcmp(cmd, "start") == 0) {
 		start_periodic();
 	} else if (strcmp(cmd, "stop") == 0) {
@@ -222,15 +556,43 @@ static struct proc_dir_entry *proc_entry;
 
 static int __init workqueue_demo_init(void)
 {
+	unsigned int i;
+	int cpu, mode;
+
 	pr_info("workqueue_demo: initializing\n");
 
-	/* Create custom work queue */
-	custom_wq = alloc_workqueue("demo_wq",
-				    WQ_UNBOUND | WQ_MEM_RECLAIM,
-				    4);  /* max 4 active workers */
-	if (!custom_wq) {
-		pr_err("workqueue_demo: failed to create workqueue\n");
-		return -ENOMEM;
+	if (!pool_size || pool_size > POOL_MAX) {
+		pr_err("workqueue_demo: pool_size must be 1..%d\n", POOL_MAX);
+		return -EINVAL;
+	}
+
+	/* Preallocate every custom work item up front */
+	custom_pool = kcalloc(pool_size, sizeof(*custom_pool), GFP_KERNEL);
+	pool_map = bitmap_zalloc(pool_size, GFP_KERNEL);
+	if (!custom_pool || !pool_map)
+		goto err_pool;
+
+	for (i = 0; i < pool_size; i++) {
+		custom_pool[i].slot = i;
+		INIT_WORK(&custom_pool[i].work, custom_work_handler);
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct custom_batch *batch = per_cpu_ptr(&custom_batches, cpu);
+
+		init_llist_head(&batch->list);
+		INIT_WORK(&batch->work, custom_batch_handler);
+	}
+
+	/* Create custom work queues, one per mode */
+	for (mode = 0; mode < NR_WQ_MODES; mode++) {
+		mode_wq[mode] = alloc_workqueue("%s", wq_modes[mode].flags,
+						wq_modes[mode].max_active,
+						wq_modes[mode].wq_name);
+		if (!mode_wq[mode]) {
+			pr_err("workqueue_demo: failed to create workqueue\n");
+			goto err_wq;
+		}
 	}
 
 	/* Initialize work structures */
@@ -241,18 +603,27 @@ static int __init workqueue_demo_init(void)
 	/* Create proc entry */
 	proc_entry = proc_create("workqueue_demo", 0666, NULL, &stats_proc_ops);
 	if (!proc_entry) {
-		destroy_workqueue(custom_wq);
 		pr_err("workqueue_demo: failed to create proc entry\n");
-		return -ENOMEM;
+		goto err_wq;
 	}
 
 	pr_info("workqueue_demo: initialized\n");
 	pr_info("workqueue_demo: use /proc/workqueue_demo to interact\n");
 	return 0;
+
+err_wq:
+	while (mode--)
+		destroy_workqueue(mode_wq[mode]);
+err_pool:
+	bitmap_free(pool_map);
+	kfree(custom_pool);
+	return -ENOMEM;
 }
 
 static void __exit workqueue_demo_exit(void)
 {
+	int mode;
+
 	pr_info("workqueue_demo: exiting\n");
 
 	/* Stop periodic work */
@@ -262,14 +633,20 @@ static void __exit workqueue_demo_exit(void)
 	cancel_work_sync(&immediate_work);
 	cancel_delayed_work_sync(&delayed_work);
 
-	/* Flush and destroy custom queue */
-	flush_workqueue(custom_wq);
-	destroy_workqueue(custom_wq);
-
-	/* Remove proc entry */
+	/* Remove proc entry so no new custom work can be submitted */
 	if (proc_entry)
 		proc_remove(proc_entry);
 
+	/* Flush and destroy custom queues; this also runs pending batches */
+	for (mode = 0; mode < NR_WQ_MODES; mode++) {
+		flush_workqueue(mode_wq[mode]);
+		destroy_workqueue(mode_wq[mode]);
+	}
+
+	/* Every pool item has run and been returned */
+	bitmap_free(pool_map);
+	kfree(custom_pool);
+
 	pr_info("workqueue_demo: exited\n");
 }
 
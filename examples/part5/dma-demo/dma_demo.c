@@ -6,6 +6,11 @@
  * - Coherent DMA allocation (dma_alloc_coherent)
  * - Streaming DMA mapping (dma_map_single)
  * - DMA synchronization
+ * - Descriptor ring in coherent memory with dma_pool buffers,
+ *   producer/consumer indices and map-once/sync-per-use recycling
+ * - Scatter-gather mapping (dma_map_sgtable)
+ * - dmaengine memcpy offload with completion callbacks, benchmarked
+ *   against CPU memcpy
  *
  * Note: This is a demonstration module. Without actual hardware,
  * DMA operations are simulated.
@@ -17,9 +22,116 @@
 #include <linux/slab.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/dmapool.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/crc32.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/scatterlist.h>
+#include <linux/dmaengine.h>
+#include <linux/sizes.h>
+#include <linux/completion.h>
 
 #define DMA_BUFFER_SIZE 4096
 #define COHERENT_BUFFER_SIZE 1024
+#define RING_SIZE_MAX 4096
+#define RING_BUF_SIZE_MAX 65536
+#define BENCH_ITERS_MAX 1000000		/* 1.5 GB at 1500 bytes */
+#define SG_PAGES_MAX 4096
+#define SG_ITERS_MAX 100000		/* 1.6 GB at SG_PAGES_MAX */
+#define COPY_SIZE_MAX SZ_1M
+#define COPY_BYTES_PER_SIZE SZ_64M	/* Bounds each size's run time */
+#define COPY_QUEUE_DEPTH 32		/* dmaengine copies in flight */
+#define COPY_TIMEOUT (5 * HZ)
+
+static unsigned int ring_size = 64;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Descriptors in the ring, power of two (default: 64)");
+
+static unsigned int ring_buf_size = 2048;
+module_param(ring_buf_size, uint, 0444);
+MODULE_PARM_DESC(ring_buf_size, "Bytes per descriptor buffer (default: 2048)");
+
+static bool ring_streaming;
+module_param(ring_streaming, bool, 0444);
+MODULE_PARM_DESC(ring_streaming, "Use kmalloc buffers mapped once instead of dma_pool buffers (default: 0)");
+
+/*
+ * Descriptor as the device sees it. Lives in coherent memory, so both
+ * sides see each other's stores without syncs; ordering still needs
+ * dma_wmb()/dma_rmb() around the ownership flag.
+ */
+struct dma_demo_desc {
+	__le64 addr;		/* Bus address of the buffer */
+	__le32 len;
+	__le32 status;		/* Device writes the buffer's CRC32 here */
+	__le32 flags;
+	__le32 reserved;
+};
+
+#define DESC_OWN	BIT(0)	/* Handed to the device */
+#define DESC_DONE	BIT(1)	/* Device finished with it */
+
+/*
+ * head and tail are free-running; slot = index & (size - 1).
+ * Each slot owns one buffer for the ring's lifetime: it is allocated
+ * (and, in streaming mode, mapped) once and recycled on every use.
+ */
+struct dma_demo_ring {
+	struct dma_demo_desc *descs;
+	dma_addr_t descs_dma;
+	unsigned int size;
+
+	void **bufs;
+	dma_addr_t *buf_dma;
+	struct dma_pool *pool;	/* NULL in streaming mode */
+	bool streaming;
+
+	u32 head;		/* CPU: next descriptor to fill */
+	u32 tail;		/* CPU: next descriptor to reclaim */
+	u32 dev_idx;		/* Device: next descriptor to process */
+
+	/*
+	 * The simulated device is just this CPU, so it runs under the
+	 * ring lock too. A real device would not, which is why the
+	 * OWN/DONE handshake below carries the DMA barriers anyway.
+	 */
+	struct mutex lock;
+	struct work_struct doorbell;
+
+	unsigned long submitted;
+	unsigned long completed;
+	unsigned long ring_full;
+	u64 bytes;
+};
+
+struct dma_demo_bench {
+	unsigned int iters;
+	unsigned int len;
+	u64 ring_ns;
+	u64 map_ns;
+};
+
+struct dma_demo_sg_result {
+	unsigned int pages;
+	unsigned int nents;	/* Segments after mapping (IOMMU may merge) */
+	unsigned int iters;
+	u64 map_ns;		/* dma_map_sgtable() + dma_unmap_sgtable() */
+	u64 total_ns;		/* Including the device walking the list */
+};
+
+static const unsigned int copy_sizes[] = {
+	SZ_256, SZ_1K, SZ_4K, SZ_16K, SZ_64K, SZ_256K, SZ_1M,
+};
+
+/* Per copy; dma_* are 0 when there is no channel or the size failed */
+struct dma_demo_copy_result {
+	unsigned int iters;
+	u64 cpu_ns;
+	u64 dma_lat_ns;		/* One copy in flight at a time */
+	u64 dma_tput_ns;	/* COPY_QUEUE_DEPTH copies in flight */
+};
 
 struct dma_demo_dev {
 	struct device *dev;
@@ -38,6 +150,16 @@ struct dma_demo_dev {
 	unsigned long coherent_reads;
 	unsigned long streaming_maps;
 	unsigned long streaming_unmaps;
+
+	struct dma_demo_ring ring;
+
+	/* Ring, scatter-gather and memcpy benchmarks, under bench_lock */
+	struct mutex bench_lock;
+	struct dma_demo_bench bench;
+	struct dma_demo_sg_result sg;
+	struct dma_demo_copy_result copy[ARRAY_SIZE(copy_sizes)];
+	char copy_chan[32];	/* dmaengine channel used, "" if none */
+	bool copy_valid;
 };
 
 static struct dma_demo_dev *demo_dev;
@@ -180,10 +302,581 @@ static void sync_streaming_for_device(struct dma_demo_dev *dev,
 	pr_info("dma_demo: synced streaming buffer for device\n");
 }
 
+/*
+ * Descriptor ring
+ */
+
+static int dma_demo_ring_init(struct dma_demo_dev *dev)
+{
+	struct dma_demo_ring *ring = &dev->ring;
+	unsigned int i;
+
+	ring->size = ring_size;
+	ring->streaming = ring_streaming;
+	mutex_init(&ring->lock);
+
+	ring->descs = dma_alloc_coherent(dev->dev,
+					 ring->size * sizeof(*ring->descs),
+					 &ring->descs_dma, GFP_KERNEL);
+	if (!ring->descs)
+		return -ENOMEM;
+
+	ring->bufs = kcalloc(ring->size, sizeof(*ring->bufs), GFP_KERNEL);
+	ring->buf_dma = kcalloc(ring->size, sizeof(*ring->buf_dma), GFP_KERNEL);
+	if (!ring->bufs || !ring->buf_dma)
+		return -ENOMEM;
+
+	if (!ring->streaming) {
+		/* Many equal, small, coherent buffers: what dma_pool is for */
+		ring->pool = dma_pool_create("dma_demo_ring", dev->dev,
+					     ring_buf_size,
+					     dma_get_cache_alignment(), 0);
+		if (!ring->pool)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < ring->size; i++) {
+		if (ring->pool) {
+			ring->bufs[i] = dma_pool_alloc(ring->pool, GFP_KERNEL,
+						       &ring->buf_dma[i]);
+			if (!ring->bufs[i])
+				return -ENOMEM;
+			continue;
+		}
+
+		/* Streaming: map once here, only sync on each use */
+		ring->bufs[i] = kmalloc(ring_buf_size, GFP_KERNEL);
+		if (!ring->bufs[i])
+			return -ENOMEM;
+
+		ring->buf_dma[i] = dma_map_single(dev->dev, ring->bufs[i],
+						  ring_buf_size, DMA_TO_DEVICE);
+		if (dma_mapping_error(dev->dev, ring->buf_dma[i])) {
+			kfree(ring->bufs[i]);
+			ring->bufs[i] = NULL;
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/* Also unwinds a partially initialized ring */
+static void dma_demo_ring_free(struct dma_demo_dev *dev)
+{
+	struct dma_demo_ring *ring = &dev->ring;
+	unsigned int i;
+
+	for (i = 0; ring->bufs && i < ring->size; i++) {
+		if (!ring->bufs[i])
+			break;
+
+		if (ring->pool) {
+			dma_pool_free(ring->pool, ring->bufs[i],
+				      ring->buf_dma[i]);
+		} else {
+			dma_unmap_single(dev->dev, ring->buf_dma[i],
+					 ring_buf_size, DMA_TO_DEVICE);
+			kfree(ring->bufs[i]);
+		}
+	}
+
+	dma_pool_destroy(ring->pool);
+	kfree(ring->buf_dma);
+	kfree(ring->bufs);
+
+	if (ring->descs)
+		dma_free_coherent(dev->dev, ring->size * sizeof(*ring->descs),
+				  ring->descs, ring->descs_dma);
+}
+
+static bool dma_demo_ring_full(struct dma_demo_ring *ring)
+{
+	return ring->head - ring->tail == ring->size;
+}
+
+/* CPU side: fill the next free buffer and hand its descriptor over */
+static int dma_demo_ring_submit(struct dma_demo_dev *dev, unsigned int len)
+{
+	struct dma_demo_ring *ring = &dev->ring;
+	unsigned int slot = ring->head & (ring->size - 1);
+	struct dma_demo_desc *desc = &ring->descs[slot];
+
+	lockdep_assert_held(&ring->lock);
+
+	if (dma_demo_ring_full(ring)) {
+		ring->ring_full++;
+		return -ENOSPC;
+	}
+
+	/* Take the recycled buffer back from the device before writing */
+	if (ring->streaming)
+		dma_sync_single_for_cpu(dev->dev, ring->buf_dma[slot], len,
+					DMA_TO_DEVICE);
+
+	memset(ring->bufs[slot], ring->head & 0xff, len);
+
+	if (ring->streaming)
+		dma_sync_single_for_device(dev->dev, ring->buf_dma[slot], len,
+					   DMA_TO_DEVICE);
+
+	desc->addr = cpu_to_le64(ring->buf_dma[slot]);
+	desc->len = cpu_to_le32(len);
+	desc->status = 0;
+
+	/* Descriptor contents must be visible before the device owns it */
+	dma_wmb();
+	WRITE_ONCE(desc->flags, cpu_to_le32(DESC_OWN));
+
+	ring->head++;
+	ring->submitted++;
+
+	return 0;
+}
+
+/*
+ * Simulated device: consume owned descriptors in order, "read" each
+ * buffer (CRC32 it), post the result and flip OWN to DONE.
+ */
+static void dma_demo_device_process(struct dma_demo_dev *dev)
+{
+	struct dma_demo_ring *ring = &dev->ring;
+
+	lockdep_assert_held(&ring->lock);
+
+	for (;;) {
+		unsigned int slot = ring->dev_idx & (ring->size - 1);
+		struct dma_demo_desc *desc = &ring->descs[slot];
+		u32 len;
+
+		if (!(le32_to_cpu(READ_ONCE(desc->flags)) & DESC_OWN))
+			break;
+
+		/* Don't read the descriptor body before seeing OWN */
+		dma_rmb();
+		len = le32_to_cpu(desc->len);
+		desc->status = cpu_to_le32(crc32_le(~0, ring->bufs[slot], len));
+
+		dma_wmb();
+		WRITE_ONCE(desc->flags, cpu_to_le32(DESC_DONE));
+		ring->dev_idx++;
+	}
+}
+
+/* CPU side: reclaim completed descriptors, the bottom of a NAPI poll */
+static unsigned int dma_demo_ring_reap(struct dma_demo_dev *dev)
+{
+	struct dma_demo_ring *ring = &dev->ring;
+	unsigned int done = 0;
+
+	lockdep_assert_held(&ring->lock);
+
+	while (ring->tail != ring->head) {
+		unsigned int slot = ring->tail & (ring->size - 1);
+		struct dma_demo_desc *desc = &ring->descs[slot];
+
+		if (!(le32_to_cpu(READ_ONCE(desc->flags)) & DESC_DONE))
+			break;
+
+		/* Status was written before DONE; read it after */
+		dma_rmb();
+		ring->bytes += le32_to_cpu(desc->len);
+		desc->flags = 0;
+
+		ring->tail++;
+		ring->completed++;
+		done++;
+	}
+
+	return done;
+}
+
+/* Doorbell write: the device runs asynchronously, then "interrupts" */
+static void dma_demo_doorbell_work(struct work_struct *work)
+{
+	struct dma_demo_dev *dev = container_of(work, struct dma_demo_dev,
+						ring.doorbell);
+
+	mutex_lock(&dev->ring.lock);
+	dma_demo_device_process(dev);
+	dma_demo_ring_reap(dev);
+	mutex_unlock(&dev->ring.lock);
+}
+
+static int dma_demo_ring_submit_batch(struct dma_demo_dev *dev,
+				      unsigned int count, unsigned int len)
+{
+	unsigned int i;
+	int ret = 0;
+
+	mutex_lock(&dev->ring.lock);
+	for (i = 0; i < count; i++) {
+		ret = dma_demo_ring_submit(dev, len);
+		if (ret)
+			break;
+	}
+	mutex_unlock(&dev->ring.lock);
+
+	/* One doorbell for the whole batch */
+	if (i)
+		schedule_work(&dev->ring.doorbell);
+
+	pr_info("dma_demo: submitted %u/%u descriptors of %u bytes\n",
+		i, count, len);
+
+	return ret;
+}
+
+/*
+ * Push @iters buffers of @len bytes through the ring, then through the
+ * map/unmap-per-operation path, and record the time of each. Both do
+ * the same CPU fill and device CRC, so the difference is the cost of
+ * remapping versus recycling.
+ */
+static void dma_demo_bench_run(struct dma_demo_dev *dev, unsigned int iters,
+			       unsigned int len)
+{
+	struct dma_demo_ring *ring = &dev->ring;
+	struct dma_demo_bench res = {};
+	unsigned int i;
+	void *buf;
+	u64 start;
+
+	iters = min_t(unsigned int, iters, BENCH_ITERS_MAX);
+
+	buf = kmalloc(len, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	flush_work(&ring->doorbell);
+
+	/*
+	 * Each time the ring fills, drop the lock so other users get in and
+	 * this can reschedule, then drain it, including anything they queued.
+	 */
+	start = ktime_get_ns();
+	mutex_lock(&ring->lock);
+	for (i = 0; i < iters; i++) {
+		if (dma_demo_ring_full(ring)) {
+			mutex_unlock(&ring->lock);
+			cond_resched();
+			mutex_lock(&ring->lock);
+			dma_demo_device_process(dev);
+			dma_demo_ring_reap(dev);
+		}
+		if (dma_demo_ring_submit(dev, len))
+			break;
+	}
+	dma_demo_device_process(dev);
+	dma_demo_ring_reap(dev);
+	mutex_unlock(&ring->lock);
+	res.ring_ns = ktime_get_ns() - start;
+	res.iters = i;
+
+	/* Private buffer: the ring lock isn't needed here */
+	start = ktime_get_ns();
+	for (i = 0; i < res.iters; i++) {
+		dma_addr_t dma;
+
+		memset(buf, i & 0xff, len);
+		dma = dma_map_single(dev->dev, buf, len, DMA_TO_DEVICE);
+		if (dma_mapping_error(dev->dev, dma))
+			break;
+		crc32_le(~0, buf, len);
+		dma_unmap_single(dev->dev, dma, len, DMA_TO_DEVICE);
+
+		if (!(i & 255))
+			cond_resched();
+	}
+	res.map_ns = ktime_get_ns() - start;
+	kfree(buf);
+
+	res.len = len;
+	mutex_lock(&dev->bench_lock);
+	dev->bench = res;
+	mutex_unlock(&dev->bench_lock);
+
+	pr_info("dma_demo: bench %u x %u bytes: ring %llu ns, map/unmap %llu ns\n",
+		res.iters, len, res.ring_ns, res.map_ns);
+}
+
+/*
+ * Scatter-gather: @npages separate pages, mapped and unmapped as one
+ * table per iteration. The simulated device walks the DMA segments.
+ */
+static int dma_demo_sg_bench(struct dma_demo_dev *dev, unsigned int npages,
+			     unsigned int iters)
+{
+	struct dma_demo_sg_result *res = &dev->sg;
+	struct scatterlist *sg;
+	struct page **pages;
+	struct sg_table sgt;
+	unsigned int i, j, nents = 0;
+	u64 start, t0, map_ns = 0, bytes = 0;
+	int ret;
+
+	pages = kcalloc(npages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < npages; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out_pages;
+		}
+		memset(page_address(pages[i]), i & 0xff, PAGE_SIZE);
+	}
+
+	ret = sg_alloc_table(&sgt, npages, GFP_KERNEL);
+	if (ret)
+		goto out_pages;
+
+	for_each_sgtable_sg(&sgt, sg, i)
+		sg_set_page(sg, pages[i], PAGE_SIZE, 0);
+
+	iters = min_t(unsigned int, iters, SG_ITERS_MAX);
+
+	start = ktime_get_ns();
+	for (i = 0; i < iters; i++) {
+		t0 = ktime_get_ns();
+		ret = dma_map_sgtable(dev->dev, &sgt, DMA_TO_DEVICE, 0);
+		if (ret)
+			break;
+		map_ns += ktime_get_ns() - t0;
+		nents = sgt.nents;
+
+		/* Device side: one burst per (possibly merged) DMA segment */
+		for_each_sgtable_dma_sg(&sgt, sg, j)
+			bytes += sg_dma_len(sg);
+
+		/* The data movement itself, done by the CPU here */
+		for_each_sgtable_sg(&sgt, sg, j)
+			crc32_le(~0, sg_virt(sg), sg->length);
+
+		t0 = ktime_get_ns();
+		dma_unmap_sgtable(dev->dev, &sgt, DMA_TO_DEVICE, 0);
+		map_ns += ktime_get_ns() - t0;
+
+		/* Up to 16 MB crc'd per iteration; let others run */
+		cond_resched();
+	}
+
+	mutex_lock(&dev->bench_lock);
+	res->pages = npages;
+	res->nents = nents;
+	res->iters = i;
+	res->map_ns = map_ns;
+	res->total_ns = ktime_get_ns() - start;
+	mutex_unlock(&dev->bench_lock);
+
+	pr_info("dma_demo: sg %u pages -> %u segments, %u iters, %llu bytes\n",
+		npages, nents, i, bytes);
+
+	sg_free_table(&sgt);
+out_pages:
+	for (i = 0; i < npages && pages[i]; i++)
+		__free_page(pages[i]);
+	kfree(pages);
+	return ret;
+}
+
+/*
+ * dmaengine completion callback, runs from the channel's tasklet.
+ * complete() is its only access to the waiter's stack: once the waiter
+ * has consumed that completion it may return, so nothing may follow.
+ */
+static void dma_demo_copy_done(void *param)
+{
+	complete(param);
+}
+
+/*
+ * Run @iters asynchronous copies of @len bytes with up to @depth in
+ * flight. Each finished copy posts one completion; the loop consumes
+ * one before reusing a slot. Returns elapsed ns, or a negative errno.
+ */
+static s64 dma_demo_dmaengine_copy(struct dma_chan *chan, dma_addr_t dst,
+				   dma_addr_t src, size_t len,
+				   unsigned int iters, unsigned int depth)
+{
+	struct completion done;
+	unsigned int i, inflight = 0;
+	u64 start;
+	int ret = 0;
+
+	init_completion(&done);
+
+	start = ktime_get_ns();
+	for (i = 0; i < iters; i++) {
+		struct dma_async_tx_descriptor *tx;
+		dma_cookie_t cookie;
+
+		if (inflight == depth) {
+			if (!wait_for_completion_timeout(&done, COPY_TIMEOUT)) {
+				ret = -ETIMEDOUT;
+				break;
+			}
+			inflight--;
+		}
+
+		tx = dmaengine_prep_dma_memcpy(chan, dst, src, len,
+					       DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+		if (!tx) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		tx->callback = dma_demo_copy_done;
+		tx->callback_param = &done;
+
+		cookie = dmaengine_submit(tx);
+		if (dma_submit_error(cookie)) {
+			ret = -EIO;
+			break;
+		}
+		inflight++;
+		dma_async_issue_pending(chan);
+	}
+
+	/* done lives on our stack: every callback must have run by return */
+	while (inflight && ret != -ETIMEDOUT) {
+		if (!wait_for_completion_timeout(&done, COPY_TIMEOUT))
+			ret = -ETIMEDOUT;
+		else
+			inflight--;
+	}
+	/* Stuck engine: abort what is left and wait out a running callback */
+	if (inflight)
+		dmaengine_terminate_sync(chan);
+
+	return ret ? ret : (s64)(ktime_get_ns() - start);
+}
+
+/*
+ * CPU memcpy vs dmaengine memcpy for each of copy_sizes[]. The engine
+ * is asked for once per run and released afterwards; without one only
+ * the CPU column is filled in. The CPU column is measured first, while
+ * the buffers still belong to the CPU: once mapped for the engine they
+ * must not be touched until they are unmapped.
+ */
+static int dma_demo_copy_bench(struct dma_demo_dev *dev, unsigned int iters)
+{
+	struct dma_demo_copy_result res[ARRAY_SIZE(copy_sizes)] = {};
+	struct dma_chan *chan;
+	dma_cap_mask_t mask;
+	struct device *dma_dev = NULL;
+	dma_addr_t src_dma = 0, dst_dma = 0;
+	unsigned int order = get_order(COPY_SIZE_MAX);
+	void *src, *dst;
+	unsigned int i, j;
+	u64 start;
+	s64 ns;
+	int ret = 0;
+
+	src = (void *)__get_free_pages(GFP_KERNEL, order);
+	dst = (void *)__get_free_pages(GFP_KERNEL, order);
+	if (!src || !dst) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	memset(src, 0xa5, COPY_SIZE_MAX);
+	memset(dst, 0, COPY_SIZE_MAX);
+
+	for (i = 0; i < ARRAY_SIZE(copy_sizes); i++) {
+		unsigned int len = copy_sizes[i];
+		unsigned int n = clamp_t(unsigned int,
+					 COPY_BYTES_PER_SIZE / len, 1, iters);
+
+		res[i].iters = n;
+
+		start = ktime_get_ns();
+		for (j = 0; j < n; j++)
+			memcpy(dst, src, len);
+		res[i].cpu_ns = div64_u64(ktime_get_ns() - start, n);
+		cond_resched();
+	}
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	chan = dma_request_chan_by_mask(&mask);
+	if (IS_ERR(chan)) {
+		pr_info("dma_demo: no dmaengine memcpy channel, CPU only\n");
+		chan = NULL;
+	} else {
+		/* Buffers must be mapped for the engine, not for our device */
+		dma_dev = chan->device->dev;
+		src_dma = dma_map_single(dma_dev, src, COPY_SIZE_MAX,
+					 DMA_TO_DEVICE);
+		dst_dma = dma_map_single(dma_dev, dst, COPY_SIZE_MAX,
+					 DMA_FROM_DEVICE);
+		if (dma_mapping_error(dma_dev, src_dma) ||
+		    dma_mapping_error(dma_dev, dst_dma)) {
+			ret = -ENOMEM;
+			goto out_unmap;
+		}
+	}
+
+	/* From here until unmap, src and dst belong to the engine */
+	for (i = 0; chan && i < ARRAY_SIZE(copy_sizes); i++) {
+		unsigned int len = copy_sizes[i];
+		unsigned int n = res[i].iters;
+
+		if (!is_dma_copy_aligned(chan->device, 0, 0, len))
+			continue;
+
+		ns = dma_demo_dmaengine_copy(chan, dst_dma, src_dma, len, n, 1);
+		if (ns > 0)
+			res[i].dma_lat_ns = div64_u64(ns, n);
+
+		ns = dma_demo_dmaengine_copy(chan, dst_dma, src_dma, len, n,
+					     COPY_QUEUE_DEPTH);
+		if (ns > 0)
+			res[i].dma_tput_ns = div64_u64(ns, n);
+	}
+
+	mutex_lock(&dev->bench_lock);
+	memcpy(dev->copy, res, sizeof(res));
+	strscpy(dev->copy_chan, chan ? dma_chan_name(chan) : "",
+		sizeof(dev->copy_chan));
+	dev->copy_valid = true;
+	mutex_unlock(&dev->bench_lock);
+
+out_unmap:
+	if (chan) {
+		if (!dma_mapping_error(dma_dev, dst_dma))
+			dma_unmap_single(dma_dev, dst_dma, COPY_SIZE_MAX,
+					 DMA_FROM_DEVICE);
+		if (!dma_mapping_error(dma_dev, src_dma))
+			dma_unmap_single(dma_dev, src_dma, COPY_SIZE_MAX,
+					 DMA_TO_DEVICE);
+		dma_release_channel(chan);
+	}
+out_free:
+	free_pages((unsigned long)dst, order);
+	free_pages((unsigned long)src, order);
+	return ret;
+}
+
+static u64 mbps(u64 bytes, u64 ns)
+{
+	return ns ? div64_u64(bytes * NSEC_PER_USEC, ns) : 0;
+}
+
+static void bench_show(struct seq_file *m, const char *name, u64 ns,
+		       const struct dma_demo_bench *bench)
+{
+	u64 bytes = (u64)bench->iters * bench->len;
+
+	seq_printf(m, "  %-12s %8llu ns/op  %8llu MB/s\n", name,
+		   div64_u64(ns, bench->iters), mbps(bytes, ns));
+}
+
 /* Proc file interface */
 static int stats_show(struct seq_file *m, void *v)
 {
 	struct dma_demo_dev *dev = demo_dev;
+	unsigned int i;
 
 	seq_printf(m, "DMA Demo Statistics\n");
 	seq_printf(m, "===================\n\n");
@@ -205,6 +898,62 @@ static int stats_show(struct seq_file *m, void *v)
 	seq_printf(m, "  Total maps:   %lu\n", dev->streaming_maps);
 	seq_printf(m, "  Total unmaps: %lu\n", dev->streaming_unmaps);
 
+	mutex_lock(&dev->ring.lock);
+	seq_printf(m, "\nDescriptor Ring:\n");
+	seq_printf(m, "  Descriptors:  %u at dma=%pad\n", dev->ring.size,
+		   &dev->ring.descs_dma);
+	seq_printf(m, "  Buffers:      %u x %u bytes (%s)\n", dev->ring.size,
+		   ring_buf_size,
+		   dev->ring.streaming ? "mapped once" : "dma_pool");
+	seq_printf(m, "  Head/tail:    %u/%u (%u in flight)\n", dev->ring.head,
+		   dev->ring.tail, dev->ring.head - dev->ring.tail);
+	seq_printf(m, "  Submitted:    %lu\n", dev->ring.submitted);
+	seq_printf(m, "  Completed:    %lu\n", dev->ring.completed);
+	seq_printf(m, "  Ring full:    %lu\n", dev->ring.ring_full);
+	seq_printf(m, "  Bytes:        %llu\n", dev->ring.bytes);
+	mutex_unlock(&dev->ring.lock);
+
+	mutex_lock(&dev->bench_lock);
+	if (dev->bench.iters) {
+		seq_printf(m, "\nLast Benchmark (%u x %u bytes):\n",
+			   dev->bench.iters, dev->bench.len);
+		bench_show(m, "ring:", dev->bench.ring_ns, &dev->bench);
+		bench_show(m, "map/unmap:", dev->bench.map_ns, &dev->bench);
+	}
+
+	if (dev->sg.iters) {
+		struct dma_demo_sg_result *sg = &dev->sg;
+
+		seq_printf(m, "\nScatter-Gather (%u pages, %u iters):\n",
+			   sg->pages, sg->iters);
+		seq_printf(m, "  Segments:     %u -> %u after mapping\n",
+			   sg->pages, sg->nents);
+		seq_printf(m, "  Map+unmap:    %llu ns/op\n",
+			   div64_u64(sg->map_ns, sg->iters));
+		seq_printf(m, "  Transfer:     %llu ns/op  %llu MB/s\n",
+			   div64_u64(sg->total_ns, sg->iters),
+			   mbps((u64)sg->iters * sg->pages * PAGE_SIZE,
+				sg->total_ns));
+	}
+
+	if (dev->copy_valid) {
+		seq_printf(m, "\nMemcpy Benchmark (dmaengine: %s):\n",
+			   dev->copy_chan[0] ? dev->copy_chan : "none");
+		seq_printf(m, "  %8s %10s %9s %10s %12s %9s\n", "size",
+			   "cpu ns", "cpu MB/s", "dma lat ns", "dma qd ns/op",
+			   "dma MB/s");
+		for (i = 0; i < ARRAY_SIZE(copy_sizes); i++) {
+			struct dma_demo_copy_result *c = &dev->copy[i];
+
+			seq_printf(m, "  %8u %10llu %9llu %10llu %12llu %9llu\n",
+				   copy_sizes[i], c->cpu_ns,
+				   mbps(copy_sizes[i], c->cpu_ns),
+				   c->dma_lat_ns, c->dma_tput_ns,
+				   mbps(copy_sizes[i], c->dma_tput_ns));
+		}
+	}
+	mutex_unlock(&dev->bench_lock);
+
 	seq_printf(m, "\nCommands:\n");
 	seq_printf(m, "  cwrite <data>  - Write to coherent buffer\n");
 	seq_printf(m, "  cread          - Read from coherent buffer\n");
@@ -212,6 +961,10 @@ static int stats_show(struct seq_file *m, void *v)
 	seq_printf(m, "  smap_from      - Map streaming for FROM_DEVICE\n");
 	seq_printf(m, "  sunmap_to      - Unmap streaming (TO_DEVICE)\n");
 	seq_printf(m, "  sunmap_from    - Unmap streaming (FROM_DEVICE)\n");
+	seq_printf(m, "  ring_submit <n> <len> - Queue n buffers on the ring\n");
+	seq_printf(m, "  bench <n> <len>       - Ring vs map/unmap per buffer\n");
+	seq_printf(m, "  sg_bench <pages> <n>  - Map a page list as one sg table\n");
+	seq_printf(m, "  memcpy_bench <n>      - CPU vs dmaengine memcpy, 256B..1MiB\n");
 
 	return 0;
 }
@@ -228,12 +981,13 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 	char cmd[128];
 	char data[64];
 	size_t len = min(count, sizeof(cmd) - 1);
+	unsigned int n, size, iters;
 
 	if (copy_from_user(cmd, buf, len))
 		return -EFAULT;
 	cmd[len] = '\0';
 
-	if (cmd[len - 1] == '\n')
+	if (len > 0 && cmd[len - 1] == '\n')
 		cmd[len - 1] = '\0';
 
 	if (sscanf(cmd, "cwrite %63s", data) == 1) {
@@ -253,6 +1007,22 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 		sync_streaming_for_cpu(dev, DMA_FROM_DEVICE);
 	} else if (strcmp(cmd, "sync_dev") == 0) {
 		sync_streaming_for_device(dev, DMA_TO_DEVICE);
+	} else if (sscanf(cmd, "ring_submit %u %u", &n, &size) == 2) {
+		if (!size || size > ring_buf_size)
+			return -EINVAL;
+		dma_demo_ring_submit_batch(dev, n, size);
+	} else if (sscanf(cmd, "bench %u %u", &n, &size) == 2) {
+		if (!n || !size || size > ring_buf_size)
+			return -EINVAL;
+		dma_demo_bench_run(dev, n, size);
+	} else if (sscanf(cmd, "sg_bench %u %u", &n, &iters) == 2) {
+		if (!n || n > SG_PAGES_MAX || !iters)
+			return -EINVAL;
+		dma_demo_sg_bench(dev, n, iters);
+	} else if (sscanf(cmd, "memcpy_bench %u", &n) == 1) {
+		if (!n)
+			return -EINVAL;
+		dma_demo_copy_bench(dev, n);
 	} else {
 		pr_warn("dma_demo: unknown command: %s\n", cmd);
 	}
@@ -290,6 +1060,13 @@ static int dma_demo_probe(struct platform_device *platform_dev)
 		return ret;
 	}
 
+	if (!is_power_of_2(ring_size) || ring_size > RING_SIZE_MAX ||
+	    !ring_buf_size || ring_buf_size > RING_BUF_SIZE_MAX) {
+		dev_err(dev, "ring_size must be a power of two <= %u, ring_buf_size 1..%u\n",
+			RING_SIZE_MAX, RING_BUF_SIZE_MAX);
+		return -EINVAL;
+	}
+
 	/* Allocate coherent DMA buffer */
 	demo_dev->coherent_buf = dma_alloc_coherent(dev, COHERENT_BUFFER_SIZE,
 						    &demo_dev->coherent_dma,
@@ -302,17 +1079,25 @@ static int dma_demo_probe(struct platform_device *platform_dev)
 	/* Allocate regular buffer for streaming DMA */
 	demo_dev->streaming_buf = devm_kmalloc(dev, DMA_BUFFER_SIZE, GFP_KERNEL);
 	if (!demo_dev->streaming_buf) {
-		dma_free_coherent(dev, COHERENT_BUFFER_SIZE,
-				  demo_dev->coherent_buf, demo_dev->coherent_dma);
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto err_coherent;
+	}
+
+	mutex_init(&demo_dev->bench_lock);
+
+	/* Descriptor ring and its recycled buffers */
+	INIT_WORK(&demo_dev->ring.doorbell, dma_demo_doorbell_work);
+	ret = dma_demo_ring_init(demo_dev);
+	if (ret) {
+		dev_err(dev, "Failed to set up descriptor ring\n");
+		goto err_ring;
 	}
 
 	/* Create proc entry */
 	proc_entry = proc_create("dma_demo", 0666, NULL, &stats_proc_ops);
 	if (!proc_entry) {
-		dma_free_coherent(dev, COHERENT_BUFFER_SIZE,
-				  demo_dev->coherent_buf, demo_dev->coherent_dma);
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto err_ring;
 	}
 
 	platform_set_drvdata(platform_dev, demo_dev);
@@ -320,8 +1105,17 @@ static int dma_demo_probe(struct platform_device *platform_dev)
 	dev_info(dev, "DMA demo initialized\n");
 	dev_info(dev, "Coherent buffer at cpu=%p dma=%pad\n",
 		 demo_dev->coherent_buf, &demo_dev->coherent_dma);
+	dev_info(dev, "Descriptor ring: %u x %u bytes (%s)\n", ring_size,
+		 ring_buf_size, ring_streaming ? "mapped once" : "dma_pool");
 
 	return 0;
+
+err_ring:
+	dma_demo_ring_free(demo_dev);
+err_coherent:
+	dma_free_coherent(dev, COHERENT_BUFFER_SIZE,
+			  demo_dev->coherent_buf, demo_dev->coherent_dma);
+	return ret;
 }
 
 static int dma_demo_remove(struct platform_device *platform_dev)
@@ -332,6 +1126,9 @@ static int dma_demo_remove(struct platform_device *platform_dev)
 
 	proc_remove(proc_entry);
 
+	cancel_work_sync(&dev->ring.doorbell);
+	dma_demo_ring_free(dev);
+
 	if (dev->streaming_mapped)
 		dma_unmap_single(dev->dev, dev->streaming_dma,
 				 DMA_BUFFER_SIZE, DMA_BIDIRECTIONAL);
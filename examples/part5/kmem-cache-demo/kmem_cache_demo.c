@@ -6,6 +6,8 @@
  * - Creating a custom kmem_cache
  * - Object constructor
  * - Allocating/freeing objects
+ * - Lockless RCU hashtable lookup with striped writer locks
+ * - Allocator microbenchmark: kmem_cache vs kmalloc vs mempool vs bulk
  * - Cache statistics via /proc
  */
 
@@ -14,12 +16,39 @@
 #include <linux/list.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/hashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/kthread.h>
+#include <linux/mempool.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/cpumask.h>
 
 #define CACHE_NAME "demo_objects"
 #define MAX_OBJECTS 100
 
+/*
+ * Objects are indexed by id in a hashtable. Lookups walk a bucket
+ * under rcu_read_lock() only; inserts and removals take one of
+ * 1 << OBJECT_LOCK_BITS striped locks, so writers to different
+ * buckets don't contend either. Freed objects wait out a grace
+ * period (call_rcu).
+ */
+#define OBJECT_HASH_BITS 12
+#define OBJECT_LOCK_BITS 6
+
+/* Benchmark: per-thread op count, objects held live per round */
+#define BENCH_DEF_OPS 100000
+#define BENCH_MAX_OPS 10000000
+#define BENCH_DEF_BATCH 16
+#define BENCH_MAX_BATCH 256
+#define BENCH_POOL_MIN 16
+#define BENCH_MAX_STEPS 16
+
 struct demo_object {
-	struct list_head list;
+	struct hlist_node node;
+	struct rcu_head rcu;
 	spinlock_t lock;
 	int id;
 	unsigned long created_at;
@@ -28,11 +57,18 @@ struct demo_object {
 };
 
 static struct kmem_cache *object_cache;
-static LIST_HEAD(object_list);
-static DEFINE_SPINLOCK(list_lock);
+static DEFINE_HASHTABLE(object_table, OBJECT_HASH_BITS);
+static spinlock_t object_locks[1 << OBJECT_LOCK_BITS];
 static atomic_t total_allocated = ATOMIC_INIT(0);
 static atomic_t total_freed = ATOMIC_INIT(0);
-static int next_id;
+static atomic_t next_id = ATOMIC_INIT(-1);
+
+/* Buckets map onto locks, so a bucket is always covered by one lock */
+static spinlock_t *object_lock(int id)
+{
+	return &object_locks[hash_min(id, OBJECT_HASH_BITS) &
+			     ((1 << OBJECT_LOCK_BITS) - 1)];
+}
 
 /* Constructor - called when slab page is allocated */
 static void object_ctor(void *ptr)
@@ -41,7 +77,7 @@ static void object_ctor(void *ptr)
 
 	/* Initialize fields that stay constant across reuses */
 	spin_lock_init(&obj->lock);
-	INIT_LIST_HEAD(&obj->list);
+	INIT_HLIST_NODE(&obj->node);
 	obj->access_count = 0;
 
 	pr_debug("kmem_cache_demo: constructor called for %p\n", obj);
@@ -57,48 +93,85 @@ static struct demo_object *alloc_object(const char *data)
 		return NULL;
 
 	/* Initialize per-allocation fields */
-	obj->id = next_id++;
+	obj->id = atomic_inc_return(&next_id);
 	obj->created_at = jiffies;
 	strscpy(obj->data, data, sizeof(obj->data));
 	obj->access_count = 0;
 
-	spin_lock(&list_lock);
-	list_add(&obj->list, &object_list);
-	spin_unlock(&list_lock);
+	/* Fully initialized before hash_add_rcu() publishes it */
+	spin_lock(object_lock(obj->id));
+	hash_add_rcu(object_table, &obj->node, obj->id);
+	spin_unlock(object_lock(obj->id));
 
 	atomic_inc(&total_allocated);
 
-	pr_info("kmem_cache_demo: allocated object %d\n", obj->id);
+	pr_debug("kmem_cache_demo: allocated object %d\n", obj->id);
 	return obj;
 }
 
-/* Free an object */
-static void free_object(struct demo_object *obj)
+static void object_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(object_cache, container_of(head, struct demo_object, rcu));
+}
+
+/*
+ * Lockless lookup. The result is only valid inside the caller's
+ * rcu_read_lock() section; it may already be unhashed for freeing.
+ */
+static struct demo_object *find_object(int id)
 {
-	int id = obj->id;
+	struct demo_object *obj;
 
-	spin_lock(&list_lock);
-	list_del(&obj->list);
-	spin_unlock(&list_lock);
+	hash_for_each_possible_rcu(object_table, obj, node, id) {
+		if (obj->id == id)
+			return obj;
+	}
+	return NULL;
+}
 
-	kmem_cache_free(object_cache, obj);
+/* Unhash one object; readers may still see it until the grace period */
+static void unhash_object(struct demo_object *obj)
+{
+	hash_del_rcu(&obj->node);
+	call_rcu(&obj->rcu, object_free_rcu);
 	atomic_inc(&total_freed);
+}
+
+/* Free an object by id */
+static int free_object(int id)
+{
+	spinlock_t *lock = object_lock(id);
+	struct demo_object *obj;
+
+	/* Look up under the writer lock so two frees can't both win */
+	spin_lock(lock);
+	obj = find_object(id);
+	if (obj)
+		unhash_object(obj);
+	spin_unlock(lock);
+
+	if (!obj)
+		return -ENOENT;
 
-	pr_info("kmem_cache_demo: freed object %d\n", id);
+	pr_debug("kmem_cache_demo: freed object %d\n", id);
+	return 0;
 }
 
 /* Free all objects */
 static void free_all_objects(void)
 {
-	struct demo_object *obj, *tmp;
+	struct demo_object *obj;
+	struct hlist_node *tmp;
+	unsigned int bkt;
+
+	for (bkt = 0; bkt < HASH_SIZE(object_table); bkt++) {
+		spinlock_t *lock = &object_locks[bkt & ((1 << OBJECT_LOCK_BITS) - 1)];
 
-	spin_lock(&list_lock);
-	list_for_each_entry_safe(obj, tmp, &object_list, list) {
-		list_del(&obj->list);
-		kmem_cache_free(object_cache, obj);
-		atomic_inc(&total_freed);
+		spin_lock(lock);
+		hlist_for_each_entry_safe(obj, tmp, &object_table[bkt], node)
+			unhash_object(obj);
+		spin_unlock(lock);
 	}
-	spin_unlock(&list_lock);
 }
 
 /* Access an object */
@@ -109,10 +182,312 @@ static void access_object(struct demo_object *obj)
 	spin_unlock(&obj->lock);
 }
 
+/*
+ * Allocator benchmark
+ *
+ * One kthread per CPU, bound to it, allocates @batch objects of
+ * demo_object size and frees them again until @ops objects have gone
+ * through. This is repeated for 1, 2, 4, ... CPUs and for each
+ * allocator, so per-CPU freelist hits and cross-CPU slab contention
+ * show up as the scaling column.
+ */
+enum bench_method {
+	BENCH_KMEM_CACHE,
+	BENCH_KMALLOC,
+	BENCH_MEMPOOL,
+	BENCH_BULK,
+	BENCH_NR_METHODS,
+};
+
+static const char * const bench_names[BENCH_NR_METHODS] = {
+	[BENCH_KMEM_CACHE] = "kmem_cache",
+	[BENCH_KMALLOC] = "kmalloc",
+	[BENCH_MEMPOOL] = "mempool",
+	[BENCH_BULK] = "bulk",
+};
+
+struct bench_run {
+	enum bench_method method;
+	unsigned int ops;
+	unsigned int batch;
+	mempool_t *pool;
+	struct completion start;
+};
+
+struct bench_thread {
+	struct bench_run *run;
+	void **objs;
+	u64 ns;
+	int err;
+	struct completion done;
+};
+
+struct bench_step {
+	unsigned int threads;
+	u64 ns_per_op[BENCH_NR_METHODS];	/* Mean over all threads */
+	u64 ops_per_sec[BENCH_NR_METHODS];	/* Aggregate */
+};
+
+/* Results shown in stats, under bench_lock */
+static DEFINE_MUTEX(bench_lock);
+static struct bench_step bench_steps[BENCH_MAX_STEPS];
+static unsigned int bench_nr_steps;
+static unsigned int bench_ops;
+static unsigned int bench_batch;
+
+static int bench_alloc(struct bench_run *run, void **objs)
+{
+	unsigned int i;
+
+	switch (run->method) {
+	case BENCH_BULK:
+		return kmem_cache_alloc_bulk(object_cache, GFP_KERNEL,
+					     run->batch, objs) ? 0 : -ENOMEM;
+	case BENCH_KMEM_CACHE:
+		for (i = 0; i < run->batch; i++) {
+			objs[i] = kmem_cache_alloc(object_cache, GFP_KERNEL);
+			if (!objs[i])
+				break;
+		}
+		break;
+	case BENCH_KMALLOC:
+		for (i = 0; i < run->batch; i++) {
+			objs[i] = kmalloc(sizeof(struct demo_object), GFP_KERNEL);
+			if (!objs[i])
+				break;
+		}
+		break;
+	case BENCH_MEMPOOL:
+		for (i = 0; i < run->batch; i++) {
+			objs[i] = mempool_alloc(run->pool, GFP_KERNEL);
+			if (!objs[i])
+				break;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (i == run->batch)
+		return 0;
+
+	/* Partial batch: release what we got */
+	while (i--) {
+		if (run->method == BENCH_KMEM_CACHE)
+			kmem_cache_free(object_cache, objs[i]);
+		else if (run->method == BENCH_KMALLOC)
+			kfree(objs[i]);
+		else
+			mempool_free(objs[i], run->pool);
+	}
+	return -ENOMEM;
+}
+
+static void bench_free(struct bench_run *run, void **objs)
+{
+	unsigned int i;
+
+	switch (run->method) {
+	case BENCH_BULK:
+		kmem_cache_free_bulk(object_cache, run->batch, objs);
+		break;
+	case BENCH_KMEM_CACHE:
+		for (i = 0; i < run->batch; i++)
+			kmem_cache_free(object_cache, objs[i]);
+		break;
+	case BENCH_KMALLOC:
+		for (i = 0; i < run->batch; i++)
+			kfree(objs[i]);
+		break;
+	case BENCH_MEMPOOL:
+		for (i = 0; i < run->batch; i++)
+			mempool_free(objs[i], run->pool);
+		break;
+	default:
+		break;
+	}
+}
+
+static int bench_thread_fn(void *arg)
+{
+	struct bench_thread *bt = arg;
+	struct bench_run *run = bt->run;
+	unsigned int done;
+	u64 start;
+
+	wait_for_completion(&run->start);
+
+	start = ktime_get_ns();
+	for (done = 0; done < run->ops; done += run->batch) {
+		bt->err = bench_alloc(run, bt->objs);
+		if (bt->err)
+			break;
+		bench_free(run, bt->objs);
+		cond_resched();
+	}
+	bt->ns = ktime_get_ns() - start;
+
+	/* Signal and exit without returning into module text */
+	kthread_complete_and_exit(&bt->done, 0);
+}
+
+/* Run @method on the first @nr_threads online CPUs */
+static int bench_one(struct bench_step *step, enum bench_method method,
+		     struct bench_thread *threads, unsigned int nr_threads)
+{
+	struct bench_run run = {
+		.method = method,
+		.ops = bench_ops,
+		.batch = bench_batch,
+	};
+	u64 total_ns = 0, max_ns = 0, total_ops;
+	unsigned int i, started = 0, cpu;
+	int ret = 0;
+
+	init_completion(&run.start);
+
+	if (method == BENCH_MEMPOOL) {
+		run.pool = mempool_create_slab_pool(BENCH_POOL_MIN, object_cache);
+		if (!run.pool)
+			return -ENOMEM;
+	}
+
+	for_each_online_cpu(cpu) {
+		struct bench_thread *bt = &threads[started];
+		struct task_struct *task;
+
+		if (started == nr_threads)
+			break;
+
+		bt->run = &run;
+		bt->err = 0;
+		bt->ns = 0;
+		init_completion(&bt->done);
+
+		task = kthread_create(bench_thread_fn, bt, "kmem_bench/%u", cpu);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			break;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		started++;
+	}
+
+	/* Release all threads at once, then wait for every started one */
+	complete_all(&run.start);
+	for (i = 0; i < started; i++) {
+		wait_for_completion(&threads[i].done);
+		if (threads[i].err && !ret)
+			ret = threads[i].err;
+		total_ns += threads[i].ns;
+		max_ns = max(max_ns, threads[i].ns);
+	}
+
+	mempool_destroy(run.pool);
+
+	if (ret)
+		return ret;
+
+	/* Each thread rounds its op count up to whole batches */
+	total_ops = (u64)roundup(bench_ops, bench_batch) * started;
+	step->ns_per_op[method] = div64_u64(total_ns, total_ops);
+	step->ops_per_sec[method] = max_ns ?
+		mul_u64_u64_div_u64(total_ops, NSEC_PER_SEC, max_ns) : 0;
+	return 0;
+}
+
+static int run_bench(unsigned int ops, unsigned int batch)
+{
+	unsigned int ncpus = num_online_cpus();
+	struct bench_thread *threads;
+	unsigned int n, i, steps = 0;
+	enum bench_method method;
+	int ret = 0;
+
+	threads = kcalloc(ncpus, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < ncpus; i++) {
+		threads[i].objs = kcalloc(batch, sizeof(void *), GFP_KERNEL);
+		if (!threads[i].objs) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	mutex_lock(&bench_lock);
+	bench_ops = ops;
+	bench_batch = batch;
+	memset(bench_steps, 0, sizeof(bench_steps));
+
+	/* 1, 2, 4, ... CPUs, always finishing with all of them */
+	for (n = 1; steps < BENCH_MAX_STEPS; n = min(n * 2, ncpus)) {
+		struct bench_step *step = &bench_steps[steps++];
+
+		step->threads = n;
+		for (method = 0; method < BENCH_NR_METHODS; method++) {
+			ret = bench_one(step, method, threads, n);
+			if (ret)
+				break;
+		}
+		if (ret || n == ncpus)
+			break;
+	}
+	bench_nr_steps = ret ? 0 : steps;
+	mutex_unlock(&bench_lock);
+
+	if (!ret)
+		pr_info("kmem_cache_demo: benchmark done, %u ops x %u CPU counts\n",
+			ops, steps);
+out:
+	for (i = 0; i < ncpus; i++)
+		kfree(threads[i].objs);
+	kfree(threads);
+	return ret;
+}
+
+static void show_bench(struct seq_file *m)
+{
+	enum bench_method method;
+	unsigned int i;
+
+	mutex_lock(&bench_lock);
+	if (!bench_nr_steps)
+		goto out;
+
+	seq_printf(m, "\nAllocator Benchmark (%u ops/thread, batch %u, %zu-byte objects):\n",
+		   bench_ops, bench_batch, sizeof(struct demo_object));
+	seq_printf(m, "  %-4s", "CPUs");
+	for (method = 0; method < BENCH_NR_METHODS; method++)
+		seq_printf(m, " %17s", bench_names[method]);
+	seq_printf(m, "\n");
+
+	for (i = 0; i < bench_nr_steps; i++) {
+		struct bench_step *step = &bench_steps[i];
+
+		seq_printf(m, "  %4u", step->threads);
+		for (method = 0; method < BENCH_NR_METHODS; method++) {
+			u64 base = bench_steps[0].ops_per_sec[method];
+			u32 scale = base ?
+				div64_u64(step->ops_per_sec[method] * 100, base) : 0;
+
+			seq_printf(m, " %5llu ns %3u.%02ux",
+				   step->ns_per_op[method], scale / 100, scale % 100);
+		}
+		seq_printf(m, "\n");
+	}
+	seq_printf(m, "  (ns per alloc+free pair; scaling = aggregate throughput vs 1 CPU)\n");
+out:
+	mutex_unlock(&bench_lock);
+}
+
 /* Proc file interface */
 static int stats_show(struct seq_file *m, void *v)
 {
 	struct demo_object *obj;
+	unsigned int bkt;
 	int count = 0;
 
 	seq_printf(m, "Slab Cache Demo Statistics\n");
@@ -126,24 +501,28 @@ static int stats_show(struct seq_file *m, void *v)
 
 	seq_printf(m, "\nActive Objects:\n");
 
-	spin_lock(&list_lock);
-	list_for_each_entry(obj, &object_list, list) {
-		seq_printf(m, "  [%d] data='%s' age=%lu ms accesses=%lu\n",
+	rcu_read_lock();
+	hash_for_each_rcu(object_table, bkt, obj, node) {
+		seq_printf(m, "  [%d] data='%s' age=%u ms accesses=%lu\n",
 			   obj->id, obj->data,
 			   jiffies_to_msecs(jiffies - obj->created_at),
-			   obj->access_count);
+			   READ_ONCE(obj->access_count));
 		count++;
 	}
-	spin_unlock(&list_lock);
+	rcu_read_unlock();
 
 	if (count == 0)
 		seq_printf(m, "  (none)\n");
 
+	show_bench(m);
+
 	seq_printf(m, "\nCommands:\n");
 	seq_printf(m, "  alloc <data> - Allocate new object\n");
 	seq_printf(m, "  free <id>    - Free object by ID\n");
 	seq_printf(m, "  access <id>  - Increment access count\n");
 	seq_printf(m, "  freeall      - Free all objects\n");
+	seq_printf(m, "  bench [ops] [batch] - Allocator benchmark on 1..%u CPUs\n",
+		   num_online_cpus());
 
 	return 0;
 }
@@ -153,23 +532,13 @@ static int stats_open(struct inode *inode, struct file *file)
 	return single_open(file, stats_show, NULL);
 }
 
-static struct demo_object *find_object(int id)
-{
-	struct demo_object *obj;
-
-	list_for_each_entry(obj, &object_list, list) {
-		if (obj->id == id)
-			return obj;
-	}
-	return NULL;
-}
-
 static ssize_t stats_write(struct file *file, const char __user *buf,
 			   size_t count, loff_t *ppos)
 {
 	char cmd[64];
 	char data[32];
-	int id;
+	unsigned int ops = BENCH_DEF_OPS, batch = BENCH_DEF_BATCH;
+	int id, ret;
 	size_t len = min(count, sizeof(cmd) - 1);
 	struct demo_object *obj;
 
@@ -177,7 +546,7 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 		return -EFAULT;
 	cmd[len] = '\0';
 
-	if (cmd[len - 1] == '\n')
+	if (len > 0 && cmd[len - 1] == '\n')
 		cmd[len - 1] = '\0';
 
 	if (sscanf(cmd, "alloc %31s", data) == 1) {
@@ -185,21 +554,25 @@ static ssize_t stats_write(struct file *file, const char __user *buf,
 		if (!obj)
 			return -ENOMEM;
 	} else if (sscanf(cmd, "free %d", &id) == 1) {
-		spin_lock(&list_lock);
-		obj = find_object(id);
-		spin_unlock(&list_lock);
-		if (obj)
-			free_object(obj);
-		else
+		if (free_object(id))
 			pr_warn("kmem_cache_demo: object %d not found\n", id);
 	} else if (sscanf(cmd, "access %d", &id) == 1) {
-		spin_lock(&list_lock);
+		/* No global lock: only the object's own lock is taken */
+		rcu_read_lock();
 		obj = find_object(id);
 		if (obj)
 			access_object(obj);
-		spin_unlock(&list_lock);
+		rcu_read_unlock();
 	} else if (strncmp(cmd, "freeall", 7) == 0) {
 		free_all_objects();
+	} else if (strncmp(cmd, "bench", 5) == 0) {
+		/* Runs synchronously; the write returns when all steps are done */
+		sscanf(cmd, "bench %u %u", &ops, &batch);
+		if (!ops || ops > BENCH_MAX_OPS || !batch || batch > BENCH_MAX_BATCH)
+			return -EINVAL;
+		ret = run_bench(ops, batch);
+		if (ret)
+			return ret;
 	} else {
 		pr_warn("kmem_cache_demo: unknown command: %s\n", cmd);
 	}
@@ -219,8 +592,13 @@ static struct proc_dir_entry *proc_entry;
 
 static int __init kmem_cache_demo_init(void)
 {
+	int i;
+
 	pr_info("kmem_cache_demo: initializing\n");
 
+	for (i = 0; i < ARRAY_SIZE(object_locks); i++)
+		spin_lock_init(&object_locks[i]);
+
 	/* Create the slab cache */
 	object_cache = kmem_cache_create(
 		CACHE_NAME,			/* Cache name */
@@ -260,6 +638,9 @@ static void __exit kmem_cache_demo_exit(void)
 	/* Free all objects */
 	free_all_objects();
 
+	/* Wait for the call_rcu() frees before the cache goes away */
+	rcu_barrier();
+
 	/* Destroy the cache */
 	kmem_cache_destroy(object_cache);
 
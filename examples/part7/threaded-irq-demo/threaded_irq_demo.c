@@ -4,81 +4,316 @@
  *
  * Demonstrates threaded interrupt handling patterns:
  * - Hardirq handler (fast acknowledgment)
- * - Threaded handler (can sleep, uses mutex)
+ * - Threaded handler (process context, lockless kfifo producer)
  * - Data passing between handlers
- * - Wait queue for user space notification
+ * - Streaming samples to user space through a char device with
+ *   blocking reads and poll()
+ * - Latency histograms with tail percentiles
+ * - Interrupt coalescing with static or adaptive thresholds
  *
- * This is a virtual device using a timer to simulate interrupts.
+ * This is a virtual device using an hrtimer to simulate interrupts.
  */
 
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/interrupt.h>
-#include <linux/timer.h>
+#include <linux/hrtimer.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
 #include <linux/ktime.h>
 #include <linux/random.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/bitops.h>
 
 #define DRIVER_NAME "threaded_irq_demo"
-#define BUFFER_SIZE 64
+#define DATA_DUMP_MAX 64	/* Samples shown by /proc/threaded_irq_demo/data */
+#define FIFO_SIZE_MAX (1U << 20)
+#define HW_FIFO_DEPTH 256	/* Samples the simulated device can hold */
+#define INTERVAL_US_MIN 10
+
+static unsigned int fifo_size = 1024;
+module_param(fifo_size, uint, 0444);
+MODULE_PARM_DESC(fifo_size, "Sample fifo depth, rounded up to a power of two, max 1048576 (default: 1024)");
+
+/*
+ * One record per interrupt, as read from /dev/threaded_irq_demo.
+ * seq increments for every interrupt, including ones dropped on
+ * overrun, so a reader can spot gaps in the stream.
+ */
+struct irq_demo_sample {
+	u64 timestamp_ns;	/* ktime_get_ns() at the hardirq */
+	u32 seq;
+	u32 data;
+};
+
+/* Emulates IRQTF_RUNTHREAD: the hardirq asked for the thread to run */
+#define DEMO_THREAD_RUN	0
+
+/*
+ * Adaptive coalescing: every ADAPT_WINDOW_MS the thread handler looks at
+ * the event rate and picks the smallest batch that keeps thread wakeups
+ * at or below ADAPT_TARGET_HZ, never holding an event longer than
+ * ADAPT_MAX_USECS. Low rates get no coalescing at all.
+ */
+#define ADAPT_WINDOW_MS	100
+#define ADAPT_TARGET_HZ	1000
+#define ADAPT_MAX_USECS	1000
+
+/*
+ * HDR-style latency histogram: values below LAT_SUB are exact, above
+ * that each power of two is split into LAT_SUB linear sub-buckets, so
+ * any recorded value is off by at most 1/LAT_SUB (12.5%) across the
+ * whole ns..s range.
+ *
+ * part4/timer-demo carries the same helpers on purpose: each example
+ * builds on its own, and with identical buckets the IRQ and timer
+ * numbers can be compared directly. Change both together.
+ */
+#define LAT_SUB_BITS	3
+#define LAT_SUB		(1U << LAT_SUB_BITS)
+#define LAT_BUCKETS	((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct lat_hist {
+	u64 buckets[LAT_BUCKETS];
+	u64 count;
+	u64 sum_ns;
+	u64 min_ns;
+	u64 max_ns;
+};
+
+struct lat_summary {
+	u64 count;
+	u64 min_ns;
+	u64 max_ns;
+	u64 mean_ns;
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 p999_ns;
+};
 
 struct irq_demo_device {
 	struct platform_device *pdev;
-	struct timer_list timer;
+	struct hrtimer timer;
 
-	/* Simulated hardware state */
+	/*
+	 * Simulated hardware state: the device queues samples in its own
+	 * fifo (filled in hardirq context, drained by the thread handler)
+	 * and raises pending_irq.
+	 */
 	atomic_t pending_irq;
-	u32 hw_data;
+	DECLARE_KFIFO(hw_fifo, struct irq_demo_sample, HW_FIFO_DEPTH);
 
-	/* Data buffer protected by mutex (threaded handler can use mutex) */
-	struct mutex data_mutex;
-	u32 data_buffer[BUFFER_SIZE];
-	int data_head;
-	int data_count;
+	/*
+	 * Coalescing: the hardirq only wakes the thread once max_events
+	 * are pending or the oldest has waited max_usecs (coal_timer).
+	 * max_events == 1 means every interrupt wakes the thread.
+	 */
+	spinlock_t coal_lock;
+	struct hrtimer coal_timer;
+	unsigned int coal_pending;
+	unsigned int coal_max_events;
+	unsigned int coal_max_usecs;
+	bool coal_adaptive;
+	u64 adapt_window_start;
+	unsigned int adapt_window_events;
+	unsigned int adapt_rate_hz;	/* Smoothed event rate */
+
+	/* Stand-in for the genirq irq thread of a real threaded IRQ */
+	struct task_struct *irq_thread;
+	wait_queue_head_t irq_thread_wq;
+	unsigned long thread_flags;
+
+	/*
+	 * Samples: the threaded handler is the only producer and readers
+	 * are serialized by read_mutex, so kfifo needs no lock between
+	 * them and the handler never waits for a reader.
+	 */
+	DECLARE_KFIFO_PTR(fifo, struct irq_demo_sample);
+	struct mutex read_mutex;
+	u32 seq;		/* Only touched by the simulated device */
 
 	/* Wait queue for readers */
 	wait_queue_head_t data_ready;
 
+	/* Character device streaming the samples */
+	struct miscdevice miscdev;
+
 	/* Statistics */
 	atomic_t hardirq_count;
 	atomic_t thread_count;
 	atomic_t spurious_count;
-	u64 last_irq_time;
-	u64 total_latency_ns;
+	atomic_t overrun_count;
+	atomic_t hw_overrun_count;
+	atomic_long_t drained_count;
+
+	/* Hardirq-to-thread wakeup and thread run time, under hist_lock */
+	spinlock_t hist_lock;
+	struct lat_hist wakeup_hist;
+	struct lat_hist run_hist;
 
 	/* Control */
 	bool running;
-	unsigned int interval_ms;
+	unsigned int interval_us;
 };
 
 static struct irq_demo_device *demo_dev;
 static struct proc_dir_entry *proc_dir;
 
+static irqreturn_t demo_hardirq(int irq, void *dev_id);
+static irqreturn_t demo_thread_handler(int irq, void *dev_id);
+
+static unsigned int lat_bucket(u64 ns)
+{
+	unsigned int msb;
+
+	if (ns < LAT_SUB)
+		return ns;
+
+	msb = fls64(ns) - 1;
+	return (msb - LAT_SUB_BITS + 1) * LAT_SUB +
+	       ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* Largest value that lands in bucket @b */
+static u64 lat_bucket_max(unsigned int b)
+{
+	unsigned int shift;
+
+	if (b < LAT_SUB)
+		return b;
+
+	shift = b / LAT_SUB - 1;
+	return ((u64)(LAT_SUB + b % LAT_SUB + 1) << shift) - 1;
+}
+
+static void lat_hist_reset(struct lat_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min_ns = U64_MAX;
+}
+
+static void lat_hist_record(struct lat_hist *h, u64 ns)
+{
+	h->buckets[lat_bucket(ns)]++;
+	h->count++;
+	h->sum_ns += ns;
+	h->min_ns = min(h->min_ns, ns);
+	h->max_ns = max(h->max_ns, ns);
+}
+
+/* Smallest bucket bound covering @per_10k / 10000 of the samples */
+static u64 lat_hist_percentile(const struct lat_hist *h, unsigned int per_10k)
+{
+	u64 target = DIV_ROUND_UP_ULL(h->count * per_10k, 10000);
+	u64 seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->buckets[b];
+		if (seen >= target)
+			return min(lat_bucket_max(b), h->max_ns);
+	}
+
+	return h->max_ns;
+}
+
+static void lat_hist_summarize(const struct lat_hist *h,
+			       struct lat_summary *sum)
+{
+	memset(sum, 0, sizeof(*sum));
+	if (!h->count)
+		return;
+
+	sum->count = h->count;
+	sum->min_ns = h->min_ns;
+	sum->max_ns = h->max_ns;
+	sum->mean_ns = div64_u64(h->sum_ns, h->count);
+	sum->p50_ns = lat_hist_percentile(h, 5000);
+	sum->p99_ns = lat_hist_percentile(h, 9900);
+	sum->p999_ns = lat_hist_percentile(h, 9990);
+}
+
+static void demo_reset_latency(struct irq_demo_device *dev)
+{
+	spin_lock(&dev->hist_lock);
+	lat_hist_reset(&dev->wakeup_hist);
+	lat_hist_reset(&dev->run_hist);
+	spin_unlock(&dev->hist_lock);
+}
+
+/* What genirq does for IRQ_WAKE_THREAD */
+static void demo_wake_thread(struct irq_demo_device *dev)
+{
+	set_bit(DEMO_THREAD_RUN, &dev->thread_flags);
+	wake_up(&dev->irq_thread_wq);
+}
+
+static void demo_set_coalesce(struct irq_demo_device *dev,
+			      unsigned int max_events, unsigned int max_usecs)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->coal_lock, flags);
+	dev->coal_max_events = max_events;
+	dev->coal_max_usecs = max_usecs;
+	spin_unlock_irqrestore(&dev->coal_lock, flags);
+}
+
 /*
  * Simulated hardware interrupt trigger
  * In real hardware, this would be triggered by the device
  */
-static void trigger_simulated_irq(struct timer_list *t)
+static enum hrtimer_restart trigger_simulated_irq(struct hrtimer *t)
 {
-	struct irq_demo_device *dev = from_timer(dev, t, timer);
+	struct irq_demo_device *dev = container_of(t, struct irq_demo_device,
+						   timer);
+	struct irq_demo_sample sample;
 
 	if (!dev->running)
-		return;
+		return HRTIMER_NORESTART;
 
 	/* Simulate hardware generating data and interrupt */
-	dev->hw_data = get_random_u32() & 0xFFFF;
+	sample.timestamp_ns = ktime_get_ns();
+	sample.seq = dev->seq++;
+	sample.data = get_random_u32() & 0xFFFF;
+	if (!kfifo_put(&dev->hw_fifo, sample))
+		atomic_inc(&dev->hw_overrun_count);
 	atomic_set(&dev->pending_irq, 1);
-	dev->last_irq_time = ktime_get_ns();
 
 	/* In real driver, hardware would trigger IRQ here */
 	/* For demo, we call the handler chain directly */
 	/* This simulates: device asserts IRQ line -> CPU receives interrupt */
+	if (demo_hardirq(0, dev) == IRQ_WAKE_THREAD)
+		demo_wake_thread(dev);
 
 	/* Re-arm timer for next "interrupt" */
-	mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->interval_ms));
+	hrtimer_forward_now(t, us_to_ktime(READ_ONCE(dev->interval_us)));
+	return HRTIMER_RESTART;
+}
+
+/* Coalescing timeout: flush whatever the hardirq has held back */
+static enum hrtimer_restart demo_coal_timeout(struct hrtimer *t)
+{
+	struct irq_demo_device *dev = container_of(t, struct irq_demo_device,
+						   coal_timer);
+	bool wake;
+
+	spin_lock(&dev->coal_lock);
+	wake = dev->coal_pending;
+	dev->coal_pending = 0;
+	spin_unlock(&dev->coal_lock);
+
+	if (wake)
+		demo_wake_thread(dev);
+
+	return HRTIMER_NORESTART;
 }
 
 /*
@@ -101,45 +336,207 @@ static irqreturn_t demo_hardirq(int irq, void *dev_id)
 	atomic_set(&dev->pending_irq, 0);
 	atomic_inc(&dev->hardirq_count);
 
+	/*
+	 * Coalescing, like NIC interrupt moderation: hold the event back
+	 * until enough have accumulated, with coal_timer bounding how
+	 * long the first one waits. The sample stays in hw_fifo meanwhile.
+	 */
+	spin_lock(&dev->coal_lock);
+	if (++dev->coal_pending < dev->coal_max_events) {
+		if (dev->coal_pending == 1)
+			hrtimer_start(&dev->coal_timer,
+				      us_to_ktime(dev->coal_max_usecs),
+				      HRTIMER_MODE_REL);
+		spin_unlock(&dev->coal_lock);
+		return IRQ_HANDLED;
+	}
+	dev->coal_pending = 0;
+	spin_unlock(&dev->coal_lock);
+
+	/* Batch complete; a running timeout has nothing left to flush */
+	hrtimer_try_to_cancel(&dev->coal_timer);
+
 	/* Wake the threaded handler for processing */
 	return IRQ_WAKE_THREAD;
 }
 
+/*
+ * Minimal version of the kernel's irq_thread(): sleep until the hardirq
+ * requests a run, then call the threaded handler in process context.
+ */
+static int demo_irq_thread(void *data)
+{
+	struct irq_demo_device *dev = data;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(dev->irq_thread_wq,
+					 test_and_clear_bit(DEMO_THREAD_RUN,
+							    &dev->thread_flags) ||
+					 kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+
+		demo_thread_handler(0, dev);
+	}
+
+	return 0;
+}
+
+/*
+ * Adaptive moderation, run from the thread handler: measure the event
+ * rate over a window, smooth it, and derive new thresholds from it.
+ */
+static void demo_adapt_coalesce(struct irq_demo_device *dev, u64 now,
+				unsigned int events)
+{
+	unsigned int rate, max_events, max_usecs = 0;
+	u64 elapsed;
+
+	dev->adapt_window_events += events;
+	elapsed = now - dev->adapt_window_start;
+	if (elapsed < ADAPT_WINDOW_MS * NSEC_PER_MSEC)
+		return;
+
+	rate = div64_u64((u64)dev->adapt_window_events * NSEC_PER_SEC, elapsed);
+	/* EWMA so a single burst does not swing the thresholds */
+	dev->adapt_rate_hz = dev->adapt_rate_hz ?
+			     (3 * dev->adapt_rate_hz + rate) / 4 : rate;
+	dev->adapt_window_start = now;
+	dev->adapt_window_events = 0;
+
+	max_events = clamp_t(unsigned int, dev->adapt_rate_hz / ADAPT_TARGET_HZ,
+			     1, HW_FIFO_DEPTH / 2);
+	if (max_events > 1)
+		max_usecs = min_t(unsigned int, ADAPT_MAX_USECS,
+				  USEC_PER_SEC / ADAPT_TARGET_HZ);
+
+	demo_set_coalesce(dev, max_events, max_usecs);
+}
+
 /*
  * Threaded handler (bottom half)
  *
  * Runs in process context - CAN SLEEP!
  * Can use mutexes, allocate memory with GFP_KERNEL, etc.
+ * It does not need to here: as the single kfifo producer it never
+ * contends with readers, however slow they are.
+ *
+ * Drains every sample the device has queued, so with coalescing one
+ * wakeup handles a whole batch.
  */
 static irqreturn_t demo_thread_handler(int irq, void *dev_id)
 {
 	struct irq_demo_device *dev = dev_id;
+	struct irq_demo_sample sample;
 	u64 now = ktime_get_ns();
-	u64 latency;
+	unsigned int n = 0;
+	u64 done;
 
 	atomic_inc(&dev->thread_count);
 
-	/* Calculate interrupt latency */
-	latency = now - dev->last_irq_time;
-	dev->total_latency_ns += latency;
+	spin_lock(&dev->hist_lock);
+	while (kfifo_get(&dev->hw_fifo, &sample)) {
+		/* Interrupt latency: event to thread running, incl. coalescing */
+		lat_hist_record(&dev->wakeup_hist, now - sample.timestamp_ns);
+		n++;
+
+		/* A full fifo means the reader fell behind: drop the new sample */
+		if (!kfifo_put(&dev->fifo, sample))
+			atomic_inc(&dev->overrun_count);
+	}
+	spin_unlock(&dev->hist_lock);
 
-	/* Lock mutex - WE CAN DO THIS because we're in process context! */
-	mutex_lock(&dev->data_mutex);
+	/* Wake up any readers waiting for data, once per batch */
+	if (n)
+		wake_up_interruptible(&dev->data_ready);
 
-	/* Store data in circular buffer */
-	dev->data_buffer[dev->data_head] = dev->hw_data;
-	dev->data_head = (dev->data_head + 1) % BUFFER_SIZE;
-	if (dev->data_count < BUFFER_SIZE)
-		dev->data_count++;
+	atomic_long_add(n, &dev->drained_count);
+	if (READ_ONCE(dev->coal_adaptive))
+		demo_adapt_coalesce(dev, now, n);
 
-	mutex_unlock(&dev->data_mutex);
+	done = ktime_get_ns();
 
-	/* Wake up any readers waiting for data */
-	wake_up_interruptible(&dev->data_ready);
+	spin_lock(&dev->hist_lock);
+	lat_hist_record(&dev->run_hist, done - now);
+	spin_unlock(&dev->hist_lock);
 
 	return IRQ_HANDLED;
 }
 
+/*
+ * Character device: /dev/threaded_irq_demo streams struct
+ * irq_demo_sample records. Reads return whole records only.
+ */
+static int demo_cdev_open(struct inode *inode, struct file *file)
+{
+	/* file->private_data points at the miscdevice after misc_open() */
+	return stream_open(inode, file);
+}
+
+static ssize_t demo_cdev_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct irq_demo_device *dev = container_of(file->private_data,
+						   struct irq_demo_device,
+						   miscdev);
+	unsigned int copied;
+	int ret;
+
+	if (count < sizeof(struct irq_demo_sample))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&dev->read_mutex))
+		return -ERESTARTSYS;
+
+	while (kfifo_is_empty(&dev->fifo)) {
+		mutex_unlock(&dev->read_mutex);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		if (wait_event_interruptible(dev->data_ready,
+					     !kfifo_is_empty(&dev->fifo)))
+			return -ERESTARTSYS;
+
+		if (mutex_lock_interruptible(&dev->read_mutex))
+			return -ERESTARTSYS;
+	}
+
+	/* kfifo_to_user() takes bytes and copies whole records */
+	ret = kfifo_to_user(&dev->fifo, buf, count, &copied);
+
+	mutex_unlock(&dev->read_mutex);
+
+	return ret ? ret : copied;
+}
+
+static __poll_t demo_cdev_poll(struct file *file, poll_table *wait)
+{
+	struct irq_demo_device *dev = container_of(file->private_data,
+						   struct irq_demo_device,
+						   miscdev);
+
+	poll_wait(file, &dev->data_ready, wait);
+
+	return kfifo_is_empty(&dev->fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations demo_cdev_fops = {
+	.owner  = THIS_MODULE,
+	.open   = demo_cdev_open,
+	.read   = demo_cdev_read,
+	.poll   = demo_cdev_poll,
+	.llseek = no_llseek,
+};
+
+static void lat_summary_show(struct seq_file *m, const char *name,
+			     const struct lat_summary *sum)
+{
+	seq_printf(m, "%-18s n=%llu min=%llu p50=%llu p99=%llu p99.9=%llu max=%llu ns\n",
+		   name, sum->count, sum->min_ns, sum->p50_ns, sum->p99_ns,
+		   sum->p999_ns, sum->max_ns);
+}
+
 /*
  * Proc file: show statistics
  */
@@ -147,7 +544,8 @@ static int stats_show(struct seq_file *m, void *v)
 {
 	struct irq_demo_device *dev = demo_dev;
 	int hardirq_cnt, thread_cnt, spurious_cnt;
-	u64 avg_latency = 0;
+	struct lat_summary wakeup, run;
+	unsigned long drained;
 
 	if (!dev)
 		return -ENODEV;
@@ -155,20 +553,43 @@ static int stats_show(struct seq_file *m, void *v)
 	hardirq_cnt = atomic_read(&dev->hardirq_count);
 	thread_cnt = atomic_read(&dev->thread_count);
 	spurious_cnt = atomic_read(&dev->spurious_count);
+	drained = atomic_long_read(&dev->drained_count);
 
-	if (thread_cnt > 0)
-		avg_latency = dev->total_latency_ns / thread_cnt;
+	/* Percentiles from one consistent snapshot; printing happens unlocked */
+	spin_lock(&dev->hist_lock);
+	lat_hist_summarize(&dev->wakeup_hist, &wakeup);
+	lat_hist_summarize(&dev->run_hist, &run);
+	spin_unlock(&dev->hist_lock);
 
 	seq_puts(m, "Threaded IRQ Demo Statistics\n");
 	seq_puts(m, "============================\n\n");
 
 	seq_printf(m, "Running:           %s\n", dev->running ? "yes" : "no");
-	seq_printf(m, "Interval:          %u ms\n", dev->interval_ms);
+	seq_printf(m, "Interval:          %u us\n", dev->interval_us);
 	seq_printf(m, "Hardirq count:     %d\n", hardirq_cnt);
 	seq_printf(m, "Thread count:      %d\n", thread_cnt);
 	seq_printf(m, "Spurious count:    %d\n", spurious_cnt);
-	seq_printf(m, "Avg latency:       %llu ns\n", avg_latency);
-	seq_printf(m, "Data in buffer:    %d\n", dev->data_count);
+	seq_printf(m, "Overrun count:     %d\n", atomic_read(&dev->overrun_count));
+	seq_printf(m, "HW overrun count:  %d\n", atomic_read(&dev->hw_overrun_count));
+	seq_printf(m, "Events per run:    %lu\n",
+		   thread_cnt > 0 ? drained / thread_cnt : 0);
+	seq_printf(m, "Avg latency:       %llu ns\n", wakeup.mean_ns);
+	seq_printf(m, "Data in fifo:      %u / %u\n",
+		   kfifo_len(&dev->fifo), kfifo_size(&dev->fifo));
+
+	seq_puts(m, "\nLatency\n");
+	lat_summary_show(m, "  Wakeup:", &wakeup);
+	lat_summary_show(m, "  Thread run:", &run);
+
+	seq_puts(m, "\nCoalescing\n");
+	seq_printf(m, "  Mode:            %s\n",
+		   READ_ONCE(dev->coal_adaptive) ? "adaptive" :
+		   READ_ONCE(dev->coal_max_events) > 1 ? "static" : "off");
+	seq_printf(m, "  Max events:      %u\n", READ_ONCE(dev->coal_max_events));
+	seq_printf(m, "  Max usecs:       %u\n", READ_ONCE(dev->coal_max_usecs));
+	if (READ_ONCE(dev->coal_adaptive))
+		seq_printf(m, "  Event rate:      %u Hz\n",
+			   READ_ONCE(dev->adapt_rate_hz));
 
 	return 0;
 }
@@ -186,27 +607,34 @@ static const struct proc_ops stats_proc_ops = {
 };
 
 /*
- * Proc file: read data buffer
+ * Proc file: peek at the oldest queued samples without consuming them
  */
 static int data_show(struct seq_file *m, void *v)
 {
 	struct irq_demo_device *dev = demo_dev;
-	int i, idx, count;
+	struct irq_demo_sample *samples;
+	unsigned int i, count;
 
 	if (!dev)
 		return -ENODEV;
 
-	mutex_lock(&dev->data_mutex);
+	samples = kmalloc_array(DATA_DUMP_MAX, sizeof(*samples), GFP_KERNEL);
+	if (!samples)
+		return -ENOMEM;
+
+	/* Peeking is a consumer-side operation: exclude the readers */
+	mutex_lock(&dev->read_mutex);
+	count = kfifo_out_peek(&dev->fifo, samples, DATA_DUMP_MAX);
+	mutex_unlock(&dev->read_mutex);
 
-	count = dev->data_count;
-	seq_printf(m, "Data buffer (%d entries):\n", count);
+	seq_printf(m, "Data fifo (%u entries, showing %u):\n",
+		   kfifo_len(&dev->fifo), count);
 
-	for (i = 0; i < count; i++) {
-		idx = (dev->data_head - count + i + BUFFER_SIZE) % BUFFER_SIZE;
-		seq_printf(m, "  [%2d]: 0x%04x\n", i, dev->data_buffer[idx]);
-	}
+	for (i = 0; i < count; i++)
+		seq_printf(m, "  [%2u]: seq %u 0x%04x\n", i,
+			   samples[i].seq, samples[i].data);
 
-	mutex_unlock(&dev->data_mutex);
+	kfree(samples);
 
 	return 0;
 }
@@ -248,29 +676,65 @@ static ssize_t control_write(struct file *file, const char __user *buf,
 	if (strcmp(cmd, "start") == 0) {
 		if (!dev->running) {
 			dev->running = true;
-			mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->interval_ms));
+			hrtimer_start(&dev->timer, us_to_ktime(dev->interval_us),
+				      HRTIMER_MODE_REL);
 			pr_info("threaded_irq_demo: Started\n");
 		}
 	} else if (strcmp(cmd, "stop") == 0) {
 		dev->running = false;
-		del_timer_sync(&dev->timer);
+		hrtimer_cancel(&dev->timer);
 		pr_info("threaded_irq_demo: Stopped\n");
 	} else if (strcmp(cmd, "reset") == 0) {
 		atomic_set(&dev->hardirq_count, 0);
 		atomic_set(&dev->thread_count, 0);
 		atomic_set(&dev->spurious_count, 0);
-		dev->total_latency_ns = 0;
-		mutex_lock(&dev->data_mutex);
-		dev->data_count = 0;
-		dev->data_head = 0;
-		mutex_unlock(&dev->data_mutex);
+		atomic_set(&dev->overrun_count, 0);
+		demo_reset_latency(dev);
+		/* Discard queued samples from the consumer side only */
+		mutex_lock(&dev->read_mutex);
+		kfifo_reset_out(&dev->fifo);
+		mutex_unlock(&dev->read_mutex);
 		pr_info("threaded_irq_demo: Stats reset\n");
+	} else if (strcmp(cmd, "reset_latency") == 0) {
+		demo_reset_latency(dev);
+		pr_info("threaded_irq_demo: Latency histograms reset\n");
 	} else if (strncmp(cmd, "interval ", 9) == 0) {
 		unsigned int interval;
-		if (kstrtouint(cmd + 9, 10, &interval) == 0 && interval > 0) {
-			dev->interval_ms = interval;
+		if (kstrtouint(cmd + 9, 10, &interval) == 0 && interval > 0 &&
+		    interval <= UINT_MAX / USEC_PER_MSEC) {
+			WRITE_ONCE(dev->interval_us, interval * USEC_PER_MSEC);
 			pr_info("threaded_irq_demo: Interval set to %u ms\n", interval);
 		}
+	} else if (strncmp(cmd, "interval_us ", 12) == 0) {
+		unsigned int interval;
+		if (kstrtouint(cmd + 12, 10, &interval) == 0 &&
+		    interval >= INTERVAL_US_MIN) {
+			WRITE_ONCE(dev->interval_us, interval);
+			pr_info("threaded_irq_demo: Interval set to %u us\n", interval);
+		}
+	} else if (strcmp(cmd, "coalesce off") == 0) {
+		WRITE_ONCE(dev->coal_adaptive, false);
+		demo_set_coalesce(dev, 1, 0);
+		pr_info("threaded_irq_demo: Coalescing off\n");
+	} else if (strcmp(cmd, "coalesce adaptive") == 0) {
+		dev->adapt_window_start = ktime_get_ns();
+		dev->adapt_window_events = 0;
+		dev->adapt_rate_hz = 0;
+		WRITE_ONCE(dev->coal_adaptive, true);
+		pr_info("threaded_irq_demo: Adaptive coalescing on\n");
+	} else if (strncmp(cmd, "coalesce ", 9) == 0) {
+		unsigned int events, usecs;
+
+		/* A held-back event needs a timeout, or it could wait forever */
+		if (sscanf(cmd + 9, "%u %u", &events, &usecs) != 2 ||
+		    events < 1 || events > HW_FIFO_DEPTH / 2 ||
+		    (events > 1 && !usecs))
+			return -EINVAL;
+
+		WRITE_ONCE(dev->coal_adaptive, false);
+		demo_set_coalesce(dev, events, usecs);
+		pr_info("threaded_irq_demo: Coalescing %u events / %u us\n",
+			events, usecs);
 	} else {
 		return -EINVAL;
 	}
@@ -283,8 +747,14 @@ static int control_show(struct seq_file *m, void *v)
 	seq_puts(m, "Commands:\n");
 	seq_puts(m, "  start          - Start generating interrupts\n");
 	seq_puts(m, "  stop           - Stop generating interrupts\n");
-	seq_puts(m, "  reset          - Reset statistics\n");
+	seq_puts(m, "  reset          - Reset statistics and discard queued samples\n");
+	seq_puts(m, "  reset_latency  - Reset only the latency histograms\n");
 	seq_puts(m, "  interval <ms>  - Set interrupt interval\n");
+	seq_puts(m, "  interval_us <us> - Set interrupt interval in microseconds\n");
+	seq_puts(m, "  coalesce <events> <usecs> - Wake the thread every <events>\n");
+	seq_puts(m, "                   interrupts or after <usecs> at the latest\n");
+	seq_puts(m, "  coalesce adaptive - Tune coalescing from the event rate\n");
+	seq_puts(m, "  coalesce off   - One thread wakeup per interrupt\n");
 	return 0;
 }
 
@@ -304,6 +774,7 @@ static const struct proc_ops control_proc_ops = {
 static int demo_probe(struct platform_device *pdev)
 {
 	struct irq_demo_device *dev;
+	int ret;
 
 	dev_info(&pdev->dev, "Probing threaded IRQ demo device\n");
 
@@ -312,17 +783,30 @@ static int demo_probe(struct platform_device *pdev)
 		return -ENOMEM;
 
 	dev->pdev = pdev;
-	mutex_init(&dev->data_mutex);
+	mutex_init(&dev->read_mutex);
 	init_waitqueue_head(&dev->data_ready);
+	init_waitqueue_head(&dev->irq_thread_wq);
 	atomic_set(&dev->pending_irq, 0);
 	atomic_set(&dev->hardirq_count, 0);
 	atomic_set(&dev->thread_count, 0);
 	atomic_set(&dev->spurious_count, 0);
-	dev->interval_ms = 100;  /* Default 100ms interval */
+	atomic_set(&dev->overrun_count, 0);
+	spin_lock_init(&dev->hist_lock);
+	lat_hist_reset(&dev->wakeup_hist);
+	lat_hist_reset(&dev->run_hist);
+	atomic_set(&dev->hw_overrun_count, 0);
+	atomic_long_set(&dev->drained_count, 0);
+	INIT_KFIFO(dev->hw_fifo);
+	spin_lock_init(&dev->coal_lock);
+	dev->coal_max_events = 1;  /* No coalescing by default */
+	dev->interval_us = 100 * USEC_PER_MSEC;  /* Default 100ms interval */
 	dev->running = false;
 
 	/* Initialize timer for simulating interrupts */
-	timer_setup(&dev->timer, trigger_simulated_irq, 0);
+	hrtimer_init(&dev->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->timer.function = trigger_simulated_irq;
+	hrtimer_init(&dev->coal_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->coal_timer.function = demo_coal_timeout;
 
 	/*
 	 * NOTE: In a real driver, you would request an actual IRQ here:
@@ -335,9 +819,38 @@ static int demo_probe(struct platform_device *pdev)
 	 *                                 "demo", dev);
 	 *
 	 * For this demo, we simulate the IRQ using a timer that
-	 * directly invokes the handler chain.
+	 * directly invokes the handler chain, and run the threaded
+	 * handler from our own kthread.
 	 */
 
+	if (fifo_size < 2 || fifo_size > FIFO_SIZE_MAX) {
+		dev_err(&pdev->dev, "fifo_size must be 2..%u\n", FIFO_SIZE_MAX);
+		return -EINVAL;
+	}
+
+	/* kfifo_alloc() rounds the depth up to a power of two */
+	ret = kfifo_alloc(&dev->fifo, fifo_size, GFP_KERNEL);
+	if (ret)
+		return ret;
+
+	dev->irq_thread = kthread_run(demo_irq_thread, dev, "irq/%s",
+				      DRIVER_NAME);
+	if (IS_ERR(dev->irq_thread)) {
+		ret = PTR_ERR(dev->irq_thread);
+		goto err_fifo;
+	}
+
+	dev->miscdev.minor = MISC_DYNAMIC_MINOR;
+	dev->miscdev.name = DRIVER_NAME;
+	dev->miscdev.fops = &demo_cdev_fops;
+	dev->miscdev.parent = &pdev->dev;
+
+	ret = misc_register(&dev->miscdev);
+	if (ret) {
+		dev_err(&pdev->dev, "Failed to register misc device: %d\n", ret);
+		goto err_thread;
+	}
+
 	platform_set_drvdata(pdev, dev);
 	demo_dev = dev;
 
@@ -349,10 +862,17 @@ static int demo_probe(struct platform_device *pdev)
 		proc_create("control", 0644, proc_dir, &control_proc_ops);
 	}
 
-	dev_info(&pdev->dev, "Threaded IRQ demo ready\n");
+	dev_info(&pdev->dev, "Threaded IRQ demo ready, fifo %u samples\n",
+		 kfifo_size(&dev->fifo));
 	dev_info(&pdev->dev, "Control via /proc/threaded_irq_demo/control\n");
 
 	return 0;
+
+err_thread:
+	kthread_stop(dev->irq_thread);
+err_fifo:
+	kfifo_free(&dev->fifo);
+	return ret;
 }
 
 static int demo_remove(struct platform_device *pdev)
@@ -361,9 +881,10 @@ static int demo_remove(struct platform_device *pdev)
 
 	dev_info(&pdev->dev, "Removing threaded IRQ demo device\n");
 
-	/* Stop the timer */
+	/* Stop the timers */
 	dev->running = false;
-	del_timer_sync(&dev->timer);
+	hrtimer_cancel(&dev->timer);
+	hrtimer_cancel(&dev->coal_timer);
 
 	/* Remove proc entries */
 	if (proc_dir) {
@@ -373,6 +894,10 @@ static int demo_remove(struct platform_device *pdev)
 		remove_proc_entry("threaded_irq_demo", NULL);
 	}
 
+	misc_deregister(&dev->miscdev);
+	kthread_stop(dev->irq_thread);
+	kfifo_free(&dev->fifo);
+
 	demo_dev = NULL;
 
 	return 0;
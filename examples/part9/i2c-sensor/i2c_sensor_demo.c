@@ -12,6 +12,9 @@
 #include <linux/regmap.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/delay.h>
 
 /* Register definitions (simulated sensor) */
@@ -38,12 +41,28 @@
 #define STATUS_HUMID_READY  BIT(1)
 #define STATUS_BUSY         BIT(7)
 
+/* Buffer scan order */
+enum demo_sensor_scan {
+    DEMO_SCAN_TEMP,
+    DEMO_SCAN_HUMID,
+    DEMO_SCAN_TIMESTAMP,
+};
+
 struct demo_sensor {
     struct device *dev;
     struct regmap *regmap;
     struct mutex lock;
     s8 temp_calibration;
     s8 humid_calibration;
+
+    /* One buffered sample: both channels plus an aligned timestamp */
+    struct {
+        s16 chan[2];
+        s64 timestamp __aligned(8);
+    } scan;
+
+    /* TEMP_L..HUMID_H, filled by one bulk read */
+    __le16 data[2] __aligned(IIO_DMA_MINALIGN);
 };
 
 /* Register defaults for cache */
@@ -110,7 +129,7 @@ static int demo_sensor_wait_ready(struct demo_sensor *sensor, unsigned int mask)
         if (ret)
             return ret;
 
-        if (status & mask)
+        if ((status & mask) == mask)
             return 0;
 
         usleep_range(1000, 2000);
@@ -119,78 +138,85 @@ static int demo_sensor_wait_ready(struct demo_sensor *sensor, unsigned int mask)
     return -ETIMEDOUT;
 }
 
-static int demo_sensor_read_temp(struct demo_sensor *sensor, int *val)
+/*
+ * Read both measurements with a single I2C transaction. TEMP_L..HUMID_H
+ * are adjacent and all volatile, so regmap_bulk_read() goes to the bus as
+ * one block read instead of a read per register. Caller holds the lock.
+ */
+static int demo_sensor_read_sample(struct demo_sensor *sensor,
+                                   unsigned int ready, int *temp, int *humid)
 {
-    unsigned int temp_l, temp_h;
-    s16 raw_temp;
     int ret;
 
-    mutex_lock(&sensor->lock);
-
-    /* Trigger conversion if needed */
+    /* Trigger conversion if needed; cached, so no bus access once set */
     ret = regmap_update_bits(sensor->regmap, REG_CONFIG, CFG_ENABLE, CFG_ENABLE);
     if (ret)
-        goto out;
+        return ret;
 
-    /* Wait for temperature ready */
-    ret = demo_sensor_wait_ready(sensor, STATUS_TEMP_READY);
+    ret = demo_sensor_wait_ready(sensor, ready);
     if (ret)
-        goto out;
+        return ret;
 
-    /* Read temperature registers */
-    ret = regmap_read(sensor->regmap, REG_TEMP_L, &temp_l);
+    ret = regmap_bulk_read(sensor->regmap, REG_TEMP_L, sensor->data,
+                           sizeof(sensor->data));
     if (ret)
-        goto out;
+        return ret;
 
-    ret = regmap_read(sensor->regmap, REG_TEMP_H, &temp_h);
-    if (ret)
-        goto out;
+    /* Apply calibration offsets (in 0.1 units) */
+    *temp = (s16)le16_to_cpu(sensor->data[0]) + sensor->temp_calibration * 10;
+    *humid = le16_to_cpu(sensor->data[1]) + sensor->humid_calibration * 10;
 
-    raw_temp = (s16)((temp_h << 8) | temp_l);
+    return 0;
+}
 
-    /* Apply calibration offset (in 0.1°C units) */
-    *val = raw_temp + (sensor->temp_calibration * 10);
+static int demo_sensor_read_temp(struct demo_sensor *sensor, int *val)
+{
+    int humid;
+    int ret;
 
-out:
+    mutex_lock(&sensor->lock);
+    ret = demo_sensor_read_sample(sensor, STATUS_TEMP_READY, val, &humid);
     mutex_unlock(&sensor->lock);
+
     return ret;
 }
 
 static int demo_sensor_read_humidity(struct demo_sensor *sensor, int *val)
 {
-    unsigned int humid_l, humid_h;
-    u16 raw_humid;
+    int temp;
     int ret;
 
     mutex_lock(&sensor->lock);
+    ret = demo_sensor_read_sample(sensor, STATUS_HUMID_READY, &temp, val);
+    mutex_unlock(&sensor->lock);
 
-    /* Trigger conversion if needed */
-    ret = regmap_update_bits(sensor->regmap, REG_CONFIG, CFG_ENABLE, CFG_ENABLE);
-    if (ret)
-        goto out;
-
-    /* Wait for humidity ready */
-    ret = demo_sensor_wait_ready(sensor, STATUS_HUMID_READY);
-    if (ret)
-        goto out;
-
-    /* Read humidity registers */
-    ret = regmap_read(sensor->regmap, REG_HUMID_L, &humid_l);
-    if (ret)
-        goto out;
+    return ret;
+}
 
-    ret = regmap_read(sensor->regmap, REG_HUMID_H, &humid_h);
-    if (ret)
-        goto out;
+/* Runs in the trigger's thread; both channels come from one bulk read */
+static irqreturn_t demo_sensor_trigger_handler(int irq, void *p)
+{
+    struct iio_poll_func *pf = p;
+    struct iio_dev *indio_dev = pf->indio_dev;
+    struct demo_sensor *sensor = iio_priv(indio_dev);
+    int temp, humid;
+    int ret;
 
-    raw_humid = (humid_h << 8) | humid_l;
+    mutex_lock(&sensor->lock);
 
-    /* Apply calibration offset (in 0.1% units) */
-    *val = raw_humid + (sensor->humid_calibration * 10);
+    ret = demo_sensor_read_sample(sensor, STATUS_TEMP_READY | STATUS_HUMID_READY,
+                                  &temp, &humid);
+    if (!ret) {
+        sensor->scan.chan[DEMO_SCAN_TEMP] = temp;
+        sensor->scan.chan[DEMO_SCAN_HUMID] = humid;
+        iio_push_to_buffers_with_timestamp(indio_dev, &sensor->scan,
+                                           pf->timestamp);
+    }
 
-out:
     mutex_unlock(&sensor->lock);
-    return ret;
+
+    iio_trigger_notify_done(indio_dev->trig);
+    return IRQ_HANDLED;
 }
 
 static int demo_sensor_read_raw(struct iio_dev *indio_dev,
@@ -202,23 +228,30 @@ static int demo_sensor_read_raw(struct iio_dev *indio_dev,
 
     switch (mask) {
     case IIO_CHAN_INFO_RAW:
+        /* The buffer owns the bus while it is running */
+        ret = iio_device_claim_direct_mode(indio_dev);
+        if (ret)
+            return ret;
+
         switch (chan->type) {
         case IIO_TEMP:
             ret = demo_sensor_read_temp(sensor, val);
-            if (ret)
-                return ret;
-            return IIO_VAL_INT;
+            break;
 
         case IIO_HUMIDITYRELATIVE:
             ret = demo_sensor_read_humidity(sensor, val);
-            if (ret)
-                return ret;
-            return IIO_VAL_INT;
+            break;
 
         default:
-            return -EINVAL;
+            ret = -EINVAL;
+            break;
         }
 
+        iio_device_release_direct_mode(indio_dev);
+        if (ret)
+            return ret;
+        return IIO_VAL_INT;
+
     case IIO_CHAN_INFO_SCALE:
         /* Temperature: raw value in 0.01°C, scale to °C */
         /* Humidity: raw value in 0.01%, scale to % */
@@ -281,13 +314,34 @@ static const struct iio_chan_spec demo_sensor_channels[] = {
                               BIT(IIO_CHAN_INFO_CALIBBIAS),
         .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE) |
                                     BIT(IIO_CHAN_INFO_OFFSET),
+        .scan_index = DEMO_SCAN_TEMP,
+        .scan_type = {
+            .sign = 's',
+            .realbits = 16,
+            .storagebits = 16,
+            .endianness = IIO_CPU,
+        },
     },
     {
         .type = IIO_HUMIDITYRELATIVE,
         .info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |
                               BIT(IIO_CHAN_INFO_CALIBBIAS),
         .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),
+        .scan_index = DEMO_SCAN_HUMID,
+        .scan_type = {
+            .sign = 'u',
+            .realbits = 16,
+            .storagebits = 16,
+            .endianness = IIO_CPU,
+        },
     },
+    IIO_CHAN_SOFT_TIMESTAMP(DEMO_SCAN_TIMESTAMP),
+};
+
+/* Both channels are always read; the core demuxes to what is enabled */
+static const unsigned long demo_sensor_scan_masks[] = {
+    BIT(DEMO_SCAN_TEMP) | BIT(DEMO_SCAN_HUMID),
+    0
 };
 
 static const struct iio_info demo_sensor_info = {
@@ -352,6 +406,15 @@ static int demo_sensor_probe(struct i2c_client *client)
     indio_dev->channels = demo_sensor_channels;
     indio_dev->num_channels = ARRAY_SIZE(demo_sensor_channels);
     indio_dev->modes = INDIO_DIRECT_MODE;
+    indio_dev->available_scan_masks = demo_sensor_scan_masks;
+
+    /* kfifo buffer filled from whichever trigger user space attaches */
+    ret = devm_iio_triggered_buffer_setup(&client->dev, indio_dev,
+                                          iio_pollfunc_store_time,
+                                          demo_sensor_trigger_handler, NULL);
+    if (ret)
+        return dev_err_probe(&client->dev, ret,
+                             "Failed to setup triggered buffer\n");
 
     i2c_set_clientdata(client, indio_dev);
 
@@ -14,6 +14,11 @@
 #include <linux/uaccess.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/err.h>
+#include <linux/string.h>
 
 /* SPI Flash commands (simulated) */
 #define CMD_READ_ID         0x9F
@@ -21,6 +26,9 @@
 #define CMD_WRITE_ENABLE    0x06
 #define CMD_WRITE_DISABLE   0x04
 #define CMD_READ_DATA       0x03
+#define CMD_FAST_READ       0x0B
+#define CMD_DUAL_READ       0x3B    /* Dual output fast read */
+#define CMD_QUAD_READ       0x6B    /* Quad output fast read */
 #define CMD_PAGE_PROGRAM    0x02
 #define CMD_SECTOR_ERASE    0x20
 #define CMD_CHIP_ERASE      0xC7
@@ -33,9 +41,90 @@
 #define FLASH_PAGE_SIZE     256
 #define FLASH_SECTOR_SIZE   4096
 #define FLASH_SIZE          (64 * 1024)  /* 64KB simulated flash */
+#define FLASH_XFER_MAX      (16 * 1024)  /* Bounce buffer upper bound */
+#define FLASH_DUMMY_MAX     1            /* Dummy bytes after address */
+
+/* Async write status polling: backoff from MIN to MAX, give up after timeout */
+#define FLASH_POLL_MIN_NS   20000U
+#define FLASH_POLL_MAX_NS   500000U
+#define FLASH_PROGRAM_TIMEOUT_MS 10
 
 #define DEMO_FLASH_MAGIC    0xDE
 
+/* Read commands, slowest first */
+enum demo_flash_read_mode {
+    READ_MODE_NORMAL,
+    READ_MODE_FAST,
+    READ_MODE_DUAL,
+    READ_MODE_QUAD,
+};
+
+static const struct demo_flash_read_op {
+    u8 opcode;
+    u8 dummy;               /* Dummy bytes (8 clocks each) after address */
+    u8 nbits;               /* Bus width of the data phase */
+} demo_flash_read_ops[] = {
+    [READ_MODE_NORMAL] = { CMD_READ_DATA, 0, SPI_NBITS_SINGLE },
+    [READ_MODE_FAST]   = { CMD_FAST_READ, 1, SPI_NBITS_SINGLE },
+    [READ_MODE_DUAL]   = { CMD_DUAL_READ, 1, SPI_NBITS_DUAL },
+    [READ_MODE_QUAD]   = { CMD_QUAD_READ, 1, SPI_NBITS_QUAD },
+};
+
+static const char * const read_mode_names[] = {
+    [READ_MODE_NORMAL] = "normal",
+    [READ_MODE_FAST]   = "fast",
+    [READ_MODE_DUAL]   = "dual",
+    [READ_MODE_QUAD]   = "quad",
+};
+
+static char *read_mode = "auto";
+module_param(read_mode, charp, 0444);
+MODULE_PARM_DESC(read_mode, "Read command: auto, normal, fast, dual or quad (default: auto)");
+
+static bool async_write = true;
+module_param(async_write, bool, 0644);
+MODULE_PARM_DESC(async_write, "Program pages with spi_async() and timer-driven polling (default: on)");
+
+static unsigned int cache_sectors = 4;
+module_param(cache_sectors, uint, 0444);
+MODULE_PARM_DESC(cache_sectors, "Sectors held in the write cache, 0 to write through (default: 4)");
+
+/* Returned by FLASH_IOC_GETSTATS */
+struct demo_flash_stats {
+    u32 pages_programmed;
+    u32 pages_skipped;    /* Unchanged at flush, not programmed */
+    u32 erases;
+    u32 erases_avoided;   /* Dirty sectors flushed without an erase */
+};
+
+/* One cached sector; both buffers are kmalloc'd so they can be DMA'd */
+struct demo_flash_sector {
+    u8 *data;               /* Contents including unflushed writes */
+    u8 *orig;               /* Contents on flash */
+    u32 addr;
+    bool valid;
+    bool dirty;
+    unsigned long last_use;
+};
+
+/* Page-at-a-time write engine driven by SPI completions and a poll timer */
+struct demo_flash_async {
+    struct spi_message msg;
+    struct spi_transfer xfer[3];
+    struct hrtimer poll_timer;
+    struct completion done;
+    const u8 *buf;
+    u32 addr;
+    size_t len;
+    size_t pos;             /* Bytes programmed so far */
+    size_t page_len;        /* Bytes in the page being programmed */
+    unsigned int poll_ns;   /* Delay before the next status poll */
+    ktime_t deadline;
+    unsigned int pages;
+    unsigned int polls;
+    int status;
+};
+
 struct demo_flash {
     struct spi_device *spi;
     struct miscdevice miscdev;
@@ -44,8 +133,32 @@ struct demo_flash {
     size_t size;
     u8 manufacturer_id;
     u16 device_id;
+    enum demo_flash_read_mode read_mode;
+    u8 *xfer_buf;           /* kmalloc'd bounce buffer, DMA-safe */
+    size_t xfer_size;       /* Largest read that fits one message */
+    struct demo_flash_async aw;
+    struct demo_flash_sector *cache;
+    unsigned int cache_count;
+    unsigned long cache_clock;  /* LRU stamp source */
+    struct demo_flash_stats stats;
+
+    /* Command + address + dummy, on its own cacheline for DMA */
+    u8 cmd[4 + FLASH_DUMMY_MAX] ____cacheline_aligned;
+
+    /* Async write: WREN, PP + address, RDSR; status is received apart */
+    u8 wr_cmd[6] ____cacheline_aligned;
+    u8 wr_status ____cacheline_aligned;
 };
 
+/* Load opcode and 24-bit address into the command buffer */
+static void demo_flash_set_cmd(struct demo_flash *flash, u8 opcode, u32 addr)
+{
+    flash->cmd[0] = opcode;
+    flash->cmd[1] = (addr >> 16) & 0xFF;
+    flash->cmd[2] = (addr >> 8) & 0xFF;
+    flash->cmd[3] = addr & 0xFF;
+}
+
 /* Read flash status register */
 static int demo_flash_read_status(struct demo_flash *flash, u8 *status)
 {
@@ -79,9 +192,9 @@ static int demo_flash_wait_ready(struct demo_flash *flash, unsigned int timeout_
 /* Enable write operations */
 static int demo_flash_write_enable(struct demo_flash *flash)
 {
-    u8 cmd = CMD_WRITE_ENABLE;
+    flash->cmd[0] = CMD_WRITE_ENABLE;
 
-    return spi_write(flash->spi, &cmd, 1);
+    return spi_write(flash->spi, flash->cmd, 1);
 }
 
 /* Read flash ID */
@@ -104,30 +217,35 @@ static int demo_flash_read_id(struct demo_flash *flash)
     return 0;
 }
 
-/* Read data from flash */
-static int demo_flash_read(struct demo_flash *flash, u32 addr, u8 *buf, size_t len)
+/*
+ * Read up to xfer_size bytes into the bounce buffer with a single message.
+ * The command and address always go out on one line; dual and quad modes
+ * only widen the data phase.
+ */
+static int demo_flash_read(struct demo_flash *flash, u32 addr, size_t len)
 {
+    const struct demo_flash_read_op *op = &demo_flash_read_ops[flash->read_mode];
     struct spi_transfer t[2];
     struct spi_message m;
-    u8 cmd[4];
     int ret;
 
+    if (len > flash->xfer_size)
+        return -EINVAL;
+
     if (addr + len > flash->size)
         return -EINVAL;
 
-    /* Command + 24-bit address */
-    cmd[0] = CMD_READ_DATA;
-    cmd[1] = (addr >> 16) & 0xFF;
-    cmd[2] = (addr >> 8) & 0xFF;
-    cmd[3] = addr & 0xFF;
+    demo_flash_set_cmd(flash, op->opcode, addr);
+    memset(&flash->cmd[4], 0, op->dummy);
 
     memset(t, 0, sizeof(t));
 
-    t[0].tx_buf = cmd;
-    t[0].len = 4;
+    t[0].tx_buf = flash->cmd;
+    t[0].len = 4 + op->dummy;
 
-    t[1].rx_buf = buf;
+    t[1].rx_buf = flash->xfer_buf;
     t[1].len = len;
+    t[1].rx_nbits = op->nbits;
 
     spi_message_init(&m);
     spi_message_add_tail(&t[0], &m);
@@ -138,7 +256,27 @@ static int demo_flash_read(struct demo_flash *flash, u32 addr, u8 *buf, size_t l
         return ret;
 
     /* For simulation: copy from internal buffer */
-    memcpy(buf, flash->buffer + addr, len);
+    memcpy(flash->xfer_buf, flash->buffer + addr, len);
+
+    return 0;
+}
+
+/* Read any length into a kernel buffer, one message per bounce buffer */
+static int demo_flash_read_buf(struct demo_flash *flash, u32 addr, u8 *buf, size_t len)
+{
+    size_t done = 0, chunk;
+    int ret;
+
+    while (done < len) {
+        chunk = min(len - done, flash->xfer_size);
+
+        ret = demo_flash_read(flash, addr + done, chunk);
+        if (ret)
+            return ret;
+
+        memcpy(buf + done, flash->xfer_buf, chunk);
+        done += chunk;
+    }
 
     return 0;
 }
@@ -149,7 +287,6 @@ static int demo_flash_program_page(struct demo_flash *flash, u32 addr,
 {
     struct spi_transfer t[2];
     struct spi_message m;
-    u8 cmd[4];
     int ret;
 
     if (len > FLASH_PAGE_SIZE)
@@ -162,15 +299,11 @@ static int demo_flash_program_page(struct demo_flash *flash, u32 addr,
     if (ret)
         return ret;
 
-    /* Command + 24-bit address */
-    cmd[0] = CMD_PAGE_PROGRAM;
-    cmd[1] = (addr >> 16) & 0xFF;
-    cmd[2] = (addr >> 8) & 0xFF;
-    cmd[3] = addr & 0xFF;
+    demo_flash_set_cmd(flash, CMD_PAGE_PROGRAM, addr);
 
     memset(t, 0, sizeof(t));
 
-    t[0].tx_buf = cmd;
+    t[0].tx_buf = flash->cmd;
     t[0].len = 4;
 
     t[1].tx_buf = buf;
@@ -213,10 +346,175 @@ static int demo_flash_write(struct demo_flash *flash, u32 addr,
     return 0;
 }
 
+/*
+ * Async write engine. Each page is one message of WREN (with a chip select
+ * toggle so the latch takes effect) followed by Page Program. Its
+ * completion arms an hrtimer that queues a status read, backing off
+ * exponentially while the flash is busy. When WIP clears, the status
+ * completion queues the next page. All of this runs from SPI completion
+ * and timer context, so the writer sleeps once per write instead of once
+ * per page.
+ */
+static void demo_flash_async_finish(struct demo_flash *flash, int status)
+{
+    flash->aw.status = status;
+    complete(&flash->aw.done);
+}
+
+static void demo_flash_async_programmed(void *context);
+static void demo_flash_async_polled(void *context);
+
+static void demo_flash_async_program(struct demo_flash *flash)
+{
+    struct demo_flash_async *aw = &flash->aw;
+    u32 addr = aw->addr + aw->pos;
+    size_t page_offset = addr % FLASH_PAGE_SIZE;
+    int ret;
+
+    aw->page_len = min(FLASH_PAGE_SIZE - page_offset, aw->len - aw->pos);
+
+    flash->wr_cmd[0] = CMD_WRITE_ENABLE;
+    flash->wr_cmd[1] = CMD_PAGE_PROGRAM;
+    flash->wr_cmd[2] = (addr >> 16) & 0xFF;
+    flash->wr_cmd[3] = (addr >> 8) & 0xFF;
+    flash->wr_cmd[4] = addr & 0xFF;
+    flash->wr_cmd[5] = CMD_READ_STATUS;
+
+    memset(aw->xfer, 0, sizeof(aw->xfer));
+
+    aw->xfer[0].tx_buf = &flash->wr_cmd[0];
+    aw->xfer[0].len = 1;
+    aw->xfer[0].cs_change = 1;
+
+    aw->xfer[1].tx_buf = &flash->wr_cmd[1];
+    aw->xfer[1].len = 4;
+
+    aw->xfer[2].tx_buf = aw->buf + aw->pos;
+    aw->xfer[2].len = aw->page_len;
+
+    spi_message_init(&aw->msg);
+    spi_message_add_tail(&aw->xfer[0], &aw->msg);
+    spi_message_add_tail(&aw->xfer[1], &aw->msg);
+    spi_message_add_tail(&aw->xfer[2], &aw->msg);
+    aw->msg.complete = demo_flash_async_programmed;
+    aw->msg.context = flash;
+
+    ret = spi_async(flash->spi, &aw->msg);
+    if (ret)
+        demo_flash_async_finish(flash, ret);
+}
+
+static void demo_flash_async_programmed(void *context)
+{
+    struct demo_flash *flash = context;
+    struct demo_flash_async *aw = &flash->aw;
+
+    if (aw->msg.status) {
+        demo_flash_async_finish(flash, aw->msg.status);
+        return;
+    }
+
+    /* For simulation: copy to internal buffer */
+    memcpy(flash->buffer + aw->addr + aw->pos, aw->buf + aw->pos, aw->page_len);
+    aw->pages++;
+
+    aw->poll_ns = FLASH_POLL_MIN_NS;
+    aw->deadline = ktime_add_ms(ktime_get(), FLASH_PROGRAM_TIMEOUT_MS);
+    hrtimer_start(&aw->poll_timer, ns_to_ktime(aw->poll_ns), HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart demo_flash_poll_timer(struct hrtimer *timer)
+{
+    struct demo_flash *flash = container_of(timer, struct demo_flash, aw.poll_timer);
+    struct demo_flash_async *aw = &flash->aw;
+    int ret;
+
+    memset(aw->xfer, 0, sizeof(aw->xfer));
+
+    aw->xfer[0].tx_buf = &flash->wr_cmd[5];
+    aw->xfer[0].len = 1;
+
+    aw->xfer[1].rx_buf = &flash->wr_status;
+    aw->xfer[1].len = 1;
+
+    spi_message_init(&aw->msg);
+    spi_message_add_tail(&aw->xfer[0], &aw->msg);
+    spi_message_add_tail(&aw->xfer[1], &aw->msg);
+    aw->msg.complete = demo_flash_async_polled;
+    aw->msg.context = flash;
+    aw->polls++;
+
+    ret = spi_async(flash->spi, &aw->msg);
+    if (ret)
+        demo_flash_async_finish(flash, ret);
+
+    return HRTIMER_NORESTART;
+}
+
+static void demo_flash_async_polled(void *context)
+{
+    struct demo_flash *flash = context;
+    struct demo_flash_async *aw = &flash->aw;
+
+    if (aw->msg.status) {
+        demo_flash_async_finish(flash, aw->msg.status);
+        return;
+    }
+
+    if (flash->wr_status & STATUS_WIP) {
+        if (ktime_after(ktime_get(), aw->deadline)) {
+            demo_flash_async_finish(flash, -ETIMEDOUT);
+            return;
+        }
+
+        aw->poll_ns = min(aw->poll_ns * 2, FLASH_POLL_MAX_NS);
+        hrtimer_start(&aw->poll_timer, ns_to_ktime(aw->poll_ns), HRTIMER_MODE_REL);
+        return;
+    }
+
+    aw->pos += aw->page_len;
+    if (aw->pos == aw->len)
+        demo_flash_async_finish(flash, 0);
+    else
+        demo_flash_async_program(flash);
+}
+
+/* Write data with the async engine; buf must be DMA-safe */
+static int demo_flash_write_async(struct demo_flash *flash, u32 addr,
+                                  const u8 *buf, size_t len)
+{
+    struct demo_flash_async *aw = &flash->aw;
+    ktime_t start = ktime_get();
+
+    if (addr + len > flash->size)
+        return -EINVAL;
+
+    if (!len)
+        return 0;
+
+    aw->buf = buf;
+    aw->addr = addr;
+    aw->len = len;
+    aw->pos = 0;
+    aw->pages = 0;
+    aw->polls = 0;
+    aw->status = 0;
+    reinit_completion(&aw->done);
+
+    demo_flash_async_program(flash);
+
+    /* Messages in flight point at buf, so this wait cannot be interrupted */
+    wait_for_completion(&aw->done);
+
+    dev_dbg(&flash->spi->dev, "async write: %zu bytes, %u pages, %u polls, %lld us\n",
+            len, aw->pages, aw->polls, ktime_us_delta(ktime_get(), start));
+
+    return aw->status;
+}
+
 /* Erase a sector */
 static int demo_flash_erase_sector(struct demo_flash *flash, u32 addr)
 {
-    u8 cmd[4];
     int ret;
 
     /* Align to sector boundary */
@@ -229,12 +527,9 @@ static int demo_flash_erase_sector(struct demo_flash *flash, u32 addr)
     if (ret)
         return ret;
 
-    cmd[0] = CMD_SECTOR_ERASE;
-    cmd[1] = (addr >> 16) & 0xFF;
-    cmd[2] = (addr >> 8) & 0xFF;
-    cmd[3] = addr & 0xFF;
+    demo_flash_set_cmd(flash, CMD_SECTOR_ERASE, addr);
 
-    ret = spi_write(flash->spi, cmd, 4);
+    ret = spi_write(flash->spi, flash->cmd, 4);
     if (ret)
         return ret;
 
@@ -245,6 +540,172 @@ static int demo_flash_erase_sector(struct demo_flash *flash, u32 addr)
     return demo_flash_wait_ready(flash, 500);
 }
 
+/* Program pre-erased flash with whichever write path is selected */
+static int demo_flash_program(struct demo_flash *flash, u32 addr,
+                              const u8 *buf, size_t len)
+{
+    if (async_write)
+        return demo_flash_write_async(flash, addr, buf, len);
+
+    return demo_flash_write(flash, addr, buf, len);
+}
+
+/*
+ * Sector write cache. Writes land in a cached copy of the sector and are
+ * merged there until the sector is flushed on fsync, close, FLASH_IOC_SYNC,
+ * eviction or removal. A flush compares the copy with what is on flash:
+ * programming can only clear bits, so the sector is erased only when some
+ * bit must go from 0 to 1, and only pages that differ are programmed.
+ */
+static struct demo_flash_sector *demo_flash_cache_find(struct demo_flash *flash,
+                                                       u32 addr)
+{
+    unsigned int i;
+
+    addr &= ~(FLASH_SECTOR_SIZE - 1);
+
+    for (i = 0; i < flash->cache_count; i++) {
+        if (flash->cache[i].valid && flash->cache[i].addr == addr)
+            return &flash->cache[i];
+    }
+
+    return NULL;
+}
+
+/* Shorten an uncached read so it stops where a cached sector begins */
+static size_t demo_flash_cache_clip(struct demo_flash *flash, u32 addr, size_t len)
+{
+    struct demo_flash_sector *sec;
+    unsigned int i;
+
+    for (i = 0; i < flash->cache_count; i++) {
+        sec = &flash->cache[i];
+        if (sec->valid && sec->addr > addr && sec->addr < addr + len)
+            len = sec->addr - addr;
+    }
+
+    return len;
+}
+
+/* True if going from old to new needs some bit set from 0 to 1 */
+static bool demo_flash_needs_erase(const u8 *old, const u8 *new)
+{
+    const unsigned long *o = (const unsigned long *)old;
+    const unsigned long *n = (const unsigned long *)new;
+    size_t i;
+
+    for (i = 0; i < FLASH_SECTOR_SIZE / sizeof(long); i++) {
+        if (n[i] & ~o[i])
+            return true;
+    }
+
+    return false;
+}
+
+static int demo_flash_cache_flush(struct demo_flash *flash,
+                                  struct demo_flash_sector *sec)
+{
+    size_t off, start;
+    int ret;
+
+    if (!sec->valid || !sec->dirty)
+        return 0;
+
+    if (demo_flash_needs_erase(sec->orig, sec->data)) {
+        ret = demo_flash_erase_sector(flash, sec->addr);
+        if (ret)
+            return ret;
+        memset(sec->orig, 0xFF, FLASH_SECTOR_SIZE);
+        flash->stats.erases++;
+    } else {
+        flash->stats.erases_avoided++;
+    }
+
+    /* Program each run of changed pages with one call */
+    off = 0;
+    while (off < FLASH_SECTOR_SIZE) {
+        if (!memcmp(sec->data + off, sec->orig + off, FLASH_PAGE_SIZE)) {
+            flash->stats.pages_skipped++;
+            off += FLASH_PAGE_SIZE;
+            continue;
+        }
+
+        start = off;
+        while (off < FLASH_SECTOR_SIZE &&
+               memcmp(sec->data + off, sec->orig + off, FLASH_PAGE_SIZE)) {
+            flash->stats.pages_programmed++;
+            off += FLASH_PAGE_SIZE;
+        }
+
+        ret = demo_flash_program(flash, sec->addr + start, sec->data + start,
+                                 off - start);
+        if (ret)
+            return ret;
+
+        memcpy(sec->orig + start, sec->data + start, off - start);
+    }
+
+    sec->dirty = false;
+    return 0;
+}
+
+static int demo_flash_cache_sync(struct demo_flash *flash)
+{
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < flash->cache_count; i++) {
+        ret = demo_flash_cache_flush(flash, &flash->cache[i]);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* Look up the sector holding addr, loading it into a free or LRU slot */
+static struct demo_flash_sector *demo_flash_cache_get(struct demo_flash *flash,
+                                                      u32 addr)
+{
+    struct demo_flash_sector *sec, *victim = NULL;
+    unsigned int i;
+    int ret;
+
+    sec = demo_flash_cache_find(flash, addr);
+    if (sec) {
+        sec->last_use = ++flash->cache_clock;
+        return sec;
+    }
+
+    for (i = 0; i < flash->cache_count; i++) {
+        sec = &flash->cache[i];
+        if (!sec->valid) {
+            victim = sec;
+            break;
+        }
+        if (!victim || sec->last_use < victim->last_use)
+            victim = sec;
+    }
+
+    ret = demo_flash_cache_flush(flash, victim);
+    if (ret)
+        return ERR_PTR(ret);
+
+    victim->valid = false;
+    victim->addr = addr & ~(FLASH_SECTOR_SIZE - 1);
+
+    ret = demo_flash_read_buf(flash, victim->addr, victim->orig, FLASH_SECTOR_SIZE);
+    if (ret)
+        return ERR_PTR(ret);
+
+    memcpy(victim->data, victim->orig, FLASH_SECTOR_SIZE);
+    victim->valid = true;
+    victim->dirty = false;
+    victim->last_use = ++flash->cache_clock;
+
+    return victim;
+}
+
 /* Character device operations */
 static int demo_flash_open(struct inode *inode, struct file *file)
 {
@@ -258,8 +719,8 @@ static ssize_t demo_flash_fread(struct file *file, char __user *buf,
                                 size_t count, loff_t *ppos)
 {
     struct demo_flash *flash = file->private_data;
-    u8 *kbuf;
-    int ret;
+    size_t done = 0, chunk;
+    int ret = 0;
 
     if (*ppos >= flash->size)
         return 0;
@@ -267,35 +728,51 @@ static ssize_t demo_flash_fread(struct file *file, char __user *buf,
     if (*ppos + count > flash->size)
         count = flash->size - *ppos;
 
-    kbuf = kmalloc(count, GFP_KERNEL);
-    if (!kbuf)
-        return -ENOMEM;
-
+    /*
+     * One message per bounce buffer, copied straight out to user space.
+     * Cached sectors are served from the cache so unflushed writes show.
+     */
     mutex_lock(&flash->lock);
-    ret = demo_flash_read(flash, *ppos, kbuf, count);
+    while (done < count) {
+        u32 pos = *ppos + done;
+        struct demo_flash_sector *sec = demo_flash_cache_find(flash, pos);
+        const u8 *src;
+
+        if (sec) {
+            chunk = min_t(size_t, count - done,
+                          sec->addr + FLASH_SECTOR_SIZE - pos);
+            src = sec->data + (pos - sec->addr);
+        } else {
+            chunk = demo_flash_cache_clip(flash, pos,
+                                          min(count - done, flash->xfer_size));
+            ret = demo_flash_read(flash, pos, chunk);
+            if (ret)
+                break;
+            src = flash->xfer_buf;
+        }
+
+        if (copy_to_user(buf + done, src, chunk)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        done += chunk;
+    }
     mutex_unlock(&flash->lock);
 
-    if (ret) {
-        kfree(kbuf);
+    if (!done)
         return ret;
-    }
 
-    if (copy_to_user(buf, kbuf, count)) {
-        kfree(kbuf);
-        return -EFAULT;
-    }
-
-    kfree(kbuf);
-    *ppos += count;
-    return count;
+    *ppos += done;
+    return done;
 }
 
 static ssize_t demo_flash_fwrite(struct file *file, const char __user *buf,
                                  size_t count, loff_t *ppos)
 {
     struct demo_flash *flash = file->private_data;
-    u8 *kbuf;
-    int ret;
+    size_t done = 0, chunk;
+    int ret = 0;
 
     if (*ppos >= flash->size)
         return -ENOSPC;
@@ -303,26 +780,73 @@ static ssize_t demo_flash_fwrite(struct file *file, const char __user *buf,
     if (*ppos + count > flash->size)
         count = flash->size - *ppos;
 
-    kbuf = kmalloc(count, GFP_KERNEL);
-    if (!kbuf)
-        return -ENOMEM;
-
-    if (copy_from_user(kbuf, buf, count)) {
-        kfree(kbuf);
-        return -EFAULT;
+    /*
+     * With the cache, copy into the cached sector and leave programming
+     * to the flush. Without it, stage through the DMA-safe bounce buffer
+     * and program straight away.
+     */
+    mutex_lock(&flash->lock);
+    while (done < count) {
+        u32 pos = *ppos + done;
+
+        if (flash->cache_count) {
+            struct demo_flash_sector *sec = demo_flash_cache_get(flash, pos);
+            size_t off;
+
+            if (IS_ERR(sec)) {
+                ret = PTR_ERR(sec);
+                break;
+            }
+
+            off = pos - sec->addr;
+            chunk = min(count - done, FLASH_SECTOR_SIZE - off);
+
+            if (copy_from_user(sec->data + off, buf + done, chunk)) {
+                ret = -EFAULT;
+                break;
+            }
+            sec->dirty = true;
+        } else {
+            chunk = min(count - done, flash->xfer_size);
+
+            if (copy_from_user(flash->xfer_buf, buf + done, chunk)) {
+                ret = -EFAULT;
+                break;
+            }
+
+            ret = demo_flash_program(flash, pos, flash->xfer_buf, chunk);
+            if (ret)
+                break;
+        }
+
+        done += chunk;
     }
+    mutex_unlock(&flash->lock);
+
+    if (!done)
+        return ret;
+
+    *ppos += done;
+    return done;
+}
+
+static int demo_flash_fsync(struct file *file, loff_t start, loff_t end,
+                            int datasync)
+{
+    struct demo_flash *flash = file->private_data;
+    int ret;
 
     mutex_lock(&flash->lock);
-    ret = demo_flash_write(flash, *ppos, kbuf, count);
+    ret = demo_flash_cache_sync(flash);
     mutex_unlock(&flash->lock);
 
-    kfree(kbuf);
-
-    if (ret)
-        return ret;
+    return ret;
+}
 
-    *ppos += count;
-    return count;
+/* Flush on every close() so write errors reach the caller */
+static int demo_flash_flush(struct file *file, fl_owner_t id)
+{
+    return demo_flash_fsync(file, 0, LLONG_MAX, 0);
 }
 
 static loff_t demo_flash_llseek(struct file *file, loff_t offset, int whence)
@@ -336,11 +860,15 @@ static loff_t demo_flash_llseek(struct file *file, loff_t offset, int whence)
 #define FLASH_IOC_MAGIC     'F'
 #define FLASH_IOC_ERASE     _IOW(FLASH_IOC_MAGIC, 1, u32)
 #define FLASH_IOC_GETSIZE   _IOR(FLASH_IOC_MAGIC, 2, u32)
+#define FLASH_IOC_SYNC      _IO(FLASH_IOC_MAGIC, 3)
+#define FLASH_IOC_GETSTATS  _IOR(FLASH_IOC_MAGIC, 4, struct demo_flash_stats)
 
 static long demo_flash_ioctl(struct file *file, unsigned int cmd,
                              unsigned long arg)
 {
     struct demo_flash *flash = file->private_data;
+    struct demo_flash_stats stats;
+    struct demo_flash_sector *sec;
     u32 addr;
     int ret;
 
@@ -350,10 +878,26 @@ static long demo_flash_ioctl(struct file *file, unsigned int cmd,
             return -EFAULT;
 
         mutex_lock(&flash->lock);
+        /* Pending writes to the sector are overridden by the erase */
+        sec = demo_flash_cache_find(flash, addr);
+        if (sec)
+            sec->valid = false;
         ret = demo_flash_erase_sector(flash, addr);
         mutex_unlock(&flash->lock);
         return ret;
 
+    case FLASH_IOC_SYNC:
+        return demo_flash_fsync(file, 0, LLONG_MAX, 0);
+
+    case FLASH_IOC_GETSTATS:
+        mutex_lock(&flash->lock);
+        stats = flash->stats;
+        mutex_unlock(&flash->lock);
+
+        if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+            return -EFAULT;
+        return 0;
+
     case FLASH_IOC_GETSIZE:
         if (copy_to_user((void __user *)arg, &flash->size, sizeof(flash->size)))
             return -EFAULT;
@@ -370,16 +914,79 @@ static const struct file_operations demo_flash_fops = {
     .read = demo_flash_fread,
     .write = demo_flash_fwrite,
     .llseek = demo_flash_llseek,
+    .fsync = demo_flash_fsync,
+    .flush = demo_flash_flush,
     .unlocked_ioctl = demo_flash_ioctl,
 };
 
+/*
+ * Pick the fastest read the controller can do. spi_setup() has already
+ * dropped any SPI_RX_DUAL/QUAD bit from the device tree bus width that the
+ * controller does not support. Fast Read needs no controller support.
+ */
+static int demo_flash_pick_read_mode(struct spi_device *spi)
+{
+    int best, mode;
+
+    if (spi->mode & SPI_RX_QUAD)
+        best = READ_MODE_QUAD;
+    else if (spi->mode & SPI_RX_DUAL)
+        best = READ_MODE_DUAL;
+    else
+        best = READ_MODE_FAST;
+
+    if (!strcmp(read_mode, "auto"))
+        return best;
+
+    mode = match_string(read_mode_names, ARRAY_SIZE(read_mode_names), read_mode);
+    if (mode < 0) {
+        dev_err(&spi->dev, "Invalid read_mode '%s'\n", read_mode);
+        return -EINVAL;
+    }
+
+    if (mode > best) {
+        dev_warn(&spi->dev, "%s read not supported, using %s\n",
+                 read_mode_names[mode], read_mode_names[best]);
+        mode = best;
+    }
+
+    return mode;
+}
+
+static int demo_flash_cache_init(struct demo_flash *flash)
+{
+    struct device *dev = &flash->spi->dev;
+    unsigned int i;
+
+    flash->cache_count = min_t(unsigned int, cache_sectors,
+                               flash->size / FLASH_SECTOR_SIZE);
+    if (!flash->cache_count)
+        return 0;
+
+    flash->cache = devm_kcalloc(dev, flash->cache_count,
+                                sizeof(*flash->cache), GFP_KERNEL);
+    if (!flash->cache)
+        return -ENOMEM;
+
+    for (i = 0; i < flash->cache_count; i++) {
+        flash->cache[i].data = devm_kmalloc(dev, FLASH_SECTOR_SIZE, GFP_KERNEL);
+        flash->cache[i].orig = devm_kmalloc(dev, FLASH_SECTOR_SIZE, GFP_KERNEL);
+        if (!flash->cache[i].data || !flash->cache[i].orig)
+            return -ENOMEM;
+    }
+
+    return 0;
+}
+
 static int demo_flash_probe(struct spi_device *spi)
 {
     struct demo_flash *flash;
+    size_t cmd_len;
     int ret;
 
-    /* Configure SPI */
-    spi->mode = SPI_MODE_0;
+    /* Configure SPI, keeping the bus width bits set from the device tree */
+    spi->mode &= ~SPI_MODE_X_MASK;
+    spi->mode |= SPI_MODE_0;
     spi->bits_per_word = 8;
     if (!spi->max_speed_hz)
         spi->max_speed_hz = 10000000;  /* 10 MHz default */
@@ -398,6 +1005,28 @@ static int demo_flash_probe(struct spi_device *spi)
     flash->spi = spi;
     flash->size = FLASH_SIZE;
     mutex_init(&flash->lock);
+    init_completion(&flash->aw.done);
+    hrtimer_init(&flash->aw.poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    flash->aw.poll_timer.function = demo_flash_poll_timer;
+
+    ret = demo_flash_pick_read_mode(spi);
+    if (ret < 0)
+        return ret;
+    flash->read_mode = ret;
+
+    /*
+     * Size reads so the command and data fit one message and the data one
+     * transfer. kmalloc memory is safe for the controller to DMA into,
+     * unlike the stack or a vmalloc'd user copy.
+     */
+    cmd_len = 4 + demo_flash_read_ops[flash->read_mode].dummy;
+    flash->xfer_size = min3(spi_max_transfer_size(spi),
+                            spi_max_message_size(spi) - cmd_len,
+                            (size_t)FLASH_XFER_MAX);
+
+    flash->xfer_buf = devm_kmalloc(&spi->dev, flash->xfer_size, GFP_KERNEL);
+    if (!flash->xfer_buf)
+        return -ENOMEM;
 
     /* Allocate internal buffer for simulation */
     flash->buffer = devm_kzalloc(&spi->dev, flash->size, GFP_KERNEL);
@@ -407,6 +1036,10 @@ static int demo_flash_probe(struct spi_device *spi)
     /* Initialize buffer to erased state (0xFF) */
     memset(flash->buffer, 0xFF, flash->size);
 
+    ret = demo_flash_cache_init(flash);
+    if (ret)
+        return ret;
+
     /* Read and verify flash ID */
     ret = demo_flash_read_id(flash);
     if (ret)
@@ -432,8 +1065,9 @@ static int demo_flash_probe(struct spi_device *spi)
 
     spi_set_drvdata(spi, flash);
 
-    dev_info(&spi->dev, "Demo SPI flash registered: %zu bytes, %d Hz\n",
-             flash->size, spi->max_speed_hz);
+    dev_info(&spi->dev, "Demo SPI flash registered: %zu bytes, %d Hz, %s read, %zu byte transfers\n",
+             flash->size, spi->max_speed_hz,
+             read_mode_names[flash->read_mode], flash->xfer_size);
 
     return 0;
 }
@@ -443,6 +1077,12 @@ static void demo_flash_remove(struct spi_device *spi)
     struct demo_flash *flash = spi_get_drvdata(spi);
 
     misc_deregister(&flash->miscdev);
+
+    mutex_lock(&flash->lock);
+    if (demo_flash_cache_sync(flash))
+        dev_warn(&spi->dev, "Failed to flush write cache\n");
+    mutex_unlock(&flash->lock);
+
     dev_info(&spi->dev, "Demo SPI flash removed\n");
 }
 